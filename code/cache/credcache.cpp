@@ -0,0 +1,176 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#include "credcache.h"
+#include <future>
+using namespace std;
+
+CredCache::CredCache(): isOpen_(false), shardCapacity_(0), ttl_(0), negativeTtl_(0) {}
+
+CredCache* CredCache::Instance() {
+    static CredCache inst;
+    return &inst;
+}
+
+void CredCache::Init(int shardNum, size_t capacity, int ttlMS, int negativeTtlMS) {
+    assert(shardNum > 0 && capacity > 0);
+    shards_.clear();
+    for(int i = 0; i < shardNum; i++) {
+        shards_.emplace_back(new Shard());
+    }
+    shardCapacity_ = capacity / shardNum > 0 ? capacity / shardNum : 1;
+    ttl_ = chrono::milliseconds(ttlMS);
+    negativeTtl_ = chrono::milliseconds(negativeTtlMS);
+    isOpen_ = true;
+}
+
+CredCache::Shard& CredCache::GetShard_(const string& name) {
+    assert(!shards_.empty());
+    return *shards_[hash<string>()(name) % shards_.size()];
+}
+
+bool CredCache::Lookup_(Shard& shard, const string& name, Credential* cred) {
+    auto it = shard.index.find(name);
+    if(it == shard.index.end()) {
+        return false;
+    }
+    if(it->second->expires <= Clock::now()) {
+        shard.lru.erase(it->second);
+        shard.index.erase(it);
+        return false;
+    }
+    shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+    *cred = it->second->cred;
+    return true;
+}
+
+void CredCache::Insert_(Shard& shard, const string& name, const Credential& cred) {
+    if(!cred.exist && negativeTtl_.count() <= 0) { return; }  // 关闭了负缓存
+    Clock::time_point expires = Clock::now() + (cred.exist ? ttl_ : negativeTtl_);
+    auto it = shard.index.find(name);
+    if(it != shard.index.end()) {
+        it->second->cred = cred;
+        it->second->expires = expires;
+        shard.lru.splice(shard.lru.begin(), shard.lru, it->second);
+        return;
+    }
+    shard.lru.push_front({name, cred, expires});
+    shard.index[name] = shard.lru.begin();
+    if(shard.lru.size() > shardCapacity_) {
+        shard.index.erase(shard.lru.back().name);
+        shard.lru.pop_back();
+    }
+}
+
+bool CredCache::Get(const string& name, Credential* cred) {
+    assert(cred);
+    Shard& shard = GetShard_(name);
+    lock_guard<mutex> locker(shard.mtx);
+    bool hit = Lookup_(shard, name, cred);
+    hit ? shard.hits++ : shard.misses++;
+    return hit;
+}
+
+void CredCache::Put(const string& name, const Credential& cred) {
+    Shard& shard = GetShard_(name);
+    lock_guard<mutex> locker(shard.mtx);
+    Insert_(shard, name, cred);
+}
+
+void CredCache::Invalidate(const string& name) {
+    Shard& shard = GetShard_(name);
+    lock_guard<mutex> locker(shard.mtx);
+    shard.version++;
+    auto it = shard.index.find(name);
+    if(it != shard.index.end()) {
+        shard.lru.erase(it->second);
+        shard.index.erase(it);
+    }
+}
+
+void CredCache::GetOrLoadAsync(const string& name, const LoadCallBack& cb, const AsyncLoader& loader) {
+    Shard& shard = GetShard_(name);
+    Credential cred;
+    uint64_t version = 0;
+    bool hit = false;
+    {
+        lock_guard<mutex> locker(shard.mtx);
+        hit = Lookup_(shard, name, &cred);
+        if(hit) {
+            shard.hits++;
+        } else {
+            shard.misses++;
+            auto it = shard.inflight.find(name);
+            if(it != shard.inflight.end()) {
+                /* 已有请求在查询同一个用户，挂在它上面等结果 */
+                it->second.push_back(cb);
+                return;
+            }
+            shard.inflight[name].push_back(cb);
+            version = shard.version;
+        }
+    }
+    if(hit) {
+        cb(true, cred);
+        return;
+    }
+    loader([this, name, version](bool ok, const Credential& result) {
+        Finish_(name, version, ok, result);
+    });
+}
+
+void CredCache::Finish_(const string& name, uint64_t version, bool ok, const Credential& cred) {
+    Shard& shard = GetShard_(name);
+    vector<LoadCallBack> waiters;
+    {
+        lock_guard<mutex> locker(shard.mtx);
+        if(ok && shard.version == version) {
+            Insert_(shard, name, cred);
+        }
+        auto it = shard.inflight.find(name);
+        if(it != shard.inflight.end()) {
+            waiters.swap(it->second);
+            shard.inflight.erase(it);
+        }
+    }
+    for(auto& waiter: waiters) {
+        waiter(ok, cred);
+    }
+}
+
+bool CredCache::GetOrLoad(const string& name, Credential* cred,
+                          const function<bool(Credential*)>& loader) {
+    assert(cred);
+    auto result = make_shared<promise<pair<bool, Credential>>>();
+    future<pair<bool, Credential>> fut = result->get_future();
+    GetOrLoadAsync(name, [result](bool ok, const Credential& c) {
+            result->set_value(make_pair(ok, c));
+        }, [&loader](const LoadCallBack& done) {
+            Credential c;
+            bool ok = loader(&c);
+            done(ok, c);
+        });
+    pair<bool, Credential> res = fut.get();
+    *cred = res.second;
+    return res.first;
+}
+
+size_t CredCache::Hits() const {
+    size_t n = 0;
+    for(auto& shard: shards_) {
+        lock_guard<mutex> locker(shard->mtx);
+        n += shard->hits;
+    }
+    return n;
+}
+
+size_t CredCache::Misses() const {
+    size_t n = 0;
+    for(auto& shard: shards_) {
+        lock_guard<mutex> locker(shard->mtx);
+        n += shard->misses;
+    }
+    return n;
+}
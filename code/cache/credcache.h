@@ -0,0 +1,92 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#ifndef CRED_CACHE_H
+#define CRED_CACHE_H
+
+#include <string>
+#include <list>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include <assert.h>
+
+/* 用户凭据，exist为false表示用户不存在(负缓存) */
+struct Credential {
+    bool exist = false;
+    std::string password;
+};
+
+/*
+ * 用户名 -> 凭据 的进程内缓存，放在数据库查询之前
+ * 按用户名哈希分片，每个分片一把锁、一条LRU链，容量满时淘汰最久未用的项
+ * 正/负缓存分别设置过期时间；并发未命中同一个用户名时只有一个调用者查询后端(single-flight)
+ */
+class CredCache {
+public:
+    /* 加载完成回调：ok为false表示后端查询失败，结果不缓存 */
+    typedef std::function<void(bool ok, const Credential& cred)> LoadCallBack;
+    /* 异步加载函数：查询后端，完成后调用传入的回调 */
+    typedef std::function<void(const LoadCallBack& done)> AsyncLoader;
+
+    static CredCache* Instance();
+
+    void Init(int shardNum, size_t capacity, int ttlMS, int negativeTtlMS);
+    bool IsOpen() const { return isOpen_; }
+
+    bool Get(const std::string& name, Credential* cred);
+    void Put(const std::string& name, const Credential& cred);
+    void Invalidate(const std::string& name);
+
+    /* 同步读取：未命中时在当前线程调用loader，并发的同名请求阻塞等待其结果 */
+    bool GetOrLoad(const std::string& name, Credential* cred,
+                   const std::function<bool(Credential*)>& loader);
+
+    /* 异步读取：命中时立即回调；未命中时第一个请求发起loader，其余请求挂在同一次加载上 */
+    void GetOrLoadAsync(const std::string& name, const LoadCallBack& cb, const AsyncLoader& loader);
+
+    size_t Hits() const;
+    size_t Misses() const;
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry {
+        std::string name;
+        Credential cred;
+        Clock::time_point expires;
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        std::list<Entry> lru;  // 表头为最近使用
+        std::unordered_map<std::string, std::list<Entry>::iterator> index;
+        std::unordered_map<std::string, std::vector<LoadCallBack>> inflight;  // 正在加载的用户名及等待者
+        uint64_t version = 0;  // 每次失效加一，避免加载中的旧结果覆盖失效
+        size_t hits = 0;
+        size_t misses = 0;
+    };
+
+    CredCache();
+    ~CredCache() = default;
+    CredCache(const CredCache&) = delete;
+    CredCache& operator=(const CredCache&) = delete;
+
+    Shard& GetShard_(const std::string& name);
+    bool Lookup_(Shard& shard, const std::string& name, Credential* cred);
+    void Insert_(Shard& shard, const std::string& name, const Credential& cred);
+    void Finish_(const std::string& name, uint64_t version, bool ok, const Credential& cred);
+
+    bool isOpen_;
+    size_t shardCapacity_;
+    std::chrono::milliseconds ttl_;
+    std::chrono::milliseconds negativeTtl_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+};
+
+#endif //CRED_CACHE_H
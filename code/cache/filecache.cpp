@@ -0,0 +1,133 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#include "filecache.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <chrono>
+#include <mutex>
+#include <assert.h>
+using namespace std;
+
+const int64_t FileCache::CHECK_MS;
+
+FileCache::FileCache(): isOpen_(false), maxFileBytes_(0), capacity_(0), bytes_(0), hits_(0), misses_(0) {}
+
+FileCache* FileCache::Instance() {
+    static FileCache inst;
+    return &inst;
+}
+
+void FileCache::Init(size_t maxFileBytes, size_t capacityBytes) {
+    assert(maxFileBytes > 0 && capacityBytes >= maxFileBytes);
+    unique_lock<shared_timed_mutex> locker(mtx_);
+    files_.clear();
+    bytes_ = 0;
+    maxFileBytes_ = maxFileBytes;
+    capacity_ = capacityBytes;
+    isOpen_ = true;
+}
+
+int64_t FileCache::NowMs_() {
+    return chrono::duration_cast<chrono::milliseconds>(
+                chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+FileCache::FilePtr FileCache::Load_(const string& path, const struct stat& st) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd < 0) { return nullptr; }
+    auto file = make_shared<CachedFile>();
+    file->st = st;
+    file->data.resize(st.st_size);
+    size_t got = 0;
+    while(got < file->data.size()) {
+        ssize_t n = read(fd, &file->data[got], file->data.size() - got);
+        if(n < 0 && errno == EINTR) { continue; }
+        if(n <= 0) { break; }
+        got += n;
+    }
+    close(fd);
+    if(got != file->data.size()) { return nullptr; }  // 读取期间文件被截断
+    return file;
+}
+
+FileCache::FilePtr FileCache::Get(const string& path, struct stat* st, int* statRet) {
+    if(!isOpen_) { return nullptr; }
+    FilePtr stale;
+    {
+        shared_lock<shared_timed_mutex> locker(mtx_);
+        auto it = files_.find(path);
+        if(it != files_.end()) {
+            Entry& entry = *it->second;
+            int64_t now = NowMs_();
+            int64_t checked = entry.checkedMs.load(memory_order_relaxed);
+            /* 检查间隔内直接返回；到期时只有一个线程去stat，其余线程继续用旧内容 */
+            if(now - checked < CHECK_MS || !entry.checkedMs.compare_exchange_strong(checked, now)) {
+                hits_++;
+                return entry.file;
+            }
+            stale = entry.file;
+        }
+    }
+
+    struct stat cur = { 0 };
+    int ret = stat(path.c_str(), &cur);
+    bool cacheable = ret == 0 && S_ISREG(cur.st_mode) && (cur.st_mode & S_IROTH)
+                     && static_cast<size_t>(cur.st_size) <= maxFileBytes_;
+    if(stale && cacheable && stale->st.st_size == cur.st_size && stale->st.st_mtim.tv_sec == cur.st_mtim.tv_sec
+       && stale->st.st_mtim.tv_nsec == cur.st_mtim.tv_nsec) {
+        hits_++;
+        return stale;  // 未修改
+    }
+    misses_++;
+    FilePtr file = cacheable ? Load_(path, cur) : nullptr;
+    if(!file) {
+        if(st) { *st = cur; }
+        if(statRet) { *statRet = ret; }
+        /* 404、过大或不可读的文件：没有旧条目要删除时不取独占锁，不阻塞其他读者 */
+        if(!stale) { return nullptr; }
+    }
+
+    unique_lock<shared_timed_mutex> locker(mtx_);
+    auto it = files_.find(path);
+    if(it != files_.end()) {
+        bytes_ -= it->second->file->data.size();
+        files_.erase(it);
+    }
+    if(file && bytes_ + file->data.size() <= capacity_) {
+        unique_ptr<Entry> entry(new Entry());
+        entry->file = file;
+        entry->checkedMs = NowMs_();
+        bytes_ += file->data.size();
+        files_.emplace(path, move(entry));
+    }
+    return file;
+}
+
+bool FileCache::Contains(const string& path, size_t maxBytes) {
+    if(!isOpen_) { return false; }
+    shared_lock<shared_timed_mutex> locker(mtx_);
+    auto it = files_.find(path);
+    return it != files_.end() && it->second->file->data.size() <= maxBytes;
+}
+
+vector<string> FileCache::Paths() {
+    vector<string> paths;
+    if(!isOpen_) { return paths; }
+    shared_lock<shared_timed_mutex> locker(mtx_);
+    paths.reserve(files_.size());
+    for(auto& file: files_) { paths.push_back(file.first); }
+    return paths;
+}
+
+size_t FileCache::Warm(const vector<string>& paths, const string& prefix) {
+    size_t loaded = 0;
+    for(const string& path: paths) {
+        /* 新版本的资源目录可能不同，只预热本进程会访问的路径 */
+        if(path.compare(0, prefix.size(), prefix) == 0 && Get(path)) { loaded++; }
+    }
+    return loaded;
+}
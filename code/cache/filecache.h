@@ -0,0 +1,79 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#ifndef FILE_CACHE_H
+#define FILE_CACHE_H
+
+#include <string>
+#include <memory>
+#include <atomic>
+#include <shared_mutex>
+#include <unordered_map>
+#include <vector>
+#include <sys/stat.h>
+#include <stdint.h>
+
+/* 缓存的静态文件，响应发送期间由HttpResponse持有引用 */
+struct CachedFile {
+    std::string data;
+    struct stat st;
+};
+
+/*
+ * 小静态文件的内存缓存，替代每个请求的stat + open + mmap
+ * 只缓存不超过maxFileBytes、其他用户可读的普通文件，总量到达容量后不再加入新文件
+ * 命中时每隔一秒最多stat一次，文件被修改则重新加载；读共享锁，加载与替换独占锁
+ */
+class FileCache {
+public:
+    static FileCache* Instance();
+
+    void Init(size_t maxFileBytes, size_t capacityBytes);
+    bool IsOpen() const { return isOpen_; }
+
+    /* 返回缓存的文件，未缓存时尝试加载；文件不存在或不可缓存返回nullptr
+       返回nullptr时，st、statRet非空则带回本次stat的结果与返回值，调用者不必再stat一次 */
+    std::shared_ptr<const CachedFile> Get(const std::string& path, struct stat* st = nullptr, int* statRet = nullptr);
+    /* 只查询不加载，用于判断请求能否在事件循环中直接完成 */
+    bool Contains(const std::string& path, size_t maxBytes);
+
+    /* 缓存中的全部路径，热重启时交给新进程 */
+    std::vector<std::string> Paths();
+    /* 加载paths中以prefix开头的文件，返回加载成功的个数 */
+    size_t Warm(const std::vector<std::string>& paths, const std::string& prefix);
+
+    size_t Hits() const { return hits_; }
+    size_t Misses() const { return misses_; }
+    size_t Bytes() const { return bytes_; }
+
+private:
+    typedef std::shared_ptr<const CachedFile> FilePtr;
+
+    struct Entry {
+        FilePtr file;
+        std::atomic<int64_t> checkedMs;  // 上次stat的时间
+    };
+
+    static const int64_t CHECK_MS = 1000;
+
+    FileCache();
+    ~FileCache() = default;
+    FileCache(const FileCache&) = delete;
+    FileCache& operator=(const FileCache&) = delete;
+
+    static int64_t NowMs_();
+    FilePtr Load_(const std::string& path, const struct stat& st);
+
+    bool isOpen_;
+    size_t maxFileBytes_;
+    size_t capacity_;
+    std::atomic<size_t> bytes_;
+    std::atomic<size_t> hits_;
+    std::atomic<size_t> misses_;
+    std::shared_timed_mutex mtx_;
+    std::unordered_map<std::string, std::unique_ptr<Entry>> files_;
+};
+
+#endif //FILE_CACHE_H
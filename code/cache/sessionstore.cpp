@@ -0,0 +1,200 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#include "sessionstore.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/random.h>  // getrandom
+#include <errno.h>
+#include <stdlib.h>
+#include <future>
+#include "../log/log.h"
+#include "../pool/redisasync.h"
+using namespace std;
+
+const size_t SessionStore::ID_LEN;
+const int SessionStore::REDIS_WAIT_MS;
+
+static const char* const REDIS_PREFIX = "sess:";
+
+SessionStore::SessionStore(): isOpen_(false), ttl_(0), redis_(nullptr), created_(0), expired_(0) {}
+
+SessionStore* SessionStore::Instance() {
+    static SessionStore inst;
+    return &inst;
+}
+
+void SessionStore::Init(int shardNum, int ttlMS, RedisAsync* redis) {
+    assert(shardNum > 0 && shardNum <= 256 && ttlMS > 0);
+    shards_.clear();
+    for(int i = 0; i < shardNum; i++) {
+        shards_.emplace_back(new Shard());
+    }
+    ttl_ = chrono::milliseconds(ttlMS);
+    redis_ = redis;
+    isOpen_ = true;
+}
+
+/* 内核随机数，getrandom不可用时退回/dev/urandom */
+bool SessionStore::RandomId_(string* id) {
+    static const char HEX[] = "0123456789abcdef";
+    unsigned char buf[ID_LEN / 2];
+    size_t got = 0;
+    while(got < sizeof(buf)) {
+        ssize_t n = getrandom(buf + got, sizeof(buf) - got, 0);
+        if(n < 0 && errno == EINTR) { continue; }
+        if(n <= 0) { break; }
+        got += n;
+    }
+    if(got < sizeof(buf)) {
+        int fd = open("/dev/urandom", O_RDONLY | O_CLOEXEC);
+        if(fd < 0) { return false; }
+        got = 0;
+        while(got < sizeof(buf)) {
+            ssize_t n = read(fd, buf + got, sizeof(buf) - got);
+            if(n < 0 && errno == EINTR) { continue; }
+            if(n <= 0) { break; }
+            got += n;
+        }
+        close(fd);
+        if(got < sizeof(buf)) { return false; }
+    }
+    id->resize(ID_LEN);
+    for(size_t i = 0; i < sizeof(buf); i++) {
+        (*id)[2 * i] = HEX[buf[i] >> 4];
+        (*id)[2 * i + 1] = HEX[buf[i] & 0xf];
+    }
+    return true;
+}
+
+bool SessionStore::IsValidId_(const string& id) {
+    if(id.size() != ID_LEN) { return false; }
+    for(char c: id) {
+        if(!((c >= '0' && c <= '9') || (c >= 'a' && c <= 'f'))) { return false; }
+    }
+    return true;
+}
+
+/* 会话ID是均匀的随机数，首字节即可均匀分片 */
+SessionStore::Shard& SessionStore::GetShard_(const string& id) {
+    assert(!shards_.empty() && id.size() >= 2);
+    int byte = strtol(id.substr(0, 2).c_str(), nullptr, 16);
+    return *shards_[byte % shards_.size()];
+}
+
+void SessionStore::Insert_(const string& id, const string& user, Clock::time_point expires) {
+    Shard& shard = GetShard_(id);
+    lock_guard<mutex> locker(shard.mtx);
+    if(!shard.sessions.emplace(id, Entry{user, expires}).second) { return; }
+    shard.order.emplace_back(expires, id);
+}
+
+string SessionStore::Create(const string& user) {
+    if(!isOpen_) { return ""; }
+    string id;
+    if(!RandomId_(&id)) {
+        LOG_ERROR("Session random id error!");
+        return "";
+    }
+    Clock::time_point expires = Clock::now() + ttl_;
+    Insert_(id, user, expires);
+    created_++;
+    if(redis_) {
+        /* Redis中保存绝对过期时间，重启后按剩余时间恢复 */
+        long long expireAt = chrono::duration_cast<chrono::milliseconds>(
+                                chrono::system_clock::now().time_since_epoch() + ttl_).count();
+        int ttlSec = static_cast<int>((ttl_.count() + 999) / 1000);
+        redis_->Set(REDIS_PREFIX + id, to_string(expireAt) + " " + user, ttlSec, [](const RedisValue& res) {
+            if(!res.ok) { LOG_WARN("Session write to redis error: %s", res.str.c_str()); }
+        });
+    }
+    return id;
+}
+
+bool SessionStore::LoadRedis_(const string& id, string* user) {
+    future<RedisValue> res = redis_->Command({"GET", REDIS_PREFIX + id});
+    if(res.wait_for(chrono::milliseconds(REDIS_WAIT_MS)) != future_status::ready) {
+        return false;
+    }
+    RedisValue value = res.get();
+    if(!value.ok || value.nil) { return false; }
+    size_t pos = value.str.find(' ');
+    if(pos == string::npos) { return false; }
+    long long left = atoll(value.str.substr(0, pos).c_str()) - chrono::duration_cast<chrono::milliseconds>(
+                        chrono::system_clock::now().time_since_epoch()).count();
+    if(left <= 0) { return false; }
+    *user = value.str.substr(pos + 1);
+    Insert_(id, *user, Clock::now() + chrono::milliseconds(left));
+    return true;
+}
+
+bool SessionStore::Validate(const string& id, string* user) {
+    assert(user);
+    if(!isOpen_ || !IsValidId_(id)) { return false; }
+    {
+        Shard& shard = GetShard_(id);
+        lock_guard<mutex> locker(shard.mtx);
+        auto it = shard.sessions.find(id);
+        if(it != shard.sessions.end()) {
+            if(it->second.expires <= Clock::now()) { return false; }  // 等定时器清理
+            *user = it->second.user;
+            return true;
+        }
+    }
+    return redis_ && LoadRedis_(id, user);
+}
+
+void SessionStore::Remove(const string& id) {
+    if(!isOpen_ || !IsValidId_(id)) { return; }
+    {
+        Shard& shard = GetShard_(id);
+        lock_guard<mutex> locker(shard.mtx);
+        shard.sessions.erase(id);  // 队列中的记录清理时跳过
+    }
+    if(redis_) {
+        redis_->Del(REDIS_PREFIX + id, [](const RedisValue&) {});
+    }
+}
+
+size_t SessionStore::Expire() {
+    if(!isOpen_) { return 0; }
+    size_t n = 0;
+    Clock::time_point now = Clock::now();
+    for(auto& shard: shards_) {
+        lock_guard<mutex> locker(shard->mtx);
+        while(!shard->order.empty() && shard->order.front().first <= now) {
+            auto it = shard->sessions.find(shard->order.front().second);
+            if(it != shard->sessions.end() && it->second.expires <= now) {
+                shard->sessions.erase(it);
+                n++;
+            }
+            shard->order.pop_front();
+        }
+    }
+    expired_ += n;
+    if(n > 0) { LOG_DEBUG("Session expired: %zu", n); }
+    return n;
+}
+
+string SessionStore::Cookie(const string& id) const {
+    return "sid=" + id + "; Max-Age=" + to_string((ttl_.count() + 999) / 1000)
+            + "; Path=/; HttpOnly; SameSite=Lax";
+}
+
+size_t SessionStore::Count() const {
+    size_t n = 0;
+    for(auto& shard: shards_) {
+        lock_guard<mutex> locker(shard->mtx);
+        n += shard->sessions.size();
+    }
+    return n;
+}
+
+void SessionStore::Close() {
+    if(!isOpen_) { return; }
+    LOG_INFO("Session created: %zu, expired: %zu, alive: %zu", Created(), Expired(), Count());
+    isOpen_ = false;
+    redis_ = nullptr;
+}
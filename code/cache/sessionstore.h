@@ -0,0 +1,90 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#ifndef SESSION_STORE_H
+#define SESSION_STORE_H
+
+#include <string>
+#include <deque>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <unordered_map>
+#include <assert.h>
+
+class RedisAsync;
+
+/*
+ * 登录会话：登录成功后生成128位随机会话ID，经Cookie下发，之后的请求凭Cookie免去重复认证
+ * 会话ID本身是随机数，直接取其首字节选分片，不再额外计算哈希；每个分片一把锁，校验只做一次哈希表查找
+ * 有效期从创建时起算，各分片按创建顺序排队，由服务器定时器周期性清理队首的过期会话；
+ * 可选写穿到Redis，本地未命中时短暂等待Redis，重启后会话仍然有效
+ */
+class SessionStore {
+public:
+    static const size_t ID_LEN = 32;  // 16字节随机数的十六进制
+
+    static SessionStore* Instance();
+
+    /* redis不为空时写穿到Redis */
+    void Init(int shardNum, int ttlMS, RedisAsync* redis = nullptr);
+    bool IsOpen() const { return isOpen_; }
+
+    /* 创建会话，返回会话ID，失败返回空串 */
+    std::string Create(const std::string& user);
+    /* 会话有效时返回true并填写用户名 */
+    bool Validate(const std::string& id, std::string* user);
+    void Remove(const std::string& id);
+
+    /* 清理过期会话，返回清理数量，由定时器在事件循环中调用 */
+    size_t Expire();
+
+    /* Set-Cookie头的值 */
+    std::string Cookie(const std::string& id) const;
+
+    size_t Count() const;
+    size_t Created() const { return created_; }
+    size_t Expired() const { return expired_; }
+
+    void Close();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Entry {
+        std::string user;
+        Clock::time_point expires;
+    };
+
+    struct Shard {
+        std::mutex mtx;
+        std::unordered_map<std::string, Entry> sessions;
+        std::deque<std::pair<Clock::time_point, std::string>> order;  // 按创建(即过期)先后排列
+    };
+
+    static const int REDIS_WAIT_MS = 50;  // 本地未命中时等待Redis的最长时间
+
+    SessionStore();
+    ~SessionStore() = default;
+    SessionStore(const SessionStore&) = delete;
+    SessionStore& operator=(const SessionStore&) = delete;
+
+    static bool RandomId_(std::string* id);
+    static bool IsValidId_(const std::string& id);
+    Shard& GetShard_(const std::string& id);
+    void Insert_(const std::string& id, const std::string& user, Clock::time_point expires);
+    bool LoadRedis_(const std::string& id, std::string* user);
+
+    bool isOpen_;
+    std::chrono::milliseconds ttl_;
+    RedisAsync* redis_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+    std::atomic<size_t> created_;
+    std::atomic<size_t> expired_;
+};
+
+#endif //SESSION_STORE_H
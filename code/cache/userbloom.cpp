@@ -0,0 +1,126 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#include "userbloom.h"
+#include <math.h>
+#include <chrono>
+#include "../log/log.h"
+#include "../store/userstore.h"
+#include <mysql/mysql.h>  // mysql_thread_init
+using namespace std;
+
+UserBloom::UserBloom(): bitNum_(0), hashNum_(0), count_(0), ready_(false), loadMs_(0),
+    maybeChecks_(0), falsePositives_(0) {}
+
+UserBloom::~UserBloom() {
+    Close();
+}
+
+UserBloom* UserBloom::Instance() {
+    static UserBloom inst;
+    return &inst;
+}
+
+void UserBloom::Init(size_t expected, double fpRate) {
+    assert(expected > 0 && fpRate > 0 && fpRate < 1);
+    /* m = -n*ln(p)/(ln2)^2, k = m/n*ln2 */
+    double ln2 = log(2.0);
+    size_t bits = static_cast<size_t>(-static_cast<double>(expected) * log(fpRate) / (ln2 * ln2));
+    size_t words = (bits + 63) / 64;
+    bitNum_ = words * 64;
+    hashNum_ = static_cast<int>(round(static_cast<double>(bitNum_) / expected * ln2));
+    if(hashNum_ < 1) { hashNum_ = 1; }
+    bits_.reset(new atomic<uint64_t>[words]);
+    for(size_t i = 0; i < words; i++) {
+        bits_[i].store(0, memory_order_relaxed);
+    }
+    count_ = 0;
+    ready_ = false;
+}
+
+/* FNV-1a 64位，高低32位作为两个独立哈希做双重哈希 */
+uint64_t UserBloom::Hash_(const string& name) {
+    uint64_t h = 14695981039346656037ULL;
+    for(unsigned char c: name) {
+        h ^= c;
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+void UserBloom::Add(const string& name) {
+    if(!IsOpen()) { return; }
+    uint64_t h = Hash_(name);
+    uint32_t h1 = static_cast<uint32_t>(h), h2 = static_cast<uint32_t>(h >> 32) | 1;
+    for(int i = 0; i < hashNum_; i++) {
+        size_t bit = (h1 + static_cast<uint64_t>(i) * h2) % bitNum_;
+        bits_[bit / 64].fetch_or(1ULL << (bit % 64), memory_order_relaxed);
+    }
+    count_++;
+}
+
+bool UserBloom::MayContain(const string& name) const {
+    if(!IsOpen()) { return true; }
+    uint64_t h = Hash_(name);
+    uint32_t h1 = static_cast<uint32_t>(h), h2 = static_cast<uint32_t>(h >> 32) | 1;
+    for(int i = 0; i < hashNum_; i++) {
+        size_t bit = (h1 + static_cast<uint64_t>(i) * h2) % bitNum_;
+        if(!(bits_[bit / 64].load(memory_order_relaxed) & (1ULL << (bit % 64)))) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void UserBloom::RecordCheck(bool falsePositive) {
+    maybeChecks_++;
+    if(falsePositive) { falsePositives_++; }
+}
+
+double UserBloom::EstimatedFpRate() const {
+    if(!IsOpen()) { return 1.0; }
+    /* p = (1 - e^(-kn/m))^k */
+    double n = count_, m = bitNum_, k = hashNum_;
+    return pow(1 - exp(-k * n / m), k);
+}
+
+double UserBloom::ObservedFpRate() const {
+    size_t checks = maybeChecks_;
+    return checks ? static_cast<double>(falsePositives_) / checks : 0.0;
+}
+
+long UserBloom::Load(UserStore* store) {
+    assert(store && IsOpen());
+    auto start = chrono::steady_clock::now();
+    long rows = store->ScanNames([this](const string& name) { Add(name); });
+    if(rows < 0) {
+        LOG_ERROR("UserBloom load error!");
+        return -1;
+    }
+    loadMs_ = chrono::duration_cast<chrono::milliseconds>(chrono::steady_clock::now() - start).count();
+    ready_.store(true, memory_order_release);
+    LOG_INFO("UserBloom loaded %ld users in %ldms, bits: %zu, hashes: %d, estimated fp: %.4f%%",
+             rows, loadMs_, bitNum_, hashNum_, EstimatedFpRate() * 100);
+    return rows;
+}
+
+void UserBloom::LoadAsync(UserStore* store) {
+    assert(!loader_.joinable());
+    loader_ = thread([this, store] {
+        mysql_thread_init();
+        Load(store);
+        mysql_thread_end();
+    });
+}
+
+void UserBloom::Close() {
+    if(loader_.joinable()) {
+        loader_.join();
+    }
+    if(IsOpen()) {
+        LOG_INFO("UserBloom users: %zu, estimated fp: %.4f%%, observed fp: %.4f%%",
+                 Count(), EstimatedFpRate() * 100, ObservedFpRate() * 100);
+    }
+}
@@ -0,0 +1,72 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#ifndef USER_BLOOM_H
+#define USER_BLOOM_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <stdint.h>
+#include <assert.h>
+
+class UserStore;
+
+/*
+ * 已注册用户名的布隆过滤器
+ * 注册时若过滤器判定用户名一定不存在，跳过数据库的存在性查询；判定可能存在时仍查询数据库
+ * 启动时在后台线程流式扫描用户存储建立过滤器，加载完成前所有请求照常查询数据库；
+ * 插入成功后加入过滤器。位数组按位原子或，读写都不加锁
+ * 不支持删除，服务器没有删除用户的功能
+ */
+class UserBloom {
+public:
+    static UserBloom* Instance();
+
+    /* expected: 预计用户数；fpRate: 目标误判率 */
+    void Init(size_t expected, double fpRate);
+    bool IsOpen() const { return bits_ != nullptr; }
+    bool IsReady() const { return ready_.load(std::memory_order_acquire); }
+
+    /* 后台流式扫描全部用户名，完成后IsReady()为true */
+    void LoadAsync(UserStore* store);
+    /* 同步扫描，返回加载的用户数，失败返回-1 */
+    long Load(UserStore* store);
+
+    void Add(const std::string& name);
+    bool MayContain(const std::string& name) const;
+
+    /* 判定可能存在而数据库中不存在时调用，用于统计实际误判率 */
+    void RecordCheck(bool falsePositive);
+
+    size_t Count() const { return count_; }
+    long LoadMs() const { return loadMs_; }
+    double EstimatedFpRate() const;  // 按当前元素数估算的理论误判率
+    double ObservedFpRate() const;   // 注册路径上实际观测的误判率
+
+    void Close();
+
+private:
+    UserBloom();
+    ~UserBloom();
+    UserBloom(const UserBloom&) = delete;
+    UserBloom& operator=(const UserBloom&) = delete;
+
+    static uint64_t Hash_(const std::string& name);
+
+    std::unique_ptr<std::atomic<uint64_t>[]> bits_;
+    size_t bitNum_;
+    int hashNum_;
+    std::atomic<size_t> count_;
+    std::atomic<bool> ready_;
+    long loadMs_;
+    std::atomic<size_t> maybeChecks_;
+    std::atomic<size_t> falsePositives_;
+    std::thread loader_;
+};
+
+#endif //USER_BLOOM_H
@@ -2,4 +2,131 @@
  * @Author       : mark
  * @Date         : 2020-06-28
  * @copyleft Apache 2.0
- */ 
+ */
+#ifndef CONFIG_H
+#define CONFIG_H
+
+/*
+ * 服务器可选功能配置
+ * 构造函数参数保持原样，新增功能统一放在这里，默认值与原有行为一致
+ */
+struct Config {
+    /* 访问日志 */
+    bool openAccessLog = false;  // 是否记录访问日志(依赖日志系统开启)
+    int accessSampleRate = 1;    // 采样率：每N个请求记录一条，1表示全部记录
+    int accessSlowMs = 500;      // 慢请求阈值(毫秒)，超过阈值或状态码>=400的请求总是记录
+
+    /* 嵌入式用户存储：用户数据保存在本地mmap文件中，不依赖MySQL */
+    bool openEmbeddedStore = false;
+    const char* embeddedStorePath = "./users.db";
+    int embeddedStoreCapacity = 65536;  // 新建文件时的槽数，装载因子超过0.7自动翻倍
+    bool embeddedStoreSync = false;     // 每次注册后同步所在页到磁盘(防掉电)，进程崩溃不需要
+
+    /* 数据库连接池(最大连接数为构造参数connPoolNum) */
+    int sqlPoolMin = -1;            // 启动时并行建立的连接数，其余按需建立；-1表示全部预先建立
+    int sqlAcquireTimeoutMs = 3000; // 借连接最长等待时间，超时按失败处理
+    int sqlIdleCheckMs = 30000;     // 空闲超过该时间的连接借出前ping检查，并由后台巡检回收到最小连接数
+    int sqlLocalStash = 0;          // 每个工作线程本地缓存的连接数(最多4)，0为关闭；超过 连接数/线程数 时按其截断
+
+    /* 用户名布隆过滤器：注册时一定不存在的用户名跳过数据库查询 */
+    bool openUserBloom = false;
+    int userBloomExpected = 1000000;  // 预计用户数，决定位数组大小
+    double userBloomFpRate = 0.01;    // 目标误判率
+
+    /* 注册写入延迟合并：窗口内的注册合并为一个事务、一条多行INSERT */
+    bool openSqlBatch = false;
+    int sqlBatchMax = 64;      // 每批最多注册数
+    int sqlBatchWindowMs = 5;  // 攒批窗口，从第一条等待的注册开始计时
+
+    /* 异步数据库认证(需要MariaDB Connector/C的非阻塞接口) */
+    bool openAsyncSql = false;
+    int asyncSqlConnNum = 4;       // 异步连接数
+    int asyncSqlMaxWait = 1024;    // 等待队列上限，超过直接失败
+    int asyncSqlTimeoutMs = 3000;  // 单次查询超时(含排队时间)
+
+    /* 用户凭据缓存，位于数据库查询之前 */
+    bool openCredCache = false;
+    int credCacheShards = 16;          // 分片数，每个分片一把锁
+    int credCacheCapacity = 65536;     // 总容量，超出按LRU淘汰
+    int credCacheTtlMs = 60000;        // 已存在用户的缓存时间
+    int credCacheNegativeTtlMs = 5000; // 不存在用户(负缓存)的缓存时间
+
+    /* 异步Redis客户端(hiredis异步接口，挂在事件循环上，命令流水线化) */
+    bool openAsyncRedis = false;
+    const char* redisHost = "127.0.0.1";
+    int redisPort = 6379;
+    int redisConnNum = 2;  // 连接数，每个连接上可同时有多条未完成命令
+
+    /* 登录会话：登录成功后下发会话Cookie，带有效会话的登录请求不再认证 */
+    bool openSession = false;
+    int sessionShards = 16;       // 分片数，每个分片一把锁(最多256)
+    int sessionTtlMs = 1800000;   // 会话有效期，从登录时起算
+    int sessionSweepMs = 1000;    // 定时清理过期会话的间隔
+    bool sessionRedis = false;    // 写穿到Redis(需开启openAsyncRedis)，重启后会话仍有效
+
+    /* 静态文件缓存：小文件读入内存，响应不再stat + open + mmap */
+    bool openFileCache = false;
+    int fileCacheMaxFileKB = 64;     // 单个文件上限，超过的文件仍走mmap
+    int fileCacheCapacityMB = 64;    // 缓存总容量，满后不再加入新文件
+
+    /* 事件循环直接完成廉价请求(需开启openFileCache)：缓存命中的小文件GET在事件循环中读、解析并应答，
+       其余请求照旧交给线程池 */
+    bool openFastPath = false;
+    int fastPathMaxBytes = 16384;    // 事件循环直接发送的文件大小上限
+
+    /* 接受连接 */
+    int listenBacklog = 1024;      // 全连接队列长度(受net.core.somaxconn限制)，原为6，突发连接时SYN被丢弃
+    int acceptBatch = 64;          // 每轮事件循环最多接受的连接数，剩余的下一轮继续，避免新连接饿死已有连接
+    int deferAcceptSec = 0;        // TCP_DEFER_ACCEPT：收到首个数据包才完成accept(秒)，0为关闭
+    int fastOpenQueue = 0;         // TCP_FASTOPEN 未完成握手队列长度，0为关闭
+    bool listenExclusive = false;  // EPOLLEXCLUSIVE：多个事件循环共享监听fd时只唤醒其中一个
+
+    /* 过载保护：按线程池任务排队时间(CoDel)做准入控制，过载时回503 */
+    bool openAdmission = false;
+    int admissionTargetMs = 5;      // 排队时间目标
+    int admissionIntervalMs = 100;  // 排队时间持续高于目标这么久进入过载；长连接上的请求排队超过它才丢弃
+    int retryAfterSec = 1;          // 503响应的Retry-After(连接数满时同样使用)
+
+    /* 按客户端IP限流，超限回429 */
+    bool openIpLimit = false;
+    int ipMaxConns = 64;        // 每个IP的并发连接上限，0为不限
+    int ipRatePerSec = 200;     // 每个IP每秒请求数(令牌桶，按读事件计)，0为不限
+    int ipRateBurst = 400;      // 令牌桶容量
+    int ipTableSlots = 65536;   // 槽数，每槽16字节；IP所在组的槽全部占满时该IP不受限
+    int ipSweepMs = 10000;      // 回收空闲槽的间隔
+
+    /* 长连接 */
+    int keepAliveMaxRequests = 1000;  // 每个连接最多处理的请求数，到达后响应带Connection: close，0为不限
+    int keepAliveTimeoutMs = 0;       // 两个请求之间的空闲超时，0表示与连接超时timeoutMS相同
+
+    /* 绑核与NUMA就近放置 */
+    const char* reactorCpus = "";     // 事件循环线程绑定的CPU列表，如"0"；空为不绑定
+    const char* workerCpus = "";      // 工作线程逐个轮流绑定的CPU列表，如"1-7"；空为不绑定
+    int numaNode = -1;                // 事件循环与工作线程放在该NUMA节点上，未指定的列表取该节点的CPU
+    const char* irqAffinityNic = "";  // 网卡名：事件循环绑定到该网卡接收队列中断所在的CPU，工作线程放在同一节点
+
+    /* 自适应忙轮询：阻塞之前先用epoll_wait(0)自旋，高负载时省去线程睡眠与唤醒，用CPU换延迟 */
+    bool openBusyPoll = false;
+    int busyPollMaxUs = 200;     // 自旋预算上限，预算按最近事件到达的间隔在0与上限之间调整
+    int busyPollSocketUs = 0;    // SO_BUSY_POLL：读取时在网卡队列上忙等的微秒数，0为不设置；超过net.core.busy_read需要CAP_NET_ADMIN
+
+    /* 多进程：主进程fork出工作进程，各自运行一个WebServer，崩溃互不影响(见main.cpp)
+       会话、嵌入式用户存储都在进程内，多进程时用户数据放MySQL、会话开启sessionRedis；
+       开启后拒绝嵌入式存储，关闭布隆过滤器与凭据负缓存(其他进程的注册在本进程中看不到) */
+    int workerProcesses = 0;        // 工作进程数，0为单进程
+    bool listenReusePort = false;   // 工作进程各自创建监听套接字并设置SO_REUSEPORT，由内核按连接哈希分配；
+                                    // 否则主进程创建监听套接字，工作进程继承后共同accept(配合listenExclusive避免惊群)
+    int workerRestartDelayMs = 100; // 工作进程启动后很快退出时的重启延迟，连续发生时指数退避
+    int listenFd = -1;              // 已在监听的套接字(从主进程继承)，-1时自行创建
+    const char* logSuffix = ".log"; // 日志文件名后缀，多进程时区分各工作进程的日志
+
+    /* 热重启(只用于单进程)：启动时若控制路径上有旧进程，接管它的监听套接字，并按它的静态文件缓存索引预热；
+       旧进程随后停止accept，处理完已有请求后退出。会话在进程内，需要跨重启保留时开启sessionRedis */
+    const char* hotRestartPath = "";  // 控制用Unix套接字路径，空为不开启
+
+    /* 排空：收到SIGTERM/SIGINT或热重启交接后停止accept，之后的响应带Connection: close，
+       空闲长连接在1秒宽限后关闭；全部连接处理完或到达期限后退出，再次收到同一信号立即退出 */
+    int drainTimeoutMs = 10000;       // 停止accept后等待已有请求处理完的上限
+};
+
+#endif //CONFIG_H
@@ -9,11 +9,19 @@ using namespace std;
 const char* HttpConn::srcDir;
 std::atomic<int> HttpConn::userCount;
 bool HttpConn::isET;
+int HttpConn::keepAliveMax;
+int HttpConn::keepAliveTimeoutSec;
+std::atomic<bool> HttpConn::isDraining;
 
 HttpConn::HttpConn() { 
     fd_ = -1;
     addr_ = { 0 };
     isClose_ = true;
+    ipCounted_ = false;
+    keepAlive_ = false;
+    reqCount_ = 0;
+    respBytes_ = 0;
+    accessPending_ = false;
 };
 
 HttpConn::~HttpConn() { 
@@ -28,6 +36,11 @@ void HttpConn::init(int fd, const sockaddr_in& addr) {
     writeBuff_.RetrieveAll();
     readBuff_.RetrieveAll();
     isClose_ = false;
+    ipCounted_ = false;
+    keepAlive_ = false;
+    reqCount_ = 0;
+    respBytes_ = 0;
+    accessPending_ = false;
     LOG_INFO("Client[%d](%s:%d) in, userCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
 }
 
@@ -36,8 +49,8 @@ void HttpConn::Close() {
     if(isClose_ == false){
         isClose_ = true; 
         userCount--;
-        close(fd_);
         LOG_INFO("Client[%d](%s:%d) quit, UserCount:%d", fd_, GetIP(), GetPort(), (int)userCount);
+        close(fd_);  // 最后关闭，之后fd可能立即被新连接复用
     }
 }
 
@@ -91,6 +104,9 @@ ssize_t HttpConn::write(int* saveErrno) {
             writeBuff_.Retrieve(len);
         }
     } while(isET || ToWriteBytes() > 10240);
+    if(accessPending_ && ToWriteBytes() == 0) {
+        LogAccess_();
+    }
     return len;
 }
 
@@ -99,18 +115,69 @@ bool HttpConn::process() {
     if(readBuff_.ReadableBytes() <= 0) {
         return false;
     }
-    else if(request_.parse(readBuff_)) {
+    reqStart_ = chrono::steady_clock::now();
+    reqCount_++;
+    if(request_.parse(readBuff_)) {
+        if(request_.IsVerifyPending()) {
+            /* 等待异步认证完成，由ResumeVerify生成响应 */
+            return false;
+        }
         LOG_DEBUG("%s", request_.path().c_str());
-        response_.Init(srcDir, request_.path(), request_.IsKeepAlive(), 200);
+        InitResponse_(200);
     } else {
-        response_.Init(srcDir, request_.path(), false, 400);
+        InitResponse_(400);
+    }
+    MakeResponse_();
+    return true;
+}
+
+void HttpConn::InitResponse_(int code) {
+    keepAlive_ = code != 400 && request_.IsKeepAlive() && (keepAliveMax <= 0 || reqCount_ < keepAliveMax)
+                 && !isDraining.load(std::memory_order_relaxed);
+    response_.Init(srcDir, request_.path(), keepAlive_, code);
+    if(keepAlive_ && (keepAliveTimeoutSec > 0 || keepAliveMax > 0)) {
+        string header = "Keep-Alive: ";
+        if(keepAliveTimeoutSec > 0) { header += "timeout=" + to_string(keepAliveTimeoutSec); }
+        if(keepAliveMax > 0) {
+            if(keepAliveTimeoutSec > 0) { header += ", "; }
+            header += "max=" + to_string(keepAliveMax - reqCount_);  // 本连接还能发送的请求数
+        }
+        response_.AddHeader(header);
     }
+}
 
+bool HttpConn::IsCheapRequest(size_t maxBytes, string* path) const {
+    const char* begin = readBuff_.Peek();
+    const char* end = readBuff_.BeginWriteConst();
+    const char CRLF2[] = "\r\n\r\n";
+    path->clear();
+    const char* pathBegin = find(begin, end, ' ');
+    if(pathBegin == end) { return false; }
+    pathBegin++;
+    const char* pathEnd = find(pathBegin, end, ' ');
+    if(pathEnd == end || pathEnd == pathBegin) { return false; }
+    *path = HttpRequest::ResolvePath(string(pathBegin, pathEnd));
+    if(pathBegin - begin != 4 || strncmp(begin, "GET ", 4) != 0) { return false; }
+    if(search(pathEnd, end, CRLF2, CRLF2 + 4) == end) { return false; }  // 请求头未收全
+    return FileCache::Instance()->Contains(srcDir + *path, maxBytes);
+}
+
+void HttpConn::ResumeVerify(bool success) {
+    request_.FinishVerify(success);
+    InitResponse_(200);
+    MakeResponse_();
+}
+
+void HttpConn::MakeResponse_() {
+    if(!request_.NewSession().empty()) {
+        response_.AddHeader("Set-Cookie: " + SessionStore::Instance()->Cookie(request_.NewSession()));
+    }
     response_.MakeResponse(writeBuff_);
     /* 响应头 */
     iov_[0].iov_base = const_cast<char*>(writeBuff_.Peek());
     iov_[0].iov_len = writeBuff_.ReadableBytes();
     iovCnt_ = 1;
+    iov_[1].iov_len = 0;
 
     /* 文件 */
     if(response_.FileLen() > 0  && response_.File()) {
@@ -119,5 +186,20 @@ bool HttpConn::process() {
         iovCnt_ = 2;
     }
     LOG_DEBUG("filesize:%d, %d  to %d", response_.FileLen() , iovCnt_, ToWriteBytes());
-    return true;
+    respBytes_ = ToWriteBytes();
+    accessPending_ = AccessLog::Instance()->IsOpen();
+}
+
+void HttpConn::LogAccess_() {
+    accessPending_ = false;
+    AccessRecord rec;
+    rec.ip = addr_.sin_addr.s_addr;
+    rec.status = static_cast<uint16_t>(response_.Code());
+    rec.reuse = static_cast<uint16_t>(reqCount_);
+    rec.durationUs = static_cast<uint32_t>(chrono::duration_cast<chrono::microseconds>(
+                        chrono::steady_clock::now() - reqStart_).count());
+    rec.bytes = respBytes_;
+    AccessRecord::CopyField(rec.method, sizeof(rec.method), request_.method());
+    AccessRecord::CopyField(rec.path, sizeof(rec.path), request_.path());
+    AccessLog::Instance()->Record(rec);
 }
@@ -12,8 +12,11 @@
 #include <arpa/inet.h>   // sockaddr_in
 #include <stdlib.h>      // atoi()
 #include <errno.h>      
+#include <chrono>
+#include <algorithm>     // search, find
 
 #include "../log/log.h"
+#include "../log/accesslog.h"
 #include "../pool/sqlconnRAII.h"
 #include "../buffer/buffer.h"
 #include "httprequest.h"
@@ -43,24 +46,66 @@ public:
     
     bool process();
 
+    /* 不消费读缓冲区，判断其中的请求能否在事件循环中直接应答：
+       请求头完整的GET、目标文件已在缓存中且不超过maxBytes；path返回解析出的资源路径(解析不出为空) */
+    bool IsCheapRequest(size_t maxBytes, std::string* path) const;
+
+    /* 读缓冲区中还有未处理的数据(流水线请求) */
+    bool HasPendingRequest() const {
+        return readBuff_.ReadableBytes() > 0;
+    }
+
+    /* 异步认证完成后生成响应 */
+    void ResumeVerify(bool success);
+
+    bool IsVerifyPending() const {
+        return request_.IsVerifyPending();
+    }
+
+    const HttpRequest& GetRequest() const {
+        return request_;
+    }
+
     int ToWriteBytes() { 
         return iov_[0].iov_len + iov_[1].iov_len; 
     }
 
+    /* 当前响应发送完后是否保持连接：请求要求保持并且未达到单连接请求数上限 */
     bool IsKeepAlive() const {
-        return request_.IsKeepAlive();
+        return keepAlive_;
+    }
+
+    /* 该连接上已开始处理的请求数，0表示新连接 */
+    int RequestCount() const {
+        return reqCount_;
+    }
+
+    /* 接受时是否计入了按IP的并发连接数，关闭时只释放计入过的 */
+    void SetIpCounted(bool counted) {
+        ipCounted_ = counted;
+    }
+
+    bool IsIpCounted() const {
+        return ipCounted_;
     }
 
     static bool isET;
     static const char* srcDir;
     static std::atomic<int> userCount;
+    static int keepAliveMax;  // 每个连接最多处理的请求数，0为不限
+    static int keepAliveTimeoutSec;  // 响应头中告知客户端的空闲超时，0为不告知
+    static std::atomic<bool> isDraining;  // 服务器正在退出，之后的响应都带Connection: close
     
 private:
-   
+    void MakeResponse_();
+    void InitResponse_(int code);
+    void LogAccess_();
+
     int fd_;
     struct  sockaddr_in addr_;
 
     bool isClose_;
+    bool ipCounted_;
     
     int iovCnt_;
     struct iovec iov_[2];
@@ -70,6 +115,13 @@ private:
 
     HttpRequest request_;
     HttpResponse response_;
+
+    /* 访问日志统计 */
+    bool keepAlive_;
+    int reqCount_;  // 该连接上已处理的请求数
+    size_t respBytes_;  // 当前响应的总字节数
+    bool accessPending_;  // 当前响应发送完毕后需要记录访问日志
+    std::chrono::steady_clock::time_point reqStart_;
 };
 
 
@@ -6,6 +6,10 @@
 #include "httprequest.h"
 using namespace std;
 
+bool HttpRequest::isAsyncVerify = false;
+static MysqlUserStore mysqlStore(SqlConnPool::Instance());
+UserStore* HttpRequest::userStore = &mysqlStore;
+
 const unordered_set<string> HttpRequest::DEFAULT_HTML{
             "/index", "/register", "/login",
              "/welcome", "/video", "/picture", };
@@ -16,13 +20,46 @@ const unordered_map<string, int> HttpRequest::DEFAULT_HTML_TAG {
 void HttpRequest::Init() {
     method_ = path_ = version_ = body_ = "";
     state_ = REQUEST_LINE;
+    bodyLen_ = 0;
+    verifyPending_ = isLogin_ = false;
     header_.clear();
     post_.clear();
+    cookie_.clear();
+    newSession_.clear();
 }
 
+/* Connection头是逗号分隔的选项列表，不区分大小写 */
+static bool HasConnectionOption(const string& value, const char* option) {
+    size_t len = strlen(option);
+    size_t pos = 0;
+    while(pos < value.size()) {
+        size_t end = value.find(',', pos);
+        if(end == string::npos) { end = value.size(); }
+        size_t begin = value.find_first_not_of(" \t", pos);
+        size_t last = value.find_last_not_of(" \t", end - 1);
+        if(begin < end && last != string::npos && last + 1 - begin == len
+           && strncasecmp(value.data() + begin, option, len) == 0) {
+            return true;
+        }
+        pos = end + 1;
+    }
+    return false;
+}
+
+/* HTTP/1.1默认保持连接，除非Connection中带close；HTTP/1.0需要显式的keep-alive */
 bool HttpRequest::IsKeepAlive() const {
-    if(header_.count("Connection") == 1) {
-        return header_.find("Connection")->second == "keep-alive" && version_ == "1.1";
+    string connection;
+    for(auto& header: header_) {
+        if(strcasecmp(header.first.c_str(), "Connection") == 0) {
+            connection = header.second;
+            break;
+        }
+    }
+    if(version_ == "1.1") {
+        return !HasConnectionOption(connection, "close");
+    }
+    if(version_ == "1.0") {
+        return HasConnectionOption(connection, "keep-alive");
     }
     return false;
 }
@@ -33,6 +70,13 @@ bool HttpRequest::parse(Buffer& buff) {
         return false;
     }
     while(buff.ReadableBytes() && state_ != FINISH) {
+        if(state_ == BODY) {
+            /* 请求体按长度读取，之后的数据属于下一个请求 */
+            size_t len = min(bodyLen_, buff.ReadableBytes());
+            ParseBody_(string(buff.Peek(), len));
+            buff.Retrieve(len);
+            break;
+        }
         const char* lineEnd = search(buff.Peek(), buff.BeginWriteConst(), CRLF, CRLF + 2);
         std::string line(buff.Peek(), lineEnd);
         switch(state_)
@@ -44,13 +88,17 @@ bool HttpRequest::parse(Buffer& buff) {
             ParsePath_();
             break;    
         case HEADERS:
-            ParseHeader_(line);
-            if(buff.ReadableBytes() <= 2) {
-                state_ = FINISH;
+            if(!line.empty()) {
+                ParseHeader_(line);
+                break;
+            }
+            /* 空行：请求头结束，没有请求体时请求已完整 */
+            bodyLen_ = ContentLength_();
+            if(bodyLen_ > 0) {
+                state_ = BODY;
+            } else {
+                ParseBody_("");
             }
-            break;
-        case BODY:
-            ParseBody_(line);
             break;
         default:
             break;
@@ -63,17 +111,17 @@ bool HttpRequest::parse(Buffer& buff) {
 }
 
 void HttpRequest::ParsePath_() {
-    if(path_ == "/") {
-        path_ = "/index.html"; 
+    path_ = ResolvePath(path_);
+}
+
+string HttpRequest::ResolvePath(const string& path) {
+    if(path == "/") {
+        return "/index.html"; 
     }
-    else {
-        for(auto &item: DEFAULT_HTML) {
-            if(item == path_) {
-                path_ += ".html";
-                break;
-            }
-        }
+    if(DEFAULT_HTML.count(path)) {
+        return path + ".html";
     }
+    return path;
 }
 
 bool HttpRequest::ParseRequestLine_(const string& line) {
@@ -95,17 +143,26 @@ void HttpRequest::ParseHeader_(const string& line) {
     smatch subMatch;
     if(regex_match(line, subMatch, patten)) {
         header_[subMatch[1]] = subMatch[2];
+        if(subMatch[1] == "Cookie") {
+            ParseCookie_(subMatch[2]);
+        }
     }
-    else {
-        state_ = BODY;
+}
+
+size_t HttpRequest::ContentLength_() const {
+    for(auto& header: header_) {
+        if(strcasecmp(header.first.c_str(), "Content-Length") == 0) {
+            return strtoul(header.second.c_str(), nullptr, 10);
+        }
     }
+    return 0;
 }
 
-void HttpRequest::ParseBody_(const string& line) {
-    body_ = line;
+void HttpRequest::ParseBody_(const string& body) {
+    body_ = body;
     ParsePost_();
     state_ = FINISH;
-    LOG_DEBUG("Body:%s, len:%d", line.c_str(), line.size());
+    LOG_DEBUG("Body:%s, len:%d", body.c_str(), body.size());
 }
 
 int HttpRequest::ConverHex(char ch) {
@@ -122,8 +179,17 @@ void HttpRequest::ParsePost_() {
             LOG_DEBUG("Tag:%d", tag);
             if(tag == 0 || tag == 1) {
                 bool isLogin = (tag == 1);
-                if(UserVerify(post_["username"], post_["password"], isLogin)) {
+                if(isLogin && CheckSession_(post_["username"])) {
+                    path_ = "/welcome.html";  // 已登录，不再认证
+                }
+                else if(isAsyncVerify) {
+                    /* 交给事件循环中的异步连接池，不占用工作线程 */
+                    verifyPending_ = true;
+                    isLogin_ = isLogin;
+                }
+                else if(UserVerify(post_["username"], post_["password"], isLogin)) {
                     path_ = "/welcome.html";
+                    CreateSession_(post_["username"]);
                 } 
                 else {
                     path_ = "/error.html";
@@ -174,65 +240,157 @@ void HttpRequest::ParseFromUrlencoded_() {
     }
 }
 
+/* Cookie: a=1; b=2 */
+void HttpRequest::ParseCookie_(const string& value) {
+    size_t i = 0, n = value.size();
+    while(i < n) {
+        size_t end = value.find(';', i);
+        if(end == string::npos) { end = n; }
+        size_t eq = value.find('=', i);
+        if(eq != string::npos && eq < end) {
+            size_t kb = value.find_first_not_of(' ', i);
+            size_t ve = value.find_last_not_of(' ', end - 1);
+            if(kb < eq && ve > eq) {
+                cookie_[value.substr(kb, eq - kb)] = value.substr(eq + 1, ve - eq);
+            }
+        }
+        i = end + 1;
+    }
+}
+
+/* 请求带有效会话且与提交的用户名一致(或未填用户名)时返回true */
+bool HttpRequest::CheckSession_(const string& name) {
+    SessionStore* sessions = SessionStore::Instance();
+    if(!sessions->IsOpen() || cookie_.count("sid") == 0) { return false; }
+    string user;
+    if(!sessions->Validate(cookie_["sid"], &user)) { return false; }
+    if(!name.empty() && name != user) { return false; }
+    LOG_DEBUG("Session hit, user:%s", user.c_str());
+    return true;
+}
+
+void HttpRequest::CreateSession_(const string& name) {
+    SessionStore* sessions = SessionStore::Instance();
+    if(sessions->IsOpen()) {
+        newSession_ = sessions->Create(name);
+    }
+}
+
+/* 根据查到的凭据判断登录/注册结果，需要注册时返回true并由调用者插入 */
+static bool CheckCredential(const Credential& cred, const string& pwd, bool isLogin, bool* needInsert) {
+    *needInsert = false;
+    if(isLogin) {
+        if(cred.exist && cred.password == pwd) { return true; }
+        LOG_DEBUG("pwd error!");
+        return false;
+    }
+    if(cred.exist) {
+        LOG_DEBUG("user used!");
+        return false;
+    }
+    /* 注册行为 且 用户名未被使用*/
+    LOG_DEBUG("regirster!");
+    *needInsert = true;
+    return true;
+}
+
 bool HttpRequest::UserVerify(const string &name, const string &pwd, bool isLogin) {
     if(name == "" || pwd == "") { return false; }
     LOG_INFO("Verify name:%s pwd:%s", name.c_str(), pwd.c_str());
-    MYSQL* sql;
-    SqlConnRAII(&sql,  SqlConnPool::Instance());
-    assert(sql);
-    
-    bool flag = false;
-    unsigned int j = 0;
-    char order[256] = { 0 };
-    MYSQL_FIELD *fields = nullptr;
-    MYSQL_RES *res = nullptr;
-    
-    if(!isLogin) { flag = true; }
-    /* 查询用户及密码 */
-    snprintf(order, 256, "SELECT username, password FROM user WHERE username='%s' LIMIT 1", name.c_str());
-    LOG_DEBUG("%s", order);
-
-    if(mysql_query(sql, order)) { 
-        mysql_free_result(res);
-        return false; 
+
+    Credential cred;
+    CredCache* cache = CredCache::Instance();
+    UserBloom* bloom = UserBloom::Instance();
+    /* 注册时布隆过滤器判定一定不存在的用户名不再查询数据库 */
+    bool knownNew = !isLogin && bloom->IsReady() && !bloom->MayContain(name);
+    if(!knownNew) {
+        auto loader = [&name](Credential* result) { return userStore->Query(name, result); };
+        bool ok = cache->IsOpen() ? cache->GetOrLoad(name, &cred, loader) : loader(&cred);
+        if(!ok) { return false; }
+        if(!isLogin && bloom->IsReady()) { bloom->RecordCheck(!cred.exist); }
     }
-    res = mysql_store_result(sql);
-    j = mysql_num_fields(res);
-    fields = mysql_fetch_fields(res);
-
-    while(MYSQL_ROW row = mysql_fetch_row(res)) {
-        LOG_DEBUG("MYSQL ROW: %s %s", row[0], row[1]);
-        string password(row[1]);
-        /* 注册行为 且 用户名未被使用*/
-        if(isLogin) {
-            if(pwd == password) { flag = true; }
-            else {
-                flag = false;
-                LOG_DEBUG("pwd error!");
-            }
-        } 
-        else { 
-            flag = false; 
-            LOG_DEBUG("user used!");
-        }
+
+    bool needInsert = false;
+    bool flag = CheckCredential(cred, pwd, isLogin, &needInsert);
+    if(needInsert) {
+        flag = userStore->Insert(name, pwd);
+        if(!flag) { LOG_DEBUG("Insert error!"); }
+        else { bloom->Add(name); }
+        if(cache->IsOpen()) { cache->Invalidate(name); }
     }
-    mysql_free_result(res);
+    if(flag) { LOG_DEBUG("UserVerify success!!"); }
+    return flag;
+}
 
-    /* 注册行为 且 用户名未被使用*/
-    if(!isLogin && flag == true) {
-        LOG_DEBUG("regirster!");
-        bzero(order, 256);
-        snprintf(order, 256,"INSERT INTO user(username, password) VALUES('%s','%s')", name.c_str(), pwd.c_str());
-        LOG_DEBUG( "%s", order);
-        if(mysql_query(sql, order)) { 
-            LOG_DEBUG( "Insert error!");
-            flag = false; 
+void HttpRequest::FinishVerify(bool success) {
+    assert(verifyPending_);
+    verifyPending_ = false;
+    path_ = success ? "/welcome.html" : "/error.html";
+    if(success) { CreateSession_(post_["username"]); }
+}
+
+void HttpRequest::UserVerifyAsync(SqlAsyncPool* pool, const string& name, const string& pwd,
+                                  bool isLogin, const function<void(bool)>& cb) {
+    assert(pool);
+    if(name == "" || pwd == "") {
+        cb(false);
+        return;
+    }
+    LOG_INFO("Verify name:%s (async)", name.c_str());
+
+    CredCache::LoadCallBack onCredential = [=](bool ok, const Credential& cred) {
+        if(!ok) {
+            cb(false);
+            return;
+        }
+        bool needInsert = false;
+        bool flag = CheckCredential(cred, pwd, isLogin, &needInsert);
+        if(!needInsert) {
+            cb(flag);
+            return;
         }
-        flag = true;
+        auto onInsert = [=](bool inserted) {
+            if(!inserted) { LOG_DEBUG("Insert error!"); }
+            else { UserBloom::Instance()->Add(name); }
+            if(CredCache::Instance()->IsOpen()) { CredCache::Instance()->Invalidate(name); }
+            cb(inserted);
+        };
+        if(SqlBatchWriter::Instance()->IsOpen()) {
+            SqlBatchWriter::Instance()->AddUser(name, pwd, onInsert);
+            return;
+        }
+        pool->Query(STMT_INSERT_USER, {name, pwd}, [onInsert](const SqlAsyncResult& res) {
+            onInsert(res.ok);
+        });
+    };
+    auto loader = [=](const CredCache::LoadCallBack& done) {
+        pool->Query(STMT_QUERY_USER, {name}, [done](const SqlAsyncResult& res) {
+            Credential cred;
+            cred.exist = !res.row.empty();
+            if(cred.exist) { cred.password = res.row[0]; }
+            done(res.ok, cred);
+        });
+    };
+
+    UserBloom* bloom = UserBloom::Instance();
+    if(!isLogin && bloom->IsReady()) {
+        if(!bloom->MayContain(name)) {
+            onCredential(true, Credential());  // 一定不存在，直接注册
+            return;
+        }
+        auto check = onCredential;
+        onCredential = [check](bool ok, const Credential& cred) {
+            if(ok) { UserBloom::Instance()->RecordCheck(!cred.exist); }
+            check(ok, cred);
+        };
+    }
+
+    CredCache* cache = CredCache::Instance();
+    if(cache->IsOpen()) {
+        cache->GetOrLoadAsync(name, onCredential, loader);
+    } else {
+        loader(onCredential);
     }
-    SqlConnPool::Instance()->FreeConn(sql);
-    LOG_DEBUG( "UserVerify success!!");
-    return flag;
 }
 
 std::string HttpRequest::path() const{
@@ -258,6 +416,11 @@ std::string HttpRequest::GetPost(const std::string& key) const {
     return "";
 }
 
+std::string HttpRequest::GetCookie(const std::string& key) const {
+    auto it = cookie_.find(key);
+    return it == cookie_.end() ? "" : it->second;
+}
+
 std::string HttpRequest::GetPost(const char* key) const {
     assert(key != nullptr);
     if(post_.count(key) == 1) {
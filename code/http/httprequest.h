@@ -10,13 +10,21 @@
 #include <unordered_set>
 #include <string>
 #include <regex>
+#include <functional>
 #include <errno.h>     
+#include <strings.h>     // strcasecmp
 #include <mysql/mysql.h>  //mysql
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/sqlconnRAII.h"
+#include "../pool/sqlasyncpool.h"
+#include "../pool/sqlbatchwriter.h"
+#include "../cache/credcache.h"
+#include "../cache/userbloom.h"
+#include "../cache/sessionstore.h"
+#include "../store/mysqluserstore.h"
 
 class HttpRequest {
 public:
@@ -42,6 +50,8 @@ public:
     ~HttpRequest() = default;
 
     void Init();
+    /* 解析一个请求：请求头到空行为止，有Content-Length时再取这么多字节的请求体；
+       只消费本请求的数据，流水线上的后续请求留在缓冲区中 */
     bool parse(Buffer& buff);
 
     std::string path() const;
@@ -50,9 +60,27 @@ public:
     std::string version() const;
     std::string GetPost(const std::string& key) const;
     std::string GetPost(const char* key) const;
+    std::string GetCookie(const std::string& key) const;
+
+    /* 本次请求登录成功后新建的会话ID，需要经Set-Cookie下发；没有则为空 */
+    const std::string& NewSession() const { return newSession_; }
 
     bool IsKeepAlive() const;
 
+    /* 异步认证：解析时只记录待验证的用户，由调用者提交异步查询，完成后回填结果 */
+    bool IsVerifyPending() const { return verifyPending_; }
+    bool IsLoginVerify() const { return isLogin_; }
+    void FinishVerify(bool success);
+
+    /* 请求路径到资源路径的映射，如 / -> /index.html、/login -> /login.html */
+    static std::string ResolvePath(const std::string& path);
+
+    static void UserVerifyAsync(SqlAsyncPool* pool, const std::string& name, const std::string& pwd,
+                                bool isLogin, const std::function<void(bool)>& cb);
+
+    static bool isAsyncVerify;
+    static UserStore* userStore;  // 同步认证使用的用户存储，默认为MySQL
+
     /* 
     todo 
     void HttpConn::ParseFormData() {}
@@ -62,18 +90,28 @@ public:
 private:
     bool ParseRequestLine_(const std::string& line);
     void ParseHeader_(const std::string& line);
-    void ParseBody_(const std::string& line);
+    void ParseBody_(const std::string& body);
+    size_t ContentLength_() const;
 
     void ParsePath_();
     void ParsePost_();
     void ParseFromUrlencoded_();
+    void ParseCookie_(const std::string& value);
+    bool CheckSession_(const std::string& name);
+    void CreateSession_(const std::string& name);
 
     static bool UserVerify(const std::string& name, const std::string& pwd, bool isLogin);
 
     PARSE_STATE state_;
+    size_t bodyLen_;  // 请求头中的Content-Length
     std::string method_, path_, version_, body_;
     std::unordered_map<std::string, std::string> header_;
     std::unordered_map<std::string, std::string> post_;
+    std::unordered_map<std::string, std::string> cookie_;
+    std::string newSession_;
+
+    bool verifyPending_;
+    bool isLogin_;
 
     static const std::unordered_set<std::string> DEFAULT_HTML;
     static const std::unordered_map<std::string, int> DEFAULT_HTML_TAG;
@@ -56,18 +56,19 @@ HttpResponse::~HttpResponse() {
 
 void HttpResponse::Init(const string& srcDir, string& path, bool isKeepAlive, int code){
     assert(srcDir != "");
-    if(mmFile_) { UnmapFile(); }
+    UnmapFile();
     code_ = code;
     isKeepAlive_ = isKeepAlive;
     path_ = path;
     srcDir_ = srcDir;
+    extraHeaders_.clear();
     mmFile_ = nullptr; 
     mmFileStat_ = { 0 };
 }
 
 void HttpResponse::MakeResponse(Buffer& buff) {
     /* 判断请求的资源文件 */
-    if(stat((srcDir_ + path_).data(), &mmFileStat_) < 0 || S_ISDIR(mmFileStat_.st_mode)) {
+    if(Stat_() < 0 || S_ISDIR(mmFileStat_.st_mode)) {
         code_ = 404;
     }
     else if(!(mmFileStat_.st_mode & S_IROTH)) {
@@ -83,6 +84,7 @@ void HttpResponse::MakeResponse(Buffer& buff) {
 }
 
 char* HttpResponse::File() {
+    if(cached_) { return const_cast<char*>(cached_->data.data()); }
     return mmFile_;
 }
 
@@ -93,10 +95,25 @@ size_t HttpResponse::FileLen() const {
 void HttpResponse::ErrorHtml_() {
     if(CODE_PATH.count(code_) == 1) {
         path_ = CODE_PATH.find(code_)->second;
-        stat((srcDir_ + path_).data(), &mmFileStat_);
+        Stat_();
     }
 }
 
+int HttpResponse::Stat_() {
+    /* 开启文件缓存时优先取缓存，命中则不再stat与mmap；未命中时沿用缓存中stat的结果 */
+    cached_.reset();
+    if(FileCache::Instance()->IsOpen()) {
+        int ret = -1;
+        cached_ = FileCache::Instance()->Get(srcDir_ + path_, &mmFileStat_, &ret);
+        if(cached_) {
+            mmFileStat_ = cached_->st;
+            return 0;
+        }
+        return ret;
+    }
+    return stat((srcDir_ + path_).data(), &mmFileStat_);
+}
+
 void HttpResponse::AddStateLine_(Buffer& buff) {
     string status;
     if(CODE_STATUS.count(code_) == 1) {
@@ -112,15 +129,19 @@ void HttpResponse::AddStateLine_(Buffer& buff) {
 void HttpResponse::AddHeader_(Buffer& buff) {
     buff.Append("Connection: ");
     if(isKeepAlive_) {
-        buff.Append("keep-alive\r\n");
-        buff.Append("keep-alive: max=6, timeout=120\r\n");
+        buff.Append("keep-alive\r\n");  // Keep-Alive参数由HttpConn按配置追加
     } else{
         buff.Append("close\r\n");
     }
     buff.Append("Content-type: " + GetFileType_() + "\r\n");
+    buff.Append(extraHeaders_);
 }
 
 void HttpResponse::AddContent_(Buffer& buff) {
+    if(cached_) {
+        buff.Append("Content-length: " + to_string(cached_->data.size()) + "\r\n\r\n");
+        return;
+    }
     int srcFd = open((srcDir_ + path_).data(), O_RDONLY);
     if(srcFd < 0) { 
         ErrorContent(buff, "File NotFound!");
@@ -145,6 +166,7 @@ void HttpResponse::UnmapFile() {
         munmap(mmFile_, mmFileStat_.st_size);
         mmFile_ = nullptr;
     }
+    cached_.reset();
 }
 
 string HttpResponse::GetFileType_() {
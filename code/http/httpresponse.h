@@ -14,6 +14,7 @@
 
 #include "../buffer/buffer.h"
 #include "../log/log.h"
+#include "../cache/filecache.h"
 
 class HttpResponse {
 public:
@@ -27,6 +28,8 @@ public:
     size_t FileLen() const;
     void ErrorContent(Buffer& buff, std::string message);
     int Code() const { return code_; }
+    /* 追加一行响应头(不含\r\n)，如Set-Cookie，Init时清空 */
+    void AddHeader(const std::string& header) { extraHeaders_ += header + "\r\n"; }
 
 private:
     void AddStateLine_(Buffer &buff);
@@ -34,6 +37,7 @@ private:
     void AddContent_(Buffer &buff);
 
     void ErrorHtml_();
+    int Stat_();
     std::string GetFileType_();
 
     int code_;
@@ -41,9 +45,11 @@ private:
 
     std::string path_;
     std::string srcDir_;
+    std::string extraHeaders_;
     
     char* mmFile_; 
     struct stat mmFileStat_;
+    std::shared_ptr<const CachedFile> cached_;  // 文件缓存命中时代替mmap
 
     static const std::unordered_map<std::string, std::string> SUFFIX_TYPE;
     static const std::unordered_map<int, std::string> CODE_STATUS;
@@ -0,0 +1,111 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#include "accesslog.h"
+
+namespace {
+
+/* 无符号整数转十进制，返回写入的字符数 */
+size_t AppendUint(char* out, uint64_t v) {
+    char tmp[20];
+    size_t n = 0;
+    do {
+        tmp[n++] = '0' + v % 10;
+        v /= 10;
+    } while(v);
+    for(size_t i = 0; i < n; i++) {
+        out[i] = tmp[n - 1 - i];
+    }
+    return n;
+}
+
+/* 定宽补零，用于毫秒 */
+size_t AppendPadded(char* out, uint32_t v, size_t width) {
+    for(size_t i = width; i > 0; i--) {
+        out[i - 1] = '0' + v % 10;
+        v /= 10;
+    }
+    return width;
+}
+
+size_t AppendStr(char* out, const char* str, size_t maxLen) {
+    size_t n = strnlen(str, maxLen);
+    memcpy(out, str, n);
+    return n;
+}
+
+size_t AppendIp(char* out, uint32_t ip) {
+    const uint8_t* b = reinterpret_cast<const uint8_t*>(&ip);
+    size_t n = 0;
+    for(int i = 0; i < 4; i++) {
+        if(i) { out[n++] = '.'; }
+        n += AppendUint(out + n, b[i]);
+    }
+    return n;
+}
+
+}
+
+AccessLog::AccessLog(): isOpen_(false), sampleRate_(1), slowUs_(0), total_(0), written_(0) {}
+
+AccessLog* AccessLog::Instance() {
+    static AccessLog inst;
+    return &inst;
+}
+
+void AccessLog::Init(int sampleRate, int slowMs) {
+    sampleRate_ = sampleRate > 0 ? sampleRate : 1;
+    slowUs_ = slowMs > 0 ? static_cast<uint32_t>(slowMs) * 1000 : 0;
+    total_ = 0;
+    written_ = 0;
+    isOpen_ = true;
+}
+
+bool AccessLog::ShouldLog_(const AccessRecord& rec) {
+    uint64_t seq = total_.fetch_add(1, std::memory_order_relaxed);
+    if(rec.status >= 400) { return true; }
+    if(slowUs_ && rec.durationUs >= slowUs_) { return true; }
+    return seq % sampleRate_ == 0;
+}
+
+/*
+ * 行格式(空格分隔)：
+ * 秒.毫秒 IP 方法 路径 状态码 字节数 耗时us 复用次数
+ */
+size_t AccessLog::Format_(const AccessRecord& rec, char* out, size_t size) {
+    struct timeval now = {0, 0};
+    gettimeofday(&now, nullptr);
+    assert(size >= 64 + sizeof(rec.method) + sizeof(rec.path));
+    size_t n = 0;
+    n += AppendUint(out + n, now.tv_sec);
+    out[n++] = '.';
+    n += AppendPadded(out + n, now.tv_usec / 1000, 3);
+    out[n++] = ' ';
+    n += AppendIp(out + n, rec.ip);
+    out[n++] = ' ';
+    n += AppendStr(out + n, rec.method, sizeof(rec.method));
+    out[n++] = ' ';
+    n += AppendStr(out + n, rec.path, sizeof(rec.path));
+    out[n++] = ' ';
+    n += AppendUint(out + n, rec.status);
+    out[n++] = ' ';
+    n += AppendUint(out + n, rec.bytes);
+    out[n++] = ' ';
+    n += AppendUint(out + n, rec.durationUs);
+    out[n++] = ' ';
+    n += AppendUint(out + n, rec.reuse);
+    out[n++] = '\n';
+    return n;
+}
+
+void AccessLog::Record(const AccessRecord& rec) {
+    if(!isOpen_ || !Log::Instance()->IsOpen() || !ShouldLog_(rec)) {
+        return;
+    }
+    char line[256];
+    size_t len = Format_(rec, line, sizeof(line));
+    Log::Instance()->WriteRaw(line, len);
+    written_.fetch_add(1, std::memory_order_relaxed);
+}
@@ -0,0 +1,67 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#ifndef ACCESS_LOG_H
+#define ACCESS_LOG_H
+
+#include <atomic>
+#include <stdint.h>
+#include <string.h>
+#include <string>
+#include <sys/time.h>
+#include "log.h"
+
+/* 一次请求的访问记录，定长布局，填充时不做任何格式化 */
+struct AccessRecord {
+    uint32_t ip;          // 客户端地址(网络字节序)
+    uint16_t status;      // 响应状态码
+    uint16_t reuse;       // 该连接上的第几个请求(keep-alive复用次数)
+    uint32_t durationUs;  // 从开始处理到响应发送完毕的耗时(微秒)
+    uint64_t bytes;       // 响应字节数(响应头+文件)
+    char method[8];
+    char path[96];        // 超长截断
+
+    /* 定长字段拷贝，填满时不保留结尾'\0'，读取端按字段长度截断 */
+    static void CopyField(char* dst, size_t size, const std::string& src) {
+        size_t n = src.size() < size ? src.size() : size;
+        memcpy(dst, src.data(), n);
+        if(n < size) { dst[n] = '\0'; }
+    }
+};
+
+/*
+ * 访问日志：按1/N采样，错误请求(>=400)与慢请求总是记录
+ * 记录只做整数拼接，最终通过Log的异步队列写出
+ */
+class AccessLog {
+public:
+    static AccessLog* Instance();
+
+    void Init(int sampleRate, int slowMs);
+    bool IsOpen() const { return isOpen_; }
+
+    void Record(const AccessRecord& rec);
+
+    uint64_t Total() const { return total_; }
+    uint64_t Written() const { return written_; }
+
+private:
+    AccessLog();
+    ~AccessLog() = default;
+    AccessLog(const AccessLog&) = delete;
+    AccessLog& operator=(const AccessLog&) = delete;
+
+    bool ShouldLog_(const AccessRecord& rec);
+    static size_t Format_(const AccessRecord& rec, char* out, size_t size);
+
+    bool isOpen_;
+    int sampleRate_;
+    uint32_t slowUs_;
+
+    std::atomic<uint64_t> total_;    // 见到的请求数
+    std::atomic<uint64_t> written_;  // 实际写出的记录数
+};
+
+#endif //ACCESS_LOG_H
@@ -95,7 +95,36 @@ void Log::write(int level, const char *format, ...) {
     struct tm t = *sysTime;
     va_list vaList;
 
-    /* 日志日期 日志行数 */
+    CheckFile_(t);
+
+    {
+        unique_lock<mutex> locker(mtx_);
+        lineCount_++;
+        int n = snprintf(buff_.BeginWrite(), 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
+                    t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
+                    t.tm_hour, t.tm_min, t.tm_sec, now.tv_usec);
+                    
+        buff_.HasWritten(n);
+        AppendLogLevelTitle_(level);
+
+        va_start(vaList, format);
+        int m = vsnprintf(buff_.BeginWrite(), buff_.WritableBytes(), format, vaList);
+        va_end(vaList);
+
+        buff_.HasWritten(m);
+        buff_.Append("\n\0", 2);
+
+        if(isAsync_ && deque_ && !deque_->full()) {
+            deque_->push_back(buff_.RetrieveAllToStr());
+        } else {
+            fputs(buff_.Peek(), fp_);
+        }
+        buff_.RetrieveAll();
+    }
+}
+
+/* 日志日期 日志行数：跨天或行数达到上限时切换日志文件 */
+void Log::CheckFile_(const struct tm& t) {
     if (toDay_ != t.tm_mday || (lineCount_ && (lineCount_  %  MAX_LINES == 0)))
     {
         unique_lock<mutex> locker(mtx_);
@@ -121,30 +150,21 @@ void Log::write(int level, const char *format, ...) {
         fp_ = fopen(newFile, "a");
         assert(fp_ != nullptr);
     }
+}
 
-    {
-        unique_lock<mutex> locker(mtx_);
-        lineCount_++;
-        int n = snprintf(buff_.BeginWrite(), 128, "%d-%02d-%02d %02d:%02d:%02d.%06ld ",
-                    t.tm_year + 1900, t.tm_mon + 1, t.tm_mday,
-                    t.tm_hour, t.tm_min, t.tm_sec, now.tv_usec);
-                    
-        buff_.HasWritten(n);
-        AppendLogLevelTitle_(level);
-
-        va_start(vaList, format);
-        int m = vsnprintf(buff_.BeginWrite(), buff_.WritableBytes(), format, vaList);
-        va_end(vaList);
-
-        buff_.HasWritten(m);
-        buff_.Append("\n\0", 2);
-
-        if(isAsync_ && deque_ && !deque_->full()) {
-            deque_->push_back(buff_.RetrieveAllToStr());
-        } else {
-            fputs(buff_.Peek(), fp_);
-        }
-        buff_.RetrieveAll();
+/* 写入已格式化好的整行(如访问日志)，不经过vsnprintf，同样走异步队列 */
+void Log::WriteRaw(const char* line, size_t len) {
+    time_t tSec = time(nullptr);
+    struct tm t;
+    localtime_r(&tSec, &t);
+    CheckFile_(t);
+
+    unique_lock<mutex> locker(mtx_);
+    lineCount_++;
+    if(isAsync_ && deque_ && !deque_->full()) {
+        deque_->push_back(string(line, len));
+    } else {
+        fwrite(line, 1, len, fp_);
     }
 }
 
@@ -27,6 +27,7 @@ public:
     static void FlushLogThread();
 
     void write(int level, const char *format,...);
+    void WriteRaw(const char* line, size_t len);
     void flush();
 
     int GetLevel();
@@ -36,6 +37,7 @@ public:
 private:
     Log();
     void AppendLogLevelTitle_(int level);
+    void CheckFile_(const struct tm& t);
     virtual ~Log();
     void AsyncWrite_();
 
@@ -2,18 +2,50 @@
  * @Author       : mark
  * @Date         : 2020-06-18
  * @copyleft Apache 2.0
- */ 
+ */
 #include <unistd.h>
 #include "server/webserver.h"
 
-int main() {
-    /* 守护进程 后台运行 */
-    //daemon(1, 0); 
-
+static int RunServer(const Config& config) {
     WebServer server(
         1316, 3, 60000, false,             /* 端口 ET模式 timeoutMs 优雅退出  */
         3306, "root", "root", "webserver", /* Mysql配置 */
-        12, 6, true, 1, 1024);             /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        12, 6, true, 1, 1024,              /* 连接池数量 线程池数量 日志开关 日志等级 日志异步队列容量 */
+        config);                           /* 可选功能配置 */
     server.Start();
-} 
-  
\ No newline at end of file
+    return 0;
+}
+
+int main() {
+    /* 守护进程 后台运行 */
+    //daemon(1, 0);
+
+    Config config;
+    config.openAccessLog = true;           /* 访问日志 */
+    config.accessSampleRate = 16;          /* 每16个请求采样1个，错误与慢请求总是记录 */
+    config.accessSlowMs = 200;
+    config.openCredCache = true;           /* 用户凭据缓存 */
+    config.workerProcesses = 0;            /* 工作进程数，0为单进程 */
+
+    if(config.workerProcesses <= 0) {
+        return RunServer(config);
+    }
+    /* 嵌入式存储在进程内，工作进程之间不能共享；在fork之前拒绝，避免工作进程初始化失败后被反复拉起 */
+    if(config.openEmbeddedStore) {
+        fprintf(stderr, "Embedded store can not be used with worker processes, use MySQL!\n");
+        return 1;
+    }
+    /* 多进程：共享监听套接字时在fork之前创建，工作进程继承 */
+    if(!config.listenReusePort) {
+        config.listenFd = WebServer::Listen(1316, false, config);
+        if(config.listenFd < 0) { return 1; }
+    }
+    Prefork master(config.workerProcesses, config.workerRestartDelayMs);
+    return master.Run([&config](int index) {
+        static char suffix[32];
+        snprintf(suffix, sizeof(suffix), ".worker%d.log", index);
+        Config workerConfig = config;
+        workerConfig.logSuffix = suffix;
+        return RunServer(workerConfig);
+    });
+}
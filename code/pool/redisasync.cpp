@@ -0,0 +1,314 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#include "redisasync.h"
+using namespace std;
+
+const int RedisAsync::RECONNECT_MS;
+
+RedisAsync::RedisAsync(Epoller* epoller): epoller_(epoller), port_(0), isClose_(true), next_(0) {
+    assert(epoller_);
+}
+
+RedisAsync::~RedisAsync() {
+    Close();
+}
+
+bool RedisAsync::Init(const char* host, int port, int connSize) {
+    assert(connSize > 0);
+    host_ = host;
+    port_ = port;
+    isClose_ = false;
+    for(int i = 0; i < connSize; i++) {
+        conns_.emplace_back(new Conn());
+        Conn* c = conns_.back().get();
+        c->owner = this;
+        lock_guard<mutex> locker(c->mtx);
+        Connect_(c);
+    }
+    return true;
+}
+
+void RedisAsync::Connect_(Conn* c) {
+    c->connected = false;
+    c->reconnectAt = Clock::now() + chrono::milliseconds(RECONNECT_MS);
+    redisAsyncContext* ctx = redisAsyncConnect(host_.c_str(), port_);
+    if(!ctx || ctx->err) {
+        LOG_ERROR("Redis async connect error: %s", ctx ? ctx->errstr : "alloc failed");
+        if(ctx) { redisAsyncFree(ctx); }
+        return;
+    }
+    c->ctx = ctx;
+    c->fd = ctx->c.fd;
+    c->events = 0;
+    {
+        lock_guard<mutex> locker(fdMtx_);
+        fdConn_[c->fd] = c;
+    }
+    epoller_->AddFd(c->fd, 0);
+
+    /* 事件钩子要在设置连接回调之前挂上，hiredis在设置回调时就会要求关注可写 */
+    ctx->data = c;
+    ctx->ev.data = c;
+    ctx->ev.addRead = AddRead_;
+    ctx->ev.delRead = DelRead_;
+    ctx->ev.addWrite = AddWrite_;
+    ctx->ev.delWrite = DelWrite_;
+    ctx->ev.cleanup = Cleanup_;
+    redisAsyncSetConnectCallback(ctx, OnConnect_);
+    redisAsyncSetDisconnectCallback(ctx, OnDisconnect_);
+}
+
+void RedisAsync::Update_(Conn* c) {
+    if(c->fd >= 0) {
+        epoller_->ModFd(c->fd, c->events);
+    }
+}
+
+void RedisAsync::AddRead_(void* data) {
+    Conn* c = static_cast<Conn*>(data);
+    c->events |= EPOLLIN;
+    c->owner->Update_(c);
+}
+
+void RedisAsync::DelRead_(void* data) {
+    Conn* c = static_cast<Conn*>(data);
+    c->events &= ~EPOLLIN;
+    c->owner->Update_(c);
+}
+
+void RedisAsync::AddWrite_(void* data) {
+    Conn* c = static_cast<Conn*>(data);
+    c->events |= EPOLLOUT;
+    c->owner->Update_(c);
+}
+
+void RedisAsync::DelWrite_(void* data) {
+    Conn* c = static_cast<Conn*>(data);
+    c->events &= ~EPOLLOUT;
+    c->owner->Update_(c);
+}
+
+void RedisAsync::Cleanup_(void* data) {
+    Conn* c = static_cast<Conn*>(data);
+    RedisAsync* self = c->owner;
+    if(c->fd >= 0) {
+        self->epoller_->DelFd(c->fd);
+        lock_guard<mutex> locker(self->fdMtx_);
+        self->fdConn_.erase(c->fd);
+    }
+    c->fd = -1;
+    c->events = 0;
+}
+
+void RedisAsync::OnConnect_(const redisAsyncContext* ctx, int status) {
+    Conn* c = static_cast<Conn*>(ctx->data);
+    if(status != REDIS_OK) {
+        /* 连接失败后hiredis会释放上下文 */
+        LOG_ERROR("Redis async connect error: %s", ctx->errstr);
+        c->ctx = nullptr;
+        return;
+    }
+    c->connected = true;
+    LOG_INFO("Redis async conn[%d] connected", c->fd);
+}
+
+void RedisAsync::OnDisconnect_(const redisAsyncContext* ctx, int status) {
+    Conn* c = static_cast<Conn*>(ctx->data);
+    if(status != REDIS_OK) {
+        LOG_WARN("Redis async conn lost: %s", ctx->errstr);
+    }
+    c->ctx = nullptr;
+    c->connected = false;
+    c->reconnectAt = Clock::now() + chrono::milliseconds(RECONNECT_MS);
+}
+
+void RedisAsync::OnReply_(redisAsyncContext* ctx, void* reply, void* privdata) {
+    Conn* c = static_cast<Conn*>(ctx->data);
+    unique_ptr<RedisCallBack> cb(static_cast<RedisCallBack*>(privdata));
+    c->done.emplace_back(move(*cb), Convert_(static_cast<redisReply*>(reply)));
+}
+
+RedisValue RedisAsync::Convert_(const redisReply* reply) {
+    RedisValue value;
+    if(!reply) {
+        return value;  // 连接断开或被释放
+    }
+    switch(reply->type) {
+    case REDIS_REPLY_STRING:
+    case REDIS_REPLY_STATUS:
+        value.ok = true;
+        value.nil = false;
+        value.str.assign(reply->str, reply->len);
+        break;
+    case REDIS_REPLY_ERROR:
+        value.nil = false;
+        value.str.assign(reply->str, reply->len);
+        break;
+    case REDIS_REPLY_INTEGER:
+        value.ok = true;
+        value.nil = false;
+        value.integer = reply->integer;
+        break;
+    case REDIS_REPLY_NIL:
+        value.ok = true;
+        break;
+    case REDIS_REPLY_ARRAY:
+        value.ok = true;
+        value.nil = false;
+        for(size_t i = 0; i < reply->elements; i++) {
+            value.elements.push_back(Convert_(reply->element[i]));
+        }
+        break;
+    default:
+        value.ok = true;
+        break;
+    }
+    return value;
+}
+
+void RedisAsync::Run_(Completions& done) {
+    for(auto& item: done) {
+        if(item.first) { item.first(item.second); }
+    }
+}
+
+void RedisAsync::Command(const vector<string>& argv, RedisCallBack cb) {
+    assert(!argv.empty());
+    vector<const char*> args;
+    vector<size_t> lens;
+    for(const string& arg: argv) {
+        args.push_back(arg.data());
+        lens.push_back(arg.size());
+    }
+    size_t n = conns_.size();
+    size_t start = next_.fetch_add(1, memory_order_relaxed);
+    for(size_t i = 0; i < n && !isClose_; i++) {
+        Conn* c = conns_[(start + i) % n].get();
+        lock_guard<mutex> locker(c->mtx);
+        if(!c->ctx) { continue; }
+        /* 只是追加到连接的输出缓冲，由事件循环写出，同一连接上的命令自然形成流水线 */
+        RedisCallBack* privdata = new RedisCallBack(move(cb));
+        if(redisAsyncCommandArgv(c->ctx, OnReply_, privdata, static_cast<int>(args.size()),
+                                 args.data(), lens.data()) == REDIS_OK) {
+            return;
+        }
+        cb = move(*privdata);
+        delete privdata;
+    }
+    LOG_WARN("Redis async no connection available!");
+    cb(RedisValue());
+}
+
+future<RedisValue> RedisAsync::Command(const vector<string>& argv) {
+    auto result = make_shared<promise<RedisValue>>();
+    future<RedisValue> fut = result->get_future();
+    Command(argv, [result](const RedisValue& value) {
+        result->set_value(value);
+    });
+    return fut;
+}
+
+void RedisAsync::Get(const string& key, RedisCallBack cb) {
+    Command({"GET", key}, move(cb));
+}
+
+void RedisAsync::Set(const string& key, const string& value, int ttlSec, RedisCallBack cb) {
+    if(ttlSec > 0) {
+        Command({"SET", key, value, "EX", to_string(ttlSec)}, move(cb));
+    } else {
+        Command({"SET", key, value}, move(cb));
+    }
+}
+
+void RedisAsync::Del(const string& key, RedisCallBack cb) {
+    Command({"DEL", key}, move(cb));
+}
+
+void RedisAsync::MGet(const vector<string>& keys, RedisCallBack cb) {
+    vector<string> argv;
+    argv.reserve(keys.size() + 1);
+    argv.push_back("MGET");
+    argv.insert(argv.end(), keys.begin(), keys.end());
+    Command(argv, move(cb));
+}
+
+void RedisAsync::MSet(const vector<pair<string, string>>& kvs, RedisCallBack cb) {
+    vector<string> argv;
+    argv.reserve(kvs.size() * 2 + 1);
+    argv.push_back("MSET");
+    for(const auto& kv: kvs) {
+        argv.push_back(kv.first);
+        argv.push_back(kv.second);
+    }
+    Command(argv, move(cb));
+}
+
+bool RedisAsync::HandleEvent(int fd, uint32_t events) {
+    Conn* c = nullptr;
+    {
+        lock_guard<mutex> locker(fdMtx_);
+        auto it = fdConn_.find(fd);
+        if(it == fdConn_.end()) {
+            return false;
+        }
+        c = it->second;
+    }
+    Completions done;
+    {
+        lock_guard<mutex> locker(c->mtx);
+        if(c->ctx && c->fd == fd) {
+            if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+                redisAsyncHandleRead(c->ctx);
+            }
+            /* 读处理中连接可能已断开并释放 */
+            if(c->ctx && (events & EPOLLOUT)) {
+                redisAsyncHandleWrite(c->ctx);
+            }
+        }
+        done.swap(c->done);
+    }
+    Run_(done);
+    return true;
+}
+
+int RedisAsync::GetNextTick() {
+    if(isClose_) { return -1; }
+    int next = -1;
+    Clock::time_point now = Clock::now();
+    for(auto& item: conns_) {
+        Conn* c = item.get();
+        Completions done;
+        {
+            lock_guard<mutex> locker(c->mtx);
+            if(!c->ctx) {
+                if(c->reconnectAt <= now) { Connect_(c); }
+                int ms = static_cast<int>(chrono::duration_cast<chrono::milliseconds>(c->reconnectAt - now).count());
+                if(!c->ctx && (next < 0 || ms < next)) { next = ms > 0 ? ms : 0; }
+            }
+            done.swap(c->done);
+        }
+        Run_(done);
+    }
+    return next;
+}
+
+void RedisAsync::Close() {
+    if(isClose_.exchange(true)) { return; }
+    for(auto& item: conns_) {
+        Conn* c = item.get();
+        Completions done;
+        {
+            lock_guard<mutex> locker(c->mtx);
+            if(c->ctx) {
+                /* 未完成的命令以空回复回调 */
+                redisAsyncFree(c->ctx);
+                c->ctx = nullptr;
+            }
+            done.swap(c->done);
+        }
+        Run_(done);
+    }
+}
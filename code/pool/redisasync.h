@@ -0,0 +1,106 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#ifndef REDIS_ASYNC_H
+#define REDIS_ASYNC_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <functional>
+#include <unordered_map>
+#include <hiredis/hiredis.h>
+#include <hiredis/async.h>
+#include "../log/log.h"
+#include "../server/epoller.h"
+
+/* hiredis回复的拷贝，回调返回后依然有效 */
+struct RedisValue {
+    bool ok = false;   // 命令已执行且不是错误回复
+    bool nil = true;   // 空回复(GET不存在的key等)
+    std::string str;   // 字符串/状态/错误信息
+    long long integer = 0;
+    std::vector<RedisValue> elements;  // 数组回复(MGET等)
+};
+
+typedef std::function<void(const RedisValue&)> RedisCallBack;
+
+/*
+ * 基于hiredis异步接口的Redis客户端
+ * 少量连接挂在服务器的Epoller上，每个连接上可以同时有任意多条未完成的命令(流水线)，
+ * 命令按轮询分配到各连接；结果通过回调或future返回，不占用线程等待
+ * 所有接口线程安全，回调在事件循环线程中执行，不能阻塞
+ */
+class RedisAsync {
+public:
+    explicit RedisAsync(Epoller* epoller);
+    ~RedisAsync();
+
+    bool Init(const char* host, int port, int connSize);
+
+    void Command(const std::vector<std::string>& argv, RedisCallBack cb);
+    std::future<RedisValue> Command(const std::vector<std::string>& argv);
+
+    void Get(const std::string& key, RedisCallBack cb);
+    void Set(const std::string& key, const std::string& value, int ttlSec, RedisCallBack cb);
+    void Del(const std::string& key, RedisCallBack cb);
+    /* 批量读写，一次往返完成 */
+    void MGet(const std::vector<std::string>& keys, RedisCallBack cb);
+    void MSet(const std::vector<std::pair<std::string, std::string>>& kvs, RedisCallBack cb);
+
+    /* 由事件循环调用：fd属于本客户端时处理并返回true */
+    bool HandleEvent(int fd, uint32_t events);
+    /* 断线重连，返回距下一次重连的毫秒数，没有则返回-1 */
+    int GetNextTick();
+
+    void Close();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    typedef std::vector<std::pair<RedisCallBack, RedisValue>> Completions;
+
+    struct Conn {
+        RedisAsync* owner;
+        std::mutex mtx;  // hiredis上下文不是线程安全的
+        redisAsyncContext* ctx = nullptr;
+        int fd = -1;
+        uint32_t events = 0;  // hiredis当前要求关注的事件
+        bool connected = false;
+        Clock::time_point reconnectAt;
+        Completions done;  // 锁内产生、锁外执行的回调
+    };
+
+    void Connect_(Conn* c);
+    void Update_(Conn* c);
+    static void Run_(Completions& done);
+    static RedisValue Convert_(const redisReply* reply);
+
+    /* hiredis事件适配 */
+    static void AddRead_(void* data);
+    static void DelRead_(void* data);
+    static void AddWrite_(void* data);
+    static void DelWrite_(void* data);
+    static void Cleanup_(void* data);
+    static void OnConnect_(const redisAsyncContext* ctx, int status);
+    static void OnDisconnect_(const redisAsyncContext* ctx, int status);
+    static void OnReply_(redisAsyncContext* ctx, void* reply, void* privdata);
+
+    static const int RECONNECT_MS = 1000;
+
+    Epoller* epoller_;
+    std::string host_;
+    int port_;
+    std::atomic<bool> isClose_;  // 工作线程中的Command与事件循环中的Close同时访问
+    std::atomic<size_t> next_;
+    std::vector<std::unique_ptr<Conn>> conns_;
+    std::mutex fdMtx_;
+    std::unordered_map<int, Conn*> fdConn_;
+};
+
+#endif //REDIS_ASYNC_H
@@ -64,13 +64,17 @@ void RedisConnPool::Init(const char* host, int port, int connSize) {
     assert(connSize > 0);
     connSize = connSize > MAX_CONN_ ? MAX_CONN_ : connSize;
     for(int i = 0; i < connSize; i++) {
-        Redis* redisConn = new Redis(host, port);
-        if(!redisConn) {
-            LOG_ERROR("Rediss init error");
-        } 
+        Redis* redisConn = nullptr;
+        try {
+            redisConn = new Redis(host, port);
+        } catch(const std::exception& e) {
+            LOG_ERROR("Redis init error: %s", e.what());
+            continue;
+        }
         connQue_.push(redisConn);
-        freeCount_ =   connSize;
     }
+    freeCount_ = connQue_.size();
+    sem_init(&semId_, 0, freeCount_);
 } 
 
 // 获取数据库连接池中的连接
@@ -93,9 +97,9 @@ Redis* RedisConnPool::GetConn() {
 
 void RedisConnPool::FreeConn(Redis * conn) {
     assert(conn);
-    connQue_.push(conn);
     {
         std::lock_guard<std::mutex> locker(mtx_);
+        connQue_.push(conn);
         freeCount_++;
         useCount_--;
     }
@@ -114,7 +118,7 @@ void RedisConnPool::ClosePool() {
     std::lock_guard<std::mutex> locker(mtx_);
     while(!connQue_.empty()) {
         auto item = connQue_.front();
-        item->~Redis();
+        delete item;
         connQue_.pop();
     }   
 }
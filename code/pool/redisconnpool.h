@@ -1,3 +1,6 @@
+#ifndef REDIS_CONN_POOL_H
+#define REDIS_CONN_POOL_H
+
 #include <iostream>
 #include <stdexcept>
 #include <string>
@@ -118,4 +121,6 @@ private:
 //     }
 
 //     return 0;
-// }
\ No newline at end of file
+// }
+
+#endif //REDIS_CONN_POOL_H
@@ -0,0 +1,442 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+
+#include "sqlasyncpool.h"
+using namespace std;
+
+const int SqlAsyncPool::RECONNECT_MS;
+
+SqlAsyncPool::SqlAsyncPool(Epoller* epoller):
+    epoller_(epoller), port_(0), maxWait_(1), timeoutMS_(0), isClose_(true) {
+    assert(epoller_);
+}
+
+SqlAsyncPool::~SqlAsyncPool() {
+    Close();
+}
+
+void SqlAsyncPool::Run_(Completions& done) {
+    for(auto& item: done) {
+        if(item.first) { item.first(item.second); }
+    }
+}
+
+/* MYSQL_WAIT_READ 等宏只有MariaDB Connector/C提供 */
+#ifdef MYSQL_WAIT_READ
+
+bool SqlAsyncPool::Init(const char* host, int port,
+            const char* user, const char* pwd, const char* dbName,
+            int connSize, int maxWait, int timeoutMS) {
+    assert(connSize > 0);
+    Completions done;
+    {
+        lock_guard<mutex> locker(mtx_);
+        host_ = host;
+        user_ = user;
+        pwd_ = pwd;
+        dbName_ = dbName;
+        port_ = port;
+        maxWait_ = maxWait > 0 ? maxWait : 1;
+        timeoutMS_ = timeoutMS;
+        isClose_ = false;
+        for(int i = 0; i < connSize; i++) {
+            unique_ptr<Conn> c(new Conn());
+            c->sql = c->connRet = nullptr;
+            c->fd = -1;
+            c->armed = 0;
+            c->state = CLOSED;
+            c->busy = false;
+            c->waitTimeout = false;
+            for(int j = 0; j < STMT_COUNT; j++) {
+                c->stmts[j] = nullptr;
+            }
+            conns_.push_back(move(c));
+            Reconnect_(conns_.back().get(), &done);
+        }
+    }
+    Run_(done);
+    return true;
+}
+
+void SqlAsyncPool::Query(SqlStmtId id, vector<string> params, SqlAsyncCallBack cb) {
+    Completions done;
+    bool reject = false;
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(isClose_ || waitQue_.size() >= maxWait_) {
+            reject = true;
+        } else {
+            waitQue_.push_back({id, move(params), move(cb), Clock::now() + chrono::milliseconds(timeoutMS_)});
+            for(auto& c: conns_) {
+                if(c->state == IDLE) {
+                    Advance_(c.get(), 0, &done);
+                    break;
+                }
+            }
+        }
+    }
+    if(reject) {
+        LOG_WARN("SqlAsyncPool busy!");
+        cb({false, {}, 0});
+    }
+    Run_(done);
+}
+
+bool SqlAsyncPool::HandleEvent(int fd, uint32_t events) {
+    Completions done;
+    {
+        lock_guard<mutex> locker(mtx_);
+        auto it = fdConn_.find(fd);
+        if(it == fdConn_.end()) {
+            return false;
+        }
+        Conn* c = it->second;
+        if(c->state == IDLE) {
+            /* 空闲连接上出现可读或挂断，只能是服务端关闭了连接 */
+            LOG_WARN("MySql async conn[%d] closed by server", fd);
+            Broken_(c, &done);
+        } else {
+            int ready = 0;
+            if(events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) { ready |= MYSQL_WAIT_READ; }
+            if(events & EPOLLOUT) { ready |= MYSQL_WAIT_WRITE; }
+            if(events & EPOLLPRI) { ready |= MYSQL_WAIT_EXCEPT; }
+            Advance_(c, ready, &done);
+        }
+    }
+    Run_(done);
+    return true;
+}
+
+int SqlAsyncPool::GetNextTick() {
+    Completions done;
+    int next = -1;
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(isClose_) { return -1; }
+        TimeStamp now = Clock::now();
+        while(!waitQue_.empty() && waitQue_.front().deadline <= now) {
+            LOG_WARN("SqlAsyncPool wait timeout!");
+            done.emplace_back(move(waitQue_.front().cb), SqlAsyncResult{false, {}, 0});
+            waitQue_.pop_front();
+        }
+        for(auto& item: conns_) {
+            Conn* c = item.get();
+            if(c->state == CLOSED) {
+                if(c->reconnectAt <= now) { Reconnect_(c, &done); }
+            }
+            else if(c->busy && c->task.deadline <= now) {
+                /* 连接处在协议中间状态，只能丢弃后重连 */
+                LOG_WARN("MySql async query timeout!");
+                Broken_(c, &done);
+            }
+            else if(c->waitTimeout && c->ioDeadline <= now) {
+                Advance_(c, MYSQL_WAIT_TIMEOUT, &done);
+            }
+        }
+
+        auto update = [&](const TimeStamp& t) {
+            int ms = static_cast<int>(chrono::duration_cast<chrono::milliseconds>(t - now).count());
+            if(ms < 0) { ms = 0; }
+            if(next < 0 || ms < next) { next = ms; }
+        };
+        if(!waitQue_.empty()) { update(waitQue_.front().deadline); }
+        for(auto& item: conns_) {
+            Conn* c = item.get();
+            if(c->state == CLOSED) { update(c->reconnectAt); }
+            if(c->busy) { update(c->task.deadline); }
+            if(c->waitTimeout) { update(c->ioDeadline); }
+        }
+    }
+    Run_(done);
+    return next;
+}
+
+void SqlAsyncPool::Close() {
+    Completions done;
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(isClose_) { return; }
+        isClose_ = true;
+        for(auto& item: conns_) {
+            Broken_(item.get(), &done);
+        }
+        while(!waitQue_.empty()) {
+            done.emplace_back(move(waitQue_.front().cb), SqlAsyncResult{false, {}, 0});
+            waitQue_.pop_front();
+        }
+    }
+    Run_(done);
+}
+
+/* 推进连接上的状态机，直到需要等待IO、连接空闲或断开 */
+void SqlAsyncPool::Advance_(Conn* c, int ready, Completions* done) {
+    int status = 0;
+    int err = 0;
+    while(true) {
+        switch(c->state) {
+        case CONNECTING:
+            if(ready) {
+                status = mysql_real_connect_cont(&c->connRet, c->sql, ready);
+            } else {
+                status = mysql_real_connect_start(&c->connRet, c->sql, host_.c_str(),
+                            user_.c_str(), pwd_.c_str(), dbName_.c_str(), port_, nullptr, 0);
+            }
+            if(status) { Wait_(c, status); return; }
+            if(!c->connRet) {
+                LOG_ERROR("MySql async connect error: %s", mysql_error(c->sql));
+                Broken_(c, done);
+                return;
+            }
+            c->state = IDLE;
+            break;
+        case IDLE:
+            if(!StartTask_(c)) {
+                /* 空闲时关注可读，及时发现服务端断开 */
+                Wait_(c, MYSQL_WAIT_READ);
+                return;
+            }
+            break;
+        case PREPARING: {
+            SqlStmtId id = c->task.id;
+            if(ready) {
+                status = mysql_stmt_prepare_cont(&err, c->stmts[id], ready);
+            } else {
+                c->stmts[id] = mysql_stmt_init(c->sql);
+                if(!c->stmts[id]) {
+                    Broken_(c, done);
+                    return;
+                }
+                const char* sql = SqlStmtCache::Sql(id);
+                status = mysql_stmt_prepare_start(&err, c->stmts[id], sql, strlen(sql));
+            }
+            if(status) { Wait_(c, status); return; }
+            if(err) {
+                LOG_ERROR("MySql async prepare error: %s", mysql_stmt_error(c->stmts[id]));
+                Fail_(c, c->stmts[id], done);
+                if(c->stmts[id]) {
+                    mysql_stmt_close(c->stmts[id]);
+                    c->stmts[id] = nullptr;
+                }
+                break;
+            }
+            c->state = EXECUTING;
+            break;
+        }
+        case EXECUTING: {
+            MYSQL_STMT* stmt = c->stmts[c->task.id];
+            if(ready) {
+                status = mysql_stmt_execute_cont(&err, stmt, ready);
+            } else {
+                BindParams_(c);
+                if(mysql_stmt_bind_param(stmt, c->paramBind.data())) {
+                    Complete_(c, false, done);
+                    break;
+                }
+                status = mysql_stmt_execute_start(&err, stmt);
+            }
+            if(status) { Wait_(c, status); return; }
+            if(err) {
+                Fail_(c, stmt, done);
+                break;
+            }
+            if(mysql_stmt_field_count(stmt) == 0) {
+                Complete_(c, true, done);
+                break;
+            }
+            c->state = STORING;
+            break;
+        }
+        case STORING: {
+            MYSQL_STMT* stmt = c->stmts[c->task.id];
+            if(ready) {
+                status = mysql_stmt_store_result_cont(&err, stmt, ready);
+            } else {
+                if(!BindResults_(c, stmt)) {
+                    Complete_(c, false, done);
+                    break;
+                }
+                status = mysql_stmt_store_result_start(&err, stmt);
+            }
+            if(status) { Wait_(c, status); return; }
+            if(err) {
+                Fail_(c, stmt, done);
+                break;
+            }
+            Complete_(c, true, done);
+            break;
+        }
+        default:
+            return;
+        }
+        ready = 0;
+    }
+}
+
+bool SqlAsyncPool::StartTask_(Conn* c) {
+    assert(c->state == IDLE && !c->busy);
+    if(waitQue_.empty()) {
+        return false;
+    }
+    c->task = move(waitQue_.front());
+    waitQue_.pop_front();
+    c->busy = true;
+    c->state = c->stmts[c->task.id] ? EXECUTING : PREPARING;
+    return true;
+}
+
+void SqlAsyncPool::BindParams_(Conn* c) {
+    const vector<string>& params = c->task.params;
+    c->paramBind.assign(params.size(), MYSQL_BIND());
+    c->paramLen.assign(params.size(), 0);
+    for(size_t i = 0; i < params.size(); i++) {
+        c->paramLen[i] = params[i].size();
+        c->paramBind[i].buffer_type = MYSQL_TYPE_STRING;
+        c->paramBind[i].buffer = const_cast<char*>(params[i].data());
+        c->paramBind[i].buffer_length = params[i].size();
+        c->paramBind[i].length = &c->paramLen[i];
+    }
+}
+
+bool SqlAsyncPool::BindResults_(Conn* c, MYSQL_STMT* stmt) {
+    unsigned int n = mysql_stmt_field_count(stmt);
+    c->resultBind.assign(n, MYSQL_BIND());
+    c->resultBuf.assign(n, vector<char>(RESULT_BUF_LEN));
+    c->resultLen.assign(n, 0);
+    for(unsigned int i = 0; i < n; i++) {
+        c->resultBind[i].buffer_type = MYSQL_TYPE_STRING;
+        c->resultBind[i].buffer = c->resultBuf[i].data();
+        c->resultBind[i].buffer_length = RESULT_BUF_LEN;
+        c->resultBind[i].length = &c->resultLen[i];
+    }
+    return mysql_stmt_bind_result(stmt, c->resultBind.data()) == 0;
+}
+
+void SqlAsyncPool::Complete_(Conn* c, bool ok, Completions* done) {
+    SqlAsyncResult res{ok, {}, 0};
+    MYSQL_STMT* stmt = c->stmts[c->task.id];
+    if(ok && c->state == STORING) {
+        /* 结果已全部缓存在客户端，fetch不会产生网络IO */
+        int ret = mysql_stmt_fetch(stmt);
+        if(ret == 0 || ret == MYSQL_DATA_TRUNCATED) {
+            for(size_t i = 0; i < c->resultBuf.size(); i++) {
+                unsigned long len = c->resultLen[i] < RESULT_BUF_LEN ? c->resultLen[i] : RESULT_BUF_LEN;
+                res.row.emplace_back(c->resultBuf[i].data(), len);
+            }
+        }
+        mysql_stmt_free_result(stmt);
+    } else if(ok) {
+        res.affected = mysql_stmt_affected_rows(stmt);
+    }
+    done->emplace_back(move(c->task.cb), move(res));
+    c->task = Task();
+    c->busy = false;
+    c->state = IDLE;
+}
+
+void SqlAsyncPool::Fail_(Conn* c, MYSQL_STMT* stmt, Completions* done) {
+    unsigned int err = mysql_stmt_errno(stmt);
+    LOG_WARN("MySql async stmt error: %s", mysql_stmt_error(stmt));
+    if(err == CR_SERVER_GONE_ERROR || err == CR_SERVER_LOST) {
+        Broken_(c, done);
+    } else {
+        Complete_(c, false, done);
+    }
+}
+
+void SqlAsyncPool::Wait_(Conn* c, int status) {
+    uint32_t events = 0;
+    if(status & MYSQL_WAIT_READ) { events |= EPOLLIN; }
+    if(status & MYSQL_WAIT_WRITE) { events |= EPOLLOUT; }
+    if(status & MYSQL_WAIT_EXCEPT) { events |= EPOLLPRI; }
+    c->waitTimeout = status & MYSQL_WAIT_TIMEOUT;
+    if(c->waitTimeout) {
+        c->ioDeadline = Clock::now() + chrono::seconds(mysql_get_timeout_value(c->sql));
+    }
+    int fd = mysql_get_socket(c->sql);
+    if(fd != c->fd) {
+        if(c->fd >= 0) {
+            epoller_->DelFd(c->fd);
+            fdConn_.erase(c->fd);
+        }
+        c->fd = fd;
+        c->armed = 0;
+        if(fd < 0) { return; }
+        fdConn_[fd] = c;
+        epoller_->AddFd(fd, events);
+        c->armed = events;
+        return;
+    }
+    if(fd >= 0 && events != c->armed) {
+        epoller_->ModFd(fd, events);
+        c->armed = events;
+    }
+}
+
+void SqlAsyncPool::Reconnect_(Conn* c, Completions* done) {
+    assert(c->state == CLOSED);
+    c->sql = mysql_init(nullptr);
+    if(!c->sql) {
+        LOG_ERROR("MySql init error!");
+        c->reconnectAt = Clock::now() + chrono::milliseconds(RECONNECT_MS);
+        return;
+    }
+    mysql_options(c->sql, MYSQL_OPT_NONBLOCK, 0);
+    c->state = CONNECTING;
+    Advance_(c, 0, done);
+}
+
+/* 连接不可用：当前任务失败，释放连接，稍后重连 */
+void SqlAsyncPool::Broken_(Conn* c, Completions* done) {
+    if(c->busy) {
+        done->emplace_back(move(c->task.cb), SqlAsyncResult{false, {}, 0});
+        c->task = Task();
+        c->busy = false;
+    }
+    if(c->fd >= 0) {
+        epoller_->DelFd(c->fd);
+        fdConn_.erase(c->fd);
+        /* 先关闭socket，后续的close不会再阻塞在网络IO上 */
+        shutdown(c->fd, SHUT_RDWR);
+        c->fd = -1;
+    }
+    for(int i = 0; i < STMT_COUNT; i++) {
+        if(c->stmts[i]) {
+            mysql_stmt_close(c->stmts[i]);
+            c->stmts[i] = nullptr;
+        }
+    }
+    if(c->sql) {
+        mysql_close(c->sql);
+        c->sql = nullptr;
+    }
+    c->armed = 0;
+    c->waitTimeout = false;
+    c->state = CLOSED;
+    c->reconnectAt = Clock::now() + chrono::milliseconds(RECONNECT_MS);
+}
+
+#else
+
+bool SqlAsyncPool::Init(const char*, int, const char*, const char*, const char*, int, int, int) {
+    LOG_ERROR("SqlAsyncPool needs the MariaDB non-blocking client API!");
+    return false;
+}
+
+void SqlAsyncPool::Query(SqlStmtId, vector<string>, SqlAsyncCallBack cb) {
+    cb({false, {}, 0});
+}
+
+bool SqlAsyncPool::HandleEvent(int, uint32_t) {
+    return false;
+}
+
+int SqlAsyncPool::GetNextTick() {
+    return -1;
+}
+
+void SqlAsyncPool::Close() {}
+
+#endif
@@ -0,0 +1,126 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#ifndef SQLASYNCPOOL_H
+#define SQLASYNCPOOL_H
+
+#include <mysql/mysql.h>
+#include <sys/socket.h>  // shutdown
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <unordered_map>
+#include "../log/log.h"
+#include "../server/epoller.h"
+#include "sqlstmtcache.h"
+
+struct SqlAsyncResult {
+    bool ok;                       // 执行成功
+    std::vector<std::string> row;  // 结果集第一行，无结果集或结果为空时为空
+    unsigned long long affected;   // 影响行数
+};
+
+typedef std::function<void(const SqlAsyncResult&)> SqlAsyncCallBack;
+
+/*
+ * 非阻塞数据库连接池(MariaDB Connector/C 的 mysql_xxx_start / mysql_xxx_cont 接口)
+ * 连接的socket注册到服务器的Epoller中，由事件循环推进每个连接上的状态机，
+ * 查询期间不占用任何工作线程
+ * 所有连接都忙时请求进入有界等待队列，队列满或超时直接失败
+ */
+class SqlAsyncPool {
+public:
+    explicit SqlAsyncPool(Epoller* epoller);
+    ~SqlAsyncPool();
+
+    bool Init(const char* host, int port,
+              const char* user, const char* pwd, const char* dbName,
+              int connSize, int maxWait, int timeoutMS);
+
+    /* 线程安全；回调在事件循环线程中执行(立即失败时在调用线程中执行)，不能阻塞 */
+    void Query(SqlStmtId id, std::vector<std::string> params, SqlAsyncCallBack cb);
+
+    /* 由事件循环调用：fd属于本池时处理并返回true */
+    bool HandleEvent(int fd, uint32_t events);
+
+    /* 处理超时与重连，返回距下一次需要处理的毫秒数，没有则返回-1 */
+    int GetNextTick();
+
+    void Close();
+
+private:
+    typedef std::chrono::steady_clock Clock;
+    typedef Clock::time_point TimeStamp;
+
+    enum STATE {
+        CLOSED,      // 未连接，等待重连
+        CONNECTING,
+        IDLE,
+        PREPARING,
+        EXECUTING,
+        STORING,
+    };
+
+    struct Task {
+        SqlStmtId id;
+        std::vector<std::string> params;
+        SqlAsyncCallBack cb;
+        TimeStamp deadline;
+    };
+
+    struct Conn {
+        MYSQL* sql;
+        MYSQL* connRet;
+        int fd;
+        uint32_t armed;  // 当前在epoll中关注的事件
+        STATE state;
+        bool busy;  // 持有任务
+        Task task;
+        MYSQL_STMT* stmts[STMT_COUNT];
+        /* 参数与结果绑定缓冲，生命周期覆盖整个异步执行过程 */
+        std::vector<MYSQL_BIND> paramBind;
+        std::vector<unsigned long> paramLen;
+        std::vector<MYSQL_BIND> resultBind;
+        std::vector<std::vector<char>> resultBuf;
+        std::vector<unsigned long> resultLen;
+        bool waitTimeout;  // 客户端库要求的超时等待
+        TimeStamp ioDeadline;
+        TimeStamp reconnectAt;
+    };
+
+    typedef std::vector<std::pair<SqlAsyncCallBack, SqlAsyncResult>> Completions;
+
+    void Advance_(Conn* c, int ready, Completions* done);
+    bool StartTask_(Conn* c);
+    void BindParams_(Conn* c);
+    bool BindResults_(Conn* c, MYSQL_STMT* stmt);
+    void Complete_(Conn* c, bool ok, Completions* done);
+    void Fail_(Conn* c, MYSQL_STMT* stmt, Completions* done);
+    void Wait_(Conn* c, int status);
+    void Reconnect_(Conn* c, Completions* done);
+    void Broken_(Conn* c, Completions* done);
+    static void Run_(Completions& done);
+
+    static const int RECONNECT_MS = 1000;
+    static const unsigned long RESULT_BUF_LEN = 256;
+
+    Epoller* epoller_;
+    std::string host_, user_, pwd_, dbName_;
+    int port_;
+    size_t maxWait_;
+    int timeoutMS_;
+    bool isClose_;
+
+    std::vector<std::unique_ptr<Conn>> conns_;
+    std::unordered_map<int, Conn*> fdConn_;
+    std::deque<Task> waitQue_;
+    std::mutex mtx_;
+};
+
+#endif // SQLASYNCPOOL_H
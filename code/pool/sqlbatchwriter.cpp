@@ -0,0 +1,236 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+
+#include "sqlbatchwriter.h"
+#include <future>
+#include <unordered_set>
+using namespace std;
+
+SqlBatchWriter::SqlBatchWriter(): pool_(nullptr), isOpen_(false), isClose_(false),
+    maxBatch_(1), window_(0), batches_(0), rows_(0) {}
+
+SqlBatchWriter* SqlBatchWriter::Instance() {
+    static SqlBatchWriter inst;
+    return &inst;
+}
+
+SqlBatchWriter::~SqlBatchWriter() {
+    Close();
+}
+
+void SqlBatchWriter::Init(SqlConnPool* pool, int maxBatch, int windowMS) {
+    assert(pool && maxBatch > 0 && windowMS >= 0);
+    pool_ = pool;
+    maxBatch_ = maxBatch;
+    window_ = chrono::milliseconds(windowMS);
+    isClose_ = false;
+    isOpen_ = true;
+    writer_ = thread(&SqlBatchWriter::Loop_, this);
+}
+
+void SqlBatchWriter::AddUser(const string& name, const string& pwd, const DoneCallBack& cb) {
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(!isClose_) {
+            queue_.push_back({name, pwd, cb, Clock::now()});
+            cond_.notify_one();
+            return;
+        }
+    }
+    cb(false);
+}
+
+bool SqlBatchWriter::AddUser(const string& name, const string& pwd) {
+    auto result = make_shared<promise<bool>>();
+    future<bool> fut = result->get_future();
+    AddUser(name, pwd, [result](bool ok) { result->set_value(ok); });
+    return fut.get();
+}
+
+void SqlBatchWriter::Loop_() {
+    mysql_thread_init();
+    unique_lock<mutex> locker(mtx_);
+    while(true) {
+        cond_.wait(locker, [this] { return isClose_ || !queue_.empty(); });
+        if(queue_.empty()) { break; }  // 已关闭且队列清空
+        /* 从第一条等待的注册开始计时，窗口结束或攒满一批即写入 */
+        Clock::time_point deadline = queue_.front().enqueued + window_;
+        cond_.wait_until(locker, deadline, [this] {
+            return isClose_ || queue_.size() >= maxBatch_;
+        });
+        vector<Pending> batch;
+        while(!queue_.empty() && batch.size() < maxBatch_) {
+            batch.push_back(move(queue_.front()));
+            queue_.pop_front();
+        }
+        locker.unlock();
+
+        vector<bool> result(batch.size(), false);
+        Flush_(batch, result);
+        for(size_t i = 0; i < batch.size(); i++) {
+            batch[i].cb(result[i]);
+        }
+        locker.lock();
+    }
+    locker.unlock();
+    mysql_thread_end();
+}
+
+void SqlBatchWriter::Flush_(vector<Pending>& batch, vector<bool>& result) {
+    /* 批内去重，同名的后来者直接失败 */
+    unordered_set<string> names;
+    vector<size_t> rows;
+    for(size_t i = 0; i < batch.size(); i++) {
+        if(names.insert(batch[i].name).second) { rows.push_back(i); }
+    }
+
+    MYSQL* sql;
+    SqlConnRAII sqlRAII(&sql, pool_);
+    if(!sql) { return; }
+    SqlStmtCache* stmts = pool_->GetStmtCache(sql);
+    if(!stmts) { return; }
+
+    mysql_autocommit(sql, false);
+    WriteRows_(sql, stmts, batch, rows, result);
+    mysql_autocommit(sql, true);  // 连接归还连接池前恢复自动提交
+
+    size_t inserted = 0;
+    for(bool r: result) { inserted += r; }
+    batches_++;
+    rows_ += inserted;
+    LOG_DEBUG("Register batch: %d pending, %d inserted", (int)batch.size(), (int)inserted);
+}
+
+void SqlBatchWriter::WriteRows_(MYSQL* sql, SqlStmtCache* stmts, const vector<Pending>& batch,
+                                const vector<size_t>& rows, vector<bool>& result) {
+    unsigned int err = 0;
+    for(int i = 0; i < LOCK_RETRY; i++) {
+        err = Transact_(sql, stmts, batch, rows, result);
+        if(err != ER_LOCK_DEADLOCK && err != ER_LOCK_WAIT_TIMEOUT) { break; }
+        LOG_WARN("Batch lock conflict(%u), retry %d", err, i + 1);
+    }
+    if(rows.size() <= 1) { return; }
+    if(err == ER_DUP_ENTRY) {
+        /* 唯一索引冲突(其他进程抢先注册)，逐条写入以确定每个用户的结果 */
+        for(size_t i: rows) {
+            WriteRows_(sql, stmts, batch, vector<size_t>(1, i), result);
+        }
+    } else if(err == ER_LOCK_DEADLOCK || err == ER_LOCK_WAIT_TIMEOUT) {
+        /* 重试仍然冲突，拆成两半缩小每个事务锁住的行 */
+        size_t half = rows.size() / 2;
+        WriteRows_(sql, stmts, batch, vector<size_t>(rows.begin(), rows.begin() + half), result);
+        WriteRows_(sql, stmts, batch, vector<size_t>(rows.begin() + half, rows.end()), result);
+    }
+}
+
+unsigned int SqlBatchWriter::Transact_(MYSQL* sql, SqlStmtCache* stmts, const vector<Pending>& batch,
+                                       const vector<size_t>& rows, vector<bool>& result) {
+    vector<size_t> fresh;
+    unsigned int err = LockRows_(stmts, batch, rows, fresh);
+    if(!err && !fresh.empty()) {
+        err = InsertRows_(stmts, batch, fresh);
+    }
+    if(!err && mysql_commit(sql)) {
+        LOG_WARN("Batch commit error: %s", mysql_error(sql));
+        err = mysql_errno(sql) ? mysql_errno(sql) : CR_UNKNOWN_ERROR;
+    }
+    if(err) {
+        mysql_rollback(sql);
+        return err;
+    }
+    for(size_t i: fresh) { result[i] = true; }
+    return 0;
+}
+
+unsigned int SqlBatchWriter::StmtError_(MYSQL_STMT* stmt, const char* what) {
+    unsigned int err = mysql_stmt_errno(stmt);
+    LOG_WARN("Batch %s error: %s", what, mysql_stmt_error(stmt));
+    return err ? err : CR_UNKNOWN_ERROR;
+}
+
+unsigned int SqlBatchWriter::LockRows_(SqlStmtCache* stmts, const vector<Pending>& batch,
+                                       const vector<size_t>& rows, vector<size_t>& fresh) {
+    MYSQL_STMT* stmt = stmts->GetBatch(BATCH_LOCK_USERS, rows.size());
+    if(!stmt) { return CR_UNKNOWN_ERROR; }
+
+    vector<unsigned long> lens(rows.size());
+    vector<MYSQL_BIND> params(rows.size());
+    memset(params.data(), 0, sizeof(MYSQL_BIND) * params.size());
+    for(size_t i = 0; i < rows.size(); i++) {
+        const string& name = batch[rows[i]].name;
+        lens[i] = name.size();
+        params[i].buffer_type = MYSQL_TYPE_STRING;
+        params[i].buffer = const_cast<char*>(name.data());
+        params[i].buffer_length = lens[i];
+        params[i].length = &lens[i];
+    }
+    char name[256] = { 0 };
+    unsigned long nameLen = 0;
+    MYSQL_BIND res;
+    memset(&res, 0, sizeof(res));
+    res.buffer_type = MYSQL_TYPE_STRING;
+    res.buffer = name;
+    res.buffer_length = sizeof(name);
+    res.length = &nameLen;
+
+    if(mysql_stmt_bind_param(stmt, params.data()) || mysql_stmt_execute(stmt)) {
+        return StmtError_(stmt, "select");
+    }
+    if(mysql_stmt_bind_result(stmt, &res) || mysql_stmt_store_result(stmt)) {
+        unsigned int err = StmtError_(stmt, "select");
+        mysql_stmt_free_result(stmt);
+        return err;
+    }
+    unordered_set<string> exist;
+    int ret;
+    while((ret = mysql_stmt_fetch(stmt)) == 0 || ret == MYSQL_DATA_TRUNCATED) {
+        exist.insert(string(name, nameLen < sizeof(name) ? nameLen : sizeof(name)));
+    }
+    mysql_stmt_free_result(stmt);
+    if(ret != MYSQL_NO_DATA) {
+        return StmtError_(stmt, "fetch");
+    }
+    for(size_t i: rows) {
+        if(!exist.count(batch[i].name)) { fresh.push_back(i); }
+    }
+    return 0;
+}
+
+unsigned int SqlBatchWriter::InsertRows_(SqlStmtCache* stmts, const vector<Pending>& batch,
+                                         const vector<size_t>& rows) {
+    MYSQL_STMT* stmt = stmts->GetBatch(BATCH_INSERT_USERS, rows.size());
+    if(!stmt) { return CR_UNKNOWN_ERROR; }
+
+    vector<unsigned long> lens(rows.size() * 2);
+    vector<MYSQL_BIND> params(rows.size() * 2);
+    memset(params.data(), 0, sizeof(MYSQL_BIND) * params.size());
+    for(size_t i = 0; i < params.size(); i++) {
+        const Pending& p = batch[rows[i / 2]];
+        const string& value = (i % 2 == 0) ? p.name : p.pwd;
+        lens[i] = value.size();
+        params[i].buffer_type = MYSQL_TYPE_STRING;
+        params[i].buffer = const_cast<char*>(value.data());
+        params[i].buffer_length = lens[i];
+        params[i].length = &lens[i];
+    }
+    if(mysql_stmt_bind_param(stmt, params.data()) || mysql_stmt_execute(stmt)) {
+        return StmtError_(stmt, "insert");
+    }
+    return 0;
+}
+
+void SqlBatchWriter::Close() {
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(!isOpen_ || isClose_) { return; }
+        isClose_ = true;
+    }
+    cond_.notify_all();
+    if(writer_.joinable()) {
+        writer_.join();  // 队列中已提交的注册写完再退出
+    }
+    isOpen_ = false;
+}
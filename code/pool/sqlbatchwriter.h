@@ -0,0 +1,100 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#ifndef SQL_BATCH_WRITER_H
+#define SQL_BATCH_WRITER_H
+
+#include <mysql/mysql.h>
+#include <mysql/mysqld_error.h>  // ER_DUP_ENTRY, ER_LOCK_DEADLOCK
+#include <mysql/errmsg.h>        // CR_UNKNOWN_ERROR
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include "../log/log.h"
+#include "sqlconnpool.h"
+#include "sqlconnRAII.h"
+#include "sqlstmtcache.h"
+
+/*
+ * 注册写入的延迟合并(write-behind)
+ * 注册请求不再各自执行一次INSERT，而是进入队列，由后台线程在一个短窗口内攒批，
+ * 每批在一个事务中完成：批内同名只保留第一个，SELECT ... FOR UPDATE 排除已存在的用户名，
+ * 剩余用户一条多行INSERT写入后提交，然后逐个通知等待的请求
+ * 两条语句按批内行数预处理并缓存在连接的SqlStmtCache中，参数以二进制协议绑定
+ * 所有注册都经过同一个写线程，保证本进程内用户名唯一；跨进程的唯一性依赖表上的唯一索引，
+ * 多行INSERT因唯一索引冲突失败时整批回滚，改为逐条插入；
+ * 死锁或锁等待超时时整批重试，仍失败则拆成两半分别写入
+ */
+class SqlBatchWriter {
+public:
+    typedef std::function<void(bool)> DoneCallBack;
+
+    static SqlBatchWriter* Instance();
+
+    void Init(SqlConnPool* pool, int maxBatch, int windowMS);
+    bool IsOpen() const { return isOpen_; }
+
+    /* 异步提交，所在批次提交后在写线程中回调 */
+    void AddUser(const std::string& name, const std::string& pwd, const DoneCallBack& cb);
+    /* 同步提交，阻塞到所在批次提交 */
+    bool AddUser(const std::string& name, const std::string& pwd);
+
+    void Close();
+
+    size_t Batches() const { return batches_; }
+    size_t Rows() const { return rows_; }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Pending {
+        std::string name;
+        std::string pwd;
+        DoneCallBack cb;
+        Clock::time_point enqueued;
+    };
+
+    SqlBatchWriter();
+    ~SqlBatchWriter();
+    SqlBatchWriter(const SqlBatchWriter&) = delete;
+    SqlBatchWriter& operator=(const SqlBatchWriter&) = delete;
+
+    void Loop_();
+    void Flush_(std::vector<Pending>& batch, std::vector<bool>& result);
+    void WriteRows_(MYSQL* sql, SqlStmtCache* stmts, const std::vector<Pending>& batch,
+                    const std::vector<size_t>& rows, std::vector<bool>& result);
+    /* 一个事务：锁定并排除已存在的用户名，插入其余行后提交，返回错误码 */
+    unsigned int Transact_(MYSQL* sql, SqlStmtCache* stmts, const std::vector<Pending>& batch,
+                           const std::vector<size_t>& rows, std::vector<bool>& result);
+    unsigned int LockRows_(SqlStmtCache* stmts, const std::vector<Pending>& batch,
+                           const std::vector<size_t>& rows, std::vector<size_t>& fresh);
+    unsigned int InsertRows_(SqlStmtCache* stmts, const std::vector<Pending>& batch,
+                             const std::vector<size_t>& rows);
+    static unsigned int StmtError_(MYSQL_STMT* stmt, const char* what);
+
+    static const int LOCK_RETRY = 3;
+
+    SqlConnPool* pool_;
+    bool isOpen_;
+    bool isClose_;
+    size_t maxBatch_;
+    std::chrono::milliseconds window_;
+
+    std::deque<Pending> queue_;
+    std::mutex mtx_;
+    std::condition_variable cond_;
+    std::thread writer_;
+
+    std::atomic<size_t> batches_;
+    std::atomic<size_t> rows_;
+};
+
+#endif //SQL_BATCH_WRITER_H
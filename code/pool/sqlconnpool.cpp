@@ -2,14 +2,42 @@
  * @Author       : mark
  * @Date         : 2020-06-17
  * @copyleft Apache 2.0
- */ 
+ */
 
 #include "sqlconnpool.h"
+#include <algorithm>
 using namespace std;
 
+const int SqlConnPool::RETRY_MS;
+
+thread_local SqlConnPool::LocalStash SqlConnPool::stash_;
+
+/* 线程退出时把本地缓存的连接还给共享队列 */
+SqlConnPool::LocalStash::~LocalStash() {
+    if(!pool) { return; }
+    {
+        lock_guard<mutex> locker(pool->mtx_);
+        if(pool->epoch_.load() != epoch) { return; }  // 连接已由ClosePool关闭
+        auto& stashes = pool->stashes_;
+        stashes.erase(remove(stashes.begin(), stashes.end(), this), stashes.end());
+    }
+    for(int i = 0; i < count; i++) {
+        pool->FreeShared_(items[i].sql);
+    }
+    count = 0;
+}
+
 SqlConnPool::SqlConnPool() {
+    port_ = 0;
+    MAX_CONN_ = 0;
+    minSize_ = 0;
     useCount_ = 0;
-    freeCount_ = 0;
+    totalCount_ = 0;
+    isClose_ = true;
+    stashSize_ = 0;
+    epoch_ = 0;
+    timeout_ = chrono::milliseconds(0);
+    idleCheck_ = chrono::milliseconds(0);
 }
 
 SqlConnPool* SqlConnPool::Instance() {
@@ -19,57 +47,368 @@ SqlConnPool* SqlConnPool::Instance() {
 
 void SqlConnPool::Init(const char* host, int port,
             const char* user,const char* pwd, const char* dbName,
-            int connSize = 10) {
+            int connSize, int minSize, int timeoutMS, int idleCheckMS) {
     assert(connSize > 0);
-    for (int i = 0; i < connSize; i++) {
-        MYSQL *sql = nullptr;
-        sql = mysql_init(sql);
-        if (!sql) {
-            LOG_ERROR("MySql init error!");
-            assert(sql);
-        }
-        sql = mysql_real_connect(sql, host,
-                                 user, pwd,
-                                 dbName, port, nullptr, 0);
-        if (!sql) {
-            LOG_ERROR("MySql Connect error!");
-        }
-        connQue_.push(sql);
-    }
+    host_ = host;
+    port_ = port;
+    user_ = user;
+    pwd_ = pwd;
+    dbName_ = dbName;
     MAX_CONN_ = connSize;
-    sem_init(&semId_, 0, MAX_CONN_);
+    minSize_ = (minSize < 0 || minSize > connSize) ? connSize : minSize;
+    timeout_ = chrono::milliseconds(timeoutMS > 0 ? timeoutMS : 0);
+    idleCheck_ = chrono::milliseconds(idleCheckMS > 0 ? idleCheckMS : 0);
+    retryAt_ = Clock::time_point();
+    isClose_ = false;
+    epoch_++;
+
+    /* 多线程并行建连前须先初始化客户端库 */
+    mysql_library_init(0, nullptr, nullptr);
+    Warm_(minSize_);
+    if(idleCheck_.count() > 0) {
+        maintainer_ = thread(&SqlConnPool::Maintain_, this);
+    }
 }
 
-MYSQL* SqlConnPool::GetConn() {
-    MYSQL *sql = nullptr;
-    if(connQue_.empty()){
-        LOG_WARN("SqlConnPool busy!");
+MYSQL* SqlConnPool::Connect_() {
+    MYSQL *sql = mysql_init(nullptr);
+    if (!sql) {
+        LOG_ERROR("MySql init error!");
+        return nullptr;
+    }
+    /* 断线自动重连，预处理语句由SqlStmtCache检测并重建 */
+    bool reconnect = true;
+    mysql_options(sql, MYSQL_OPT_RECONNECT, &reconnect);
+    /* 建连时间不超过借连接的等待时间，数据库不可达时尽快失败 */
+    unsigned int connectTimeout = timeout_.count() > 1000 ? timeout_.count() / 1000 : 1;
+    mysql_options(sql, MYSQL_OPT_CONNECT_TIMEOUT, &connectTimeout);
+    if (!mysql_real_connect(sql, host_.c_str(),
+                            user_.c_str(), pwd_.c_str(),
+                            dbName_.c_str(), port_, nullptr, 0)) {
+        LOG_ERROR("MySql Connect error: %s", mysql_error(sql));
+        mysql_close(sql);
         return nullptr;
     }
-    sem_wait(&semId_);
+    lock_guard<mutex> locker(mtx_);
+    stmtCache_[sql].reset(new SqlStmtCache(sql));
+    return sql;
+}
+
+void SqlConnPool::Close_(MYSQL* sql) {
     {
+        /* 语句句柄要在连接关闭前释放 */
         lock_guard<mutex> locker(mtx_);
-        sql = connQue_.front();
-        connQue_.pop();
+        stmtCache_.erase(sql);
     }
-    return sql;
+    mysql_close(sql);
+}
+
+bool SqlConnPool::Check_(MYSQL* sql) {
+    return mysql_ping(sql) == 0;
+}
+
+/* 并行建立count个连接，建好的放入空闲队列 */
+void SqlConnPool::Warm_(int count) {
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(count > MAX_CONN_ - totalCount_) { count = MAX_CONN_ - totalCount_; }
+        if(count <= 0) { return; }
+        totalCount_ += count;
+    }
+    vector<MYSQL*> conns(count, nullptr);
+    vector<thread> workers;
+    for(int i = 0; i < count; i++) {
+        workers.emplace_back([this, &conns, i] {
+            mysql_thread_init();
+            conns[i] = Connect_();
+            mysql_thread_end();
+        });
+    }
+    for(auto& worker: workers) {
+        worker.join();
+    }
+    vector<MYSQL*> closed;
+    {
+        lock_guard<mutex> locker(mtx_);
+        for(MYSQL* sql: conns) {
+            if(sql && !isClose_) {
+                connQue_.push_back({sql, Clock::now()});
+            } else if(sql) {
+                totalCount_--;
+                closed.push_back(sql);  // 建连期间连接池已关闭，不再放入队列
+            } else {
+                totalCount_--;
+                stats_.connectFails++;
+                retryAt_ = Clock::now() + chrono::milliseconds(RETRY_MS);
+            }
+        }
+    }
+    cond_.notify_all();
+    for(MYSQL* sql: closed) {
+        Close_(sql);
+    }
+}
+
+void SqlConnPool::SetLocalStash(int size, int threadNum) {
+    int maxSize = sizeof(stash_.items) / sizeof(stash_.items[0]);
+    if(threadNum > 0 && MAX_CONN_ / threadNum < maxSize) {
+        maxSize = MAX_CONN_ / threadNum;  // 每个线程都缓存满时仍不超过连接总数
+    }
+    stashSize_ = size < 0 ? 0 : (size > maxSize ? maxSize : size);
+    if(size > stashSize_) {
+        LOG_WARN("SqlConnPool local stash %d clamped to %d (conn: %d, thread: %d)",
+                 size, stashSize_, MAX_CONN_, threadNum);
+    }
+}
+
+MYSQL* SqlConnPool::GetConn(int timeoutMS) {
+    if(stashSize_ > 0) {
+        /* 快速路径：本线程缓存中有连接时直接取出，不加锁 */
+        LocalStash& stash = stash_;
+        if(stash.pool == this && stash.epoch == epoch_.load(memory_order_relaxed)) {
+            while(stash.count > 0) {
+                LocalStash::Item& item = stash.items[--stash.count];
+                if(idleCheck_.count() > 0 && Clock::now() - item.lastUsed >= idleCheck_
+                   && !Check_(item.sql)) {
+                    Discard_(item.sql);
+                    continue;
+                }
+                stash.curSql = item.sql;
+                stash.curStmts = item.stmts;
+                return item.sql;
+            }
+        }
+    }
+    Clock::time_point start = Clock::now();
+    Clock::time_point deadline = start + (timeoutMS < 0 ? timeout_ : chrono::milliseconds(timeoutMS));
+    unique_lock<mutex> locker(mtx_);
+    while(!isClose_) {
+        if(!connQue_.empty()) {
+            IdleConn conn = connQue_.back();
+            connQue_.pop_back();
+            useCount_++;
+            if(idleCheck_.count() > 0 && Clock::now() - conn.lastUsed >= idleCheck_) {
+                /* 空闲太久的连接可能已被服务端断开，借出前先检查 */
+                locker.unlock();
+                bool alive = Check_(conn.sql);
+                if(!alive) { Close_(conn.sql); }
+                locker.lock();
+                if(!alive) {
+                    useCount_--;
+                    totalCount_--;
+                    stats_.broken++;
+                    LOG_WARN("SqlConnPool drop broken conn!");
+                    continue;
+                }
+            }
+            RecordWait_(start);
+            SetCurrent_(conn.sql);
+            return conn.sql;
+        }
+        Clock::time_point now = Clock::now();
+        if(totalCount_ < MAX_CONN_ && now >= retryAt_) {
+            /* 按需扩容，建连在锁外进行 */
+            totalCount_++;
+            useCount_++;
+            locker.unlock();
+            MYSQL* sql = Connect_();
+            locker.lock();
+            if(sql) {
+                RecordWait_(start);
+                SetCurrent_(sql);
+                return sql;
+            }
+            totalCount_--;
+            useCount_--;
+            stats_.connectFails++;
+            retryAt_ = Clock::now() + chrono::milliseconds(RETRY_MS);
+            continue;
+        }
+        /* 没有任何连接会被归还(数据库不可用)时不再等待 */
+        if(totalCount_ == 0 || now >= deadline) {
+            break;
+        }
+        cond_.wait_until(locker, deadline);
+    }
+    stats_.timeouts++;
+    LOG_WARN("SqlConnPool busy!");
+    return nullptr;
+}
+
+void SqlConnPool::RecordWait_(Clock::time_point start) {
+    uint64_t us = chrono::duration_cast<chrono::microseconds>(Clock::now() - start).count();
+    stats_.acquires++;
+    stats_.waitUsTotal += us;
+    if(us > stats_.waitUsMax) { stats_.waitUsMax = us; }
+}
+
+void SqlConnPool::SetCurrent_(MYSQL* sql) {
+    auto it = stmtCache_.find(sql);
+    stash_.curSql = sql;
+    stash_.curStmts = it != stmtCache_.end() ? it->second.get() : nullptr;
+}
+
+void SqlConnPool::Discard_(MYSQL* sql) {
+    Close_(sql);
+    lock_guard<mutex> locker(mtx_);
+    useCount_--;
+    totalCount_--;
+    stats_.broken++;
 }
 
 void SqlConnPool::FreeConn(MYSQL* sql) {
     assert(sql);
+    if(stashSize_ > 0) {
+        LocalStash& stash = stash_;
+        unsigned epoch = epoch_.load(memory_order_relaxed);
+        if(stash.pool != this || stash.epoch != epoch) {
+            /* 连接池重新初始化过，旧缓存中的连接已由ClosePool关闭 */
+            stash.pool = this;
+            stash.epoch = epoch;
+            stash.count = 0;
+            lock_guard<mutex> locker(mtx_);
+            stashes_.push_back(&stash);
+        }
+        if(stash.count < stashSize_ && sql == stash.curSql && stash.curStmts) {
+            stash.items[stash.count++] = {sql, stash.curStmts, Clock::now()};
+            return;
+        }
+    }
+    if(stash_.curSql == sql) {
+        stash_.curSql = nullptr;  // 连接回到共享队列后可能被关闭
+        stash_.curStmts = nullptr;
+    }
+    FreeShared_(sql);
+}
+
+void SqlConnPool::FreeShared_(MYSQL* sql) {
+    {
+        lock_guard<mutex> locker(mtx_);
+        useCount_--;
+        if(!isClose_) {
+            connQue_.push_back({sql, Clock::now()});
+            cond_.notify_one();
+            return;
+        }
+        totalCount_--;
+    }
+    Close_(sql);  // 连接池已关闭，归还的连接直接关闭
+}
+
+/* 后台巡检：多于minSize的空闲连接关闭，其余ping检查，坏连接关闭后补足到minSize */
+void SqlConnPool::Maintain_() {
+    mysql_thread_init();
+    unique_lock<mutex> locker(mtx_);
+    while(!isClose_) {
+        maintainCond_.wait_for(locker, idleCheck_);
+        if(isClose_) { break; }
+        vector<MYSQL*> stale, surplus;
+        Clock::time_point now = Clock::now();
+        for(auto it = connQue_.begin(); it != connQue_.end();) {
+            if(now - it->lastUsed < idleCheck_) {
+                ++it;
+                continue;
+            }
+            if(totalCount_ - static_cast<int>(surplus.size()) > minSize_) {
+                surplus.push_back(it->sql);
+            } else {
+                stale.push_back(it->sql);
+            }
+            it = connQue_.erase(it);
+        }
+        totalCount_ -= surplus.size();
+        locker.unlock();
+
+        vector<MYSQL*> alive;
+        for(MYSQL* sql: surplus) {
+            Close_(sql);
+        }
+        for(MYSQL* sql: stale) {
+            if(Check_(sql)) {
+                alive.push_back(sql);
+            } else {
+                Close_(sql);
+            }
+        }
+
+        locker.lock();
+        for(MYSQL* sql: alive) {
+            connQue_.push_front({sql, Clock::now()});
+        }
+        int broken = stale.size() - alive.size();
+        totalCount_ -= broken;
+        stats_.broken += broken;
+        if(!alive.empty()) { cond_.notify_all(); }
+        int lack = minSize_ - totalCount_;
+        bool canRetry = Clock::now() >= retryAt_;
+        LOG_DEBUG("SqlConnPool total: %d, idle: %d, in use: %d, closed: %d, broken: %d",
+                  totalCount_, (int)connQue_.size(), useCount_, (int)surplus.size(), broken);
+        if(lack > 0 && canRetry && !isClose_) {
+            locker.unlock();
+            Warm_(lack);
+            locker.lock();
+        }
+    }
+    locker.unlock();
+    mysql_thread_end();
+}
+
+SqlStmtCache* SqlConnPool::GetStmtCache(MYSQL* sql) {
+    assert(sql);
+    if(stash_.curSql == sql && stash_.curStmts) {
+        return stash_.curStmts;
+    }
+    lock_guard<mutex> locker(mtx_);
+    auto it = stmtCache_.find(sql);
+    if(it == stmtCache_.end()) {
+        return nullptr;
+    }
+    return it->second.get();
+}
+
+SqlPoolStats SqlConnPool::GetStats() {
     lock_guard<mutex> locker(mtx_);
-    connQue_.push(sql);
-    sem_post(&semId_);
+    SqlPoolStats stats = stats_;
+    stats.total = totalCount_;
+    stats.idle = connQue_.size();
+    stats.inUse = useCount_;
+    return stats;
 }
 
 void SqlConnPool::ClosePool() {
-    lock_guard<mutex> locker(mtx_);
-    while(!connQue_.empty()) {
-        auto item = connQue_.front();
-        connQue_.pop();
-        mysql_close(item);
+    vector<MYSQL*> conns;
+    {
+        lock_guard<mutex> locker(mtx_);
+        if(isClose_) { return; }
+        isClose_ = true;
+        epoch_++;  // 各线程本地缓存随之作废
+        for(auto& item: connQue_) {
+            conns.push_back(item.sql);
+        }
+        totalCount_ -= connQue_.size();
+        connQue_.clear();
+        /* 缓存中的连接仍计为借出，取出后一并关闭 */
+        for(LocalStash* stash: stashes_) {
+            for(int i = 0; i < stash->count; i++) {
+                conns.push_back(stash->items[i].sql);
+            }
+            useCount_ -= stash->count;
+            totalCount_ -= stash->count;
+            stash->count = 0;
+            stash->curSql = nullptr;
+            stash->curStmts = nullptr;
+        }
+        stashes_.clear();
+    }
+    cond_.notify_all();
+    maintainCond_.notify_all();
+    if(maintainer_.joinable()) {
+        maintainer_.join();
+    }
+    for(MYSQL* sql: conns) {
+        Close_(sql);
     }
-    mysql_library_end();        
+    mysql_library_end();
 }
 
 int SqlConnPool::GetFreeConnCount() {
@@ -2,43 +2,131 @@
  * @Author       : mark
  * @Date         : 2020-06-16
  * @copyleft Apache 2.0
- */ 
+ */
 #ifndef SQLCONNPOOL_H
 #define SQLCONNPOOL_H
 
 #include <mysql/mysql.h>
 #include <string>
-#include <queue>
+#include <deque>
+#include <vector>
 #include <mutex>
-#include <semaphore.h>
+#include <condition_variable>
+#include <chrono>
 #include <thread>
+#include <memory>
+#include <atomic>
+#include <unordered_map>
 #include "../log/log.h"
+#include "sqlstmtcache.h"
 
+/* 连接池运行指标 */
+struct SqlPoolStats {
+    int total = 0;             // 已建立(含正在建立)的连接数
+    int idle = 0;              // 空闲连接数
+    int inUse = 0;             // 借出中的连接数
+    size_t acquires = 0;       // 成功借出次数
+    size_t timeouts = 0;       // 等待超时或快速失败次数
+    size_t connectFails = 0;   // 建连失败次数
+    size_t broken = 0;         // 健康检查发现并关闭的坏连接数
+    uint64_t waitUsTotal = 0;  // 借连接的累计等待时间
+    uint64_t waitUsMax = 0;    // 最长一次等待时间
+};
+
+/*
+ * MySQL连接池
+ * 连接数在[minSize, maxSize]之间伸缩：启动时并行建立minSize个连接，其余按需建立；
+ * 空闲超过idleCheckMS的连接在借出前和后台巡检时ping一次，坏连接关闭后补足到minSize；
+ * GetConn最多等待timeoutMS，数据库不可用且没有可用连接时立即失败，避免工作线程堆积
+ * 开启线程本地缓存后，每个线程归还的连接先留在自己的小缓存里，下次借用直接取出，
+ * 不经过锁和条件变量；本地缓存空/满时才访问共享队列。缓存中的连接对其他线程不可见，
+ * 缓存大小不超过 连接数/线程数，避免连接全部留在缓存里、其他线程借不到；ClosePool时一并关闭
+ */
 class SqlConnPool {
 public:
     static SqlConnPool *Instance();
 
-    MYSQL *GetConn();
+    /* timeoutMS < 0 使用Init设置的默认等待时间 */
+    MYSQL *GetConn(int timeoutMS = -1);
     void FreeConn(MYSQL * conn);
     int GetFreeConnCount();
+    SqlStmtCache* GetStmtCache(MYSQL* conn);  // 取连接上的预处理语句缓存
+    SqlPoolStats GetStats();
+    /* 线程本地缓存大小，0为关闭；threadNum为借用连接的线程数；须在没有线程借用连接时设置 */
+    void SetLocalStash(int size, int threadNum);
 
+    /* minSize < 0 表示启动时建立全部maxSize个连接(原有行为) */
     void Init(const char* host, int port,
-              const char* user,const char* pwd, 
-              const char* dbName, int connSize);
+              const char* user,const char* pwd,
+              const char* dbName, int connSize,
+              int minSize = -1, int timeoutMS = 3000, int idleCheckMS = 30000);
+    /* 须在没有线程借用连接时调用 */
     void ClosePool();
 
 private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct IdleConn {
+        MYSQL* sql;
+        Clock::time_point lastUsed;
+    };
+
+    /* 线程本地缓存，只由所属线程访问 */
+    struct LocalStash {
+        struct Item {
+            MYSQL* sql;
+            SqlStmtCache* stmts;
+            Clock::time_point lastUsed;
+        };
+        SqlConnPool* pool = nullptr;
+        unsigned epoch = 0;    // 与连接池的epoch_不一致时缓存内容作废
+        int count = 0;
+        Item items[4];
+        MYSQL* curSql = nullptr;  // 本线程最近借出的连接及其语句缓存，GetStmtCache免查表
+        SqlStmtCache* curStmts = nullptr;
+        ~LocalStash();
+    };
+
     SqlConnPool();
     ~SqlConnPool();
 
+    MYSQL* Connect_();
+    void Close_(MYSQL* sql);
+    bool Check_(MYSQL* sql);
+    void Warm_(int count);
+    void Maintain_();
+    void RecordWait_(Clock::time_point start);
+    void SetCurrent_(MYSQL* sql);
+    void FreeShared_(MYSQL* sql);
+    void Discard_(MYSQL* sql);
+
+    static thread_local LocalStash stash_;
+
+    static const int RETRY_MS = 1000;  // 建连失败后的冷却时间，期间不再尝试新建连接
+
+    std::string host_, user_, pwd_, dbName_;
+    int port_;
+
     int MAX_CONN_;
+    int minSize_;
     int useCount_;
-    int freeCount_;
+    int totalCount_;
+    bool isClose_;
+    int stashSize_;
+    std::atomic<unsigned> epoch_;  // 每次Init/ClosePool加一
+    std::chrono::milliseconds timeout_;
+    std::chrono::milliseconds idleCheck_;
+    Clock::time_point retryAt_;  // 冷却结束时间
+    SqlPoolStats stats_;
 
-    std::queue<MYSQL *> connQue_;
+    std::deque<IdleConn> connQue_;  // 队尾为最近归还
+    std::vector<LocalStash*> stashes_;  // 当前epoch下存放过连接的线程本地缓存，ClosePool时关闭其中的连接
+    std::unordered_map<MYSQL*, std::unique_ptr<SqlStmtCache>> stmtCache_;
     std::mutex mtx_;
-    sem_t semId_;
+    std::condition_variable cond_;          // 等待归还的借用者
+    std::condition_variable maintainCond_;  // 巡检线程
+    std::thread maintainer_;
 };
 
 
-#endif // SQLCONNPOOL_H
\ No newline at end of file
+#endif // SQLCONNPOOL_H
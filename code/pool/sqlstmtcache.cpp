@@ -0,0 +1,129 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+
+#include "sqlstmtcache.h"
+using namespace std;
+
+const char* SqlStmtCache::SQL_[STMT_COUNT] = {
+    "SELECT password FROM user WHERE username=? LIMIT 1",
+    "INSERT INTO user(username, password) VALUES(?, ?)",
+};
+
+SqlStmtCache::SqlStmtCache(MYSQL* sql): sql_(sql), threadId_(0) {
+    assert(sql_);
+    for(int i = 0; i < STMT_COUNT; i++) {
+        stmts_[i] = nullptr;
+    }
+    threadId_ = mysql_thread_id(sql_);
+}
+
+SqlStmtCache::~SqlStmtCache() {
+    Reset();
+}
+
+void SqlStmtCache::Reset() {
+    for(int i = 0; i < STMT_COUNT; i++) {
+        if(stmts_[i]) {
+            mysql_stmt_close(stmts_[i]);
+            stmts_[i] = nullptr;
+        }
+    }
+    for(int i = 0; i < BATCH_COUNT; i++) {
+        for(auto& item: batchStmts_[i]) {
+            mysql_stmt_close(item.second);
+        }
+        batchStmts_[i].clear();
+    }
+}
+
+MYSQL_STMT* SqlStmtCache::Prepare_(const char* query, unsigned long len) {
+    MYSQL_STMT* stmt = mysql_stmt_init(sql_);
+    if(!stmt) {
+        LOG_ERROR("MySql stmt init error!");
+        return nullptr;
+    }
+    if(mysql_stmt_prepare(stmt, query, len)) {
+        LOG_ERROR("MySql prepare error: %s", mysql_stmt_error(stmt));
+        mysql_stmt_close(stmt);
+        return nullptr;
+    }
+    return stmt;
+}
+
+void SqlStmtCache::CheckReconnect_() {
+    /* 自动重连后服务端的语句已经失效 */
+    unsigned long threadId = mysql_thread_id(sql_);
+    if(threadId != threadId_) {
+        LOG_INFO("MySql reconnected, re-prepare statements");
+        Reset();
+        threadId_ = threadId;
+    }
+}
+
+MYSQL_STMT* SqlStmtCache::Get(SqlStmtId id) {
+    assert(id >= 0 && id < STMT_COUNT);
+    CheckReconnect_();
+    if(!stmts_[id]) {
+        stmts_[id] = Prepare_(SQL_[id], strlen(SQL_[id]));
+    }
+    return stmts_[id];
+}
+
+string SqlStmtCache::BatchSql_(SqlBatchStmtId id, size_t rows) {
+    string query;
+    if(id == BATCH_LOCK_USERS) {
+        query = "SELECT username FROM user WHERE username IN (";
+        for(size_t i = 0; i < rows; i++) {
+            query += i > 0 ? ",?" : "?";
+        }
+        query += ") FOR UPDATE";
+    } else {
+        query = "INSERT INTO user(username, password) VALUES";
+        for(size_t i = 0; i < rows; i++) {
+            query += i > 0 ? ",(?,?)" : "(?,?)";
+        }
+    }
+    return query;
+}
+
+MYSQL_STMT* SqlStmtCache::GetBatch(SqlBatchStmtId id, size_t rows) {
+    assert(id >= 0 && id < BATCH_COUNT && rows > 0);
+    CheckReconnect_();
+    auto it = batchStmts_[id].find(rows);
+    if(it != batchStmts_[id].end()) {
+        return it->second;
+    }
+    string query = BatchSql_(id, rows);
+    MYSQL_STMT* stmt = Prepare_(query.data(), query.size());
+    if(stmt) {
+        batchStmts_[id][rows] = stmt;
+    }
+    return stmt;
+}
+
+MYSQL_STMT* SqlStmtCache::Execute(SqlStmtId id, MYSQL_BIND* params) {
+    for(int retry = 0; retry < 2; retry++) {
+        MYSQL_STMT* stmt = Get(id);
+        if(!stmt) {
+            /* prepare失败多半是连接已断开，ping触发重连 */
+            if(retry == 0 && mysql_ping(sql_) == 0) { continue; }
+            return nullptr;
+        }
+        if(mysql_stmt_bind_param(stmt, params) == 0 && mysql_stmt_execute(stmt) == 0) {
+            return stmt;
+        }
+        unsigned int err = mysql_stmt_errno(stmt);
+        LOG_WARN("MySql stmt execute error: %s", mysql_stmt_error(stmt));
+        if(err != CR_SERVER_GONE_ERROR && err != CR_SERVER_LOST) {
+            return nullptr;
+        }
+        Reset();
+        if(mysql_ping(sql_) != 0) {
+            return nullptr;
+        }
+    }
+    return nullptr;
+}
@@ -0,0 +1,68 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#ifndef SQLSTMTCACHE_H
+#define SQLSTMTCACHE_H
+
+#include <mysql/mysql.h>
+#include <mysql/errmsg.h>  // CR_SERVER_LOST
+#include <map>
+#include <string>
+#include "../log/log.h"
+
+/* 服务器用到的固定语句 */
+enum SqlStmtId {
+    STMT_QUERY_USER = 0,  // 按用户名查询密码
+    STMT_INSERT_USER,     // 注册新用户
+    STMT_COUNT,
+};
+
+/* 批量注册用到的多行语句，占位符个数随行数变化 */
+enum SqlBatchStmtId {
+    BATCH_LOCK_USERS = 0,  // SELECT ... IN (?,...) FOR UPDATE
+    BATCH_INSERT_USERS,    // INSERT ... VALUES(?,?),...
+    BATCH_COUNT,
+};
+
+/*
+ * 单个MYSQL连接上的预处理语句缓存
+ * 语句在第一次使用时prepare，之后复用二进制协议执行；
+ * 连接断开重连后(thread id变化)语句句柄失效，自动重新prepare
+ * 调用者须已通过连接池独占该连接，本类不加锁
+ */
+class SqlStmtCache {
+public:
+    explicit SqlStmtCache(MYSQL* sql);
+    ~SqlStmtCache();
+
+    MYSQL_STMT* Get(SqlStmtId id);
+
+    /* 绑定参数并执行，遇到断线时重连、重新prepare并重试一次 */
+    MYSQL_STMT* Execute(SqlStmtId id, MYSQL_BIND* params);
+
+    /* 多行语句，每种行数prepare一次后缓存 */
+    MYSQL_STMT* GetBatch(SqlBatchStmtId id, size_t rows);
+
+    void Reset();
+
+    static const char* Sql(SqlStmtId id) { return SQL_[id]; }
+
+private:
+    SqlStmtCache(const SqlStmtCache&) = delete;
+    SqlStmtCache& operator=(const SqlStmtCache&) = delete;
+
+    MYSQL_STMT* Prepare_(const char* query, unsigned long len);
+    void CheckReconnect_();
+    static std::string BatchSql_(SqlBatchStmtId id, size_t rows);
+
+    MYSQL* sql_;
+    unsigned long threadId_;
+    MYSQL_STMT* stmts_[STMT_COUNT];
+    std::map<size_t, MYSQL_STMT*> batchStmts_[BATCH_COUNT];
+
+    static const char* SQL_[STMT_COUNT];
+};
+
+#endif // SQLSTMTCACHE_H
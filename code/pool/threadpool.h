@@ -12,12 +12,17 @@
 #include <queue>
 #include <thread>
 #include <functional>
+#include <vector>
+#include <assert.h>
+#include <pthread.h>
+#include <sched.h>
 class ThreadPool {
 public:
-    explicit ThreadPool(size_t threadCount = 8): pool_(std::make_shared<Pool>()) {
+    /* cpus非空时第i个线程绑定到cpus[i % cpus.size()]，绑定失败的线程数由PinFailures返回 */
+    explicit ThreadPool(size_t threadCount = 8, const std::vector<int>& cpus = {}): pool_(std::make_shared<Pool>()) {
             assert(threadCount > 0);
             for(size_t i = 0; i < threadCount; i++) {
-                std::thread([pool = pool_] {
+                threads_.emplace_back([pool = pool_] {
                     std::unique_lock<std::mutex> locker(pool->mtx);
                     while(true) {
                         if(!pool->tasks.empty()) {
@@ -30,15 +35,34 @@ public:
                         else if(pool->isClosed) break;
                         else pool->cond.wait(locker);
                     }
-                }).detach();
+                });
+                if(!cpus.empty()) {
+                    /* 在构造中同步绑定，返回时已知道结果 */
+                    cpu_set_t set;
+                    CPU_ZERO(&set);
+                    CPU_SET(cpus[i % cpus.size()], &set);
+                    if(pthread_setaffinity_np(threads_.back().native_handle(), sizeof(set), &set) != 0) {
+                        pinFailures_++;
+                    }
+                }
             }
     }
 
     ThreadPool() = default;
 
     ThreadPool(ThreadPool&&) = default;
+
+    size_t PinFailures() const {
+        return pinFailures_;
+    }
     
     ~ThreadPool() {
+        Shutdown();
+    }
+
+    /* 执行完已排队的任务、线程全部退出后才返回，任务中不会再访问已析构的对象
+       之后提交的任务只入队不执行，随线程池析构释放 */
+    void Shutdown() {
         if(static_cast<bool>(pool_)) {
             {
                 std::lock_guard<std::mutex> locker(pool_->mtx);
@@ -46,6 +70,10 @@ public:
             }
             pool_->cond.notify_all();
         }
+        for(auto& thread: threads_) {
+            if(thread.get_id() == std::this_thread::get_id()) { thread.detach(); }  // 在任务中析构线程池
+            else if(thread.joinable()) { thread.join(); }
+        }
     }
 
     template<class F>
@@ -75,6 +103,8 @@ private:
         std::queue<std::function<void()>> tasks;
     };
     std::shared_ptr<Pool> pool_;
+    std::vector<std::thread> threads_;
+    size_t pinFailures_ = 0;
 };
 
 
@@ -0,0 +1,60 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#include "admission.h"
+#include <chrono>
+#include <assert.h>
+#include "../log/log.h"
+using namespace std;
+
+AdmissionControl::AdmissionControl(int targetMs, int intervalMs):
+        targetUs_(static_cast<int64_t>(targetMs) * 1000), intervalUs_(static_cast<int64_t>(intervalMs) * 1000),
+        pending_(0), firstAboveUs_(0), overloaded_(false),
+        shedConns_(0), shedNew_(0), shedKeepAlive_(0), overloads_(0) {
+    assert(targetMs > 0 && intervalMs >= targetMs);
+}
+
+int64_t AdmissionControl::NowUs() {
+    return chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool AdmissionControl::OnDequeue(int64_t enqueuedUs, bool isNew, bool sheddable) {
+    int64_t now = NowUs();
+    int64_t sojourn = now - enqueuedUs;
+    bool drained = pending_.fetch_sub(1, memory_order_relaxed) <= 1;
+    if(sojourn < targetUs_ || drained) {
+        /* 队列能降到目标以下，不是站立队列 */
+        firstAboveUs_.store(0, memory_order_relaxed);
+        if(overloaded_.load(memory_order_relaxed) && overloaded_.exchange(false)) {
+            LOG_INFO("Admission: overload end, sojourn %lldus", (long long)sojourn);
+        }
+    } else {
+        int64_t first = firstAboveUs_.load(memory_order_relaxed);
+        if(first == 0) {
+            firstAboveUs_.compare_exchange_strong(first, now + intervalUs_, memory_order_relaxed);
+        } else if(now >= first && !overloaded_.load(memory_order_relaxed) && !overloaded_.exchange(true)) {
+            overloads_++;
+            LOG_WARN("Admission: overload, sojourn %lldus, pending %lld", (long long)sojourn,
+                     (long long)pending_.load(memory_order_relaxed));
+        }
+    }
+    if(!sheddable || !overloaded_.load(memory_order_relaxed)) { return false; }
+    if(sojourn <= (isNew ? targetUs_ : intervalUs_)) { return false; }
+    if(isNew) { shedNew_++; }
+    else { shedKeepAlive_++; }
+    return true;
+}
+
+bool AdmissionControl::Overloaded() const {
+    /* 队列已空时过载状态已过期(没有任务出队来清除它) */
+    return overloaded_.load(memory_order_relaxed) && pending_.load(memory_order_relaxed) > 0;
+}
+
+bool AdmissionControl::AdmitConnection() {
+    if(!Overloaded()) { return true; }
+    shedConns_++;
+    return false;
+}
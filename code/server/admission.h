@@ -0,0 +1,55 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * 按线程池任务排队时间做准入控制(CoDel)
+ * 工作线程取出任务时报告排队时间：排队时间持续一个interval都高于target，说明存在站立队列，进入过载状态；
+ * 出现一次低于target的排队时间或队列排空即退出
+ * 过载时：新连接在accept时直接回503；新连接的首个请求排队超过target、已有长连接的请求排队超过interval才丢弃，
+ * 优先保证已建立连接上的请求；发送中的响应不丢弃
+ * 排队时间只用原子变量记录，多个工作线程并发更新时允许少量误差
+ */
+class AdmissionControl {
+public:
+    AdmissionControl(int targetMs, int intervalMs);
+
+    /* 事件循环在提交任务前调用 */
+    void OnEnqueue() { pending_.fetch_add(1, std::memory_order_relaxed); }
+    /* 工作线程取出任务时调用，返回是否丢弃该任务；isNew为连接上还没有处理过请求，sheddable为false时只做统计 */
+    bool OnDequeue(int64_t enqueuedUs, bool isNew, bool sheddable = true);
+    /* accept时调用：过载返回false并计数 */
+    bool AdmitConnection();
+
+    bool Overloaded() const;
+
+    size_t ShedConnections() const { return shedConns_; }
+    size_t ShedNew() const { return shedNew_; }
+    size_t ShedKeepAlive() const { return shedKeepAlive_; }
+    size_t Overloads() const { return overloads_; }
+
+    static int64_t NowUs();
+
+private:
+    const int64_t targetUs_;
+    const int64_t intervalUs_;
+
+    std::atomic<int64_t> pending_;       // 已提交未取出的任务数
+    std::atomic<int64_t> firstAboveUs_;  // 排队时间连续高于target时，到该时刻进入过载；0表示未高于
+    std::atomic<bool> overloaded_;
+
+    std::atomic<size_t> shedConns_;      // accept时拒绝的连接
+    std::atomic<size_t> shedNew_;        // 丢弃的新连接首个请求
+    std::atomic<size_t> shedKeepAlive_;  // 丢弃的长连接请求
+    std::atomic<size_t> overloads_;      // 进入过载状态的次数
+};
+
+#endif //ADMISSION_H
@@ -0,0 +1,38 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#include "busypoll.h"
+#include <chrono>
+#include <algorithm>
+#include <assert.h>
+using namespace std;
+
+const int64_t BusyPoll::START_US;
+
+BusyPoll::BusyPoll(int maxSpinUs): maxUs_(maxSpinUs), budgetUs_(min<int64_t>(START_US, maxSpinUs)),
+        spinUs_(0), hits_(0), blocks_(0) {
+    assert(maxSpinUs > 0);
+}
+
+int64_t BusyPoll::NowUs() {
+    return chrono::duration_cast<chrono::microseconds>(
+                chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void BusyPoll::OnHit(int64_t spinUs) {
+    spinUs_ += spinUs;
+    hits_++;
+}
+
+void BusyPoll::OnBlock(int64_t spinUs, int64_t blockUs, bool got) {
+    spinUs_ += spinUs;
+    blocks_++;
+    if(got && spinUs + blockUs <= maxUs_) {
+        budgetUs_ = budgetUs_ == 0 ? min(START_US, maxUs_) : min(budgetUs_ * 2, maxUs_);
+    } else {
+        budgetUs_ /= 2;
+        if(budgetUs_ < START_US) { budgetUs_ = 0; }
+    }
+}
@@ -0,0 +1,47 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#ifndef BUSY_POLL_H
+#define BUSY_POLL_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+ * 事件循环自适应忙轮询的自旋预算，做法与KVM的halt-polling相同：
+ *   自旋期间等到事件：预算不变
+ *   自旋到期后阻塞，事件在上限时间内就到达了(再多转一会就能等到)：预算加倍
+ *   阻塞超过上限才有事件或超时：事件稀疏，自旋纯属浪费，预算减半，低于起始值归零
+ * 只在事件循环线程中使用，不加锁
+ */
+class BusyPoll {
+public:
+    explicit BusyPoll(int maxSpinUs);
+
+    /* 本轮可以自旋的时长(微秒)，0表示直接阻塞 */
+    int64_t Budget() const { return budgetUs_; }
+
+    /* 自旋了spinUs后等到事件 */
+    void OnHit(int64_t spinUs);
+    /* 自旋了spinUs没有等到，阻塞blockUs后返回；got为阻塞期间是否有事件 */
+    void OnBlock(int64_t spinUs, int64_t blockUs, bool got);
+
+    int64_t SpinUs() const { return spinUs_; }  // 自旋消耗的总时间，即多用的CPU时间
+    size_t Hits() const { return hits_; }
+    size_t Blocks() const { return blocks_; }
+
+    static int64_t NowUs();
+
+private:
+    static const int64_t START_US = 10;
+
+    const int64_t maxUs_;
+    int64_t budgetUs_;
+    int64_t spinUs_;
+    size_t hits_;
+    size_t blocks_;
+};
+
+#endif //BUSY_POLL_H
@@ -0,0 +1,60 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#include "completionqueue.h"
+#include <sys/eventfd.h>
+#include <unistd.h>
+#include <assert.h>
+#include <stdexcept>
+using namespace std;
+
+CompletionQueue::CompletionQueue(): head_(nullptr), notified_(false), wakeups_(0) {
+    eventFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(eventFd_ < 0) { throw runtime_error("eventfd error"); }
+}
+
+CompletionQueue::~CompletionQueue() {
+    close(eventFd_);
+}
+
+void CompletionQueue::Push(Completion* item) {
+    assert(item);
+    Completion* head = head_.load(memory_order_relaxed);
+    do {
+        item->next = head;
+    } while(!head_.compare_exchange_weak(head, item, memory_order_release, memory_order_relaxed));
+    if(!notified_.exchange(true, memory_order_acq_rel)) {
+        uint64_t one = 1;
+        ssize_t n = write(eventFd_, &one, sizeof(one));
+        (void)n;  // 计数器溢出之前事件循环早已读过
+        wakeups_.fetch_add(1, memory_order_relaxed);
+    }
+}
+
+size_t CompletionQueue::Drain(const function<void(Completion*)>& fn) {
+    uint64_t cnt;
+    ssize_t n = read(eventFd_, &cnt, sizeof(cnt));
+    (void)n;
+    /* 先清除唤醒标志再取队列，之后的提交会重新唤醒，不会丢失 */
+    notified_.store(false, memory_order_release);
+    Completion* list = head_.exchange(nullptr, memory_order_acq_rel);
+    /* 栈是后进先出，反转回提交顺序 */
+    Completion* ordered = nullptr;
+    while(list) {
+        Completion* next = list->next;
+        list->next = ordered;
+        ordered = list;
+        list = next;
+    }
+    size_t count = 0;
+    while(ordered) {
+        Completion* next = ordered->next;  // fn中连接可能被关闭、结点被复用
+        ordered->next = nullptr;
+        fn(ordered);
+        ordered = next;
+        count++;
+    }
+    return count;
+}
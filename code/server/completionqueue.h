@@ -0,0 +1,51 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#ifndef COMPLETION_QUEUE_H
+#define COMPLETION_QUEUE_H
+
+#include <atomic>
+#include <functional>
+#include <stdint.h>
+#include <stddef.h>
+
+/* 工作线程处理完一个连接后提交的结果，结点嵌在连接表中，每个连接同一时刻最多一个 */
+struct Completion {
+    Completion* next = nullptr;
+    int fd = -1;
+    uint32_t events = 0;  // 需要重新注册的事件(EPOLLIN/EPOLLOUT)，0表示关闭连接
+};
+
+/*
+ * 工作线程 -> 事件循环 的完成队列
+ * 多生产者单消费者：生产者CAS压入无锁栈，事件循环一次取走整条链再反转为提交顺序
+ * 唤醒用eventfd并且合并：只有队列从"已唤醒"状态被清空之后的第一次提交才写eventfd，
+ * 一批完成事件只唤醒一次事件循环；epoll_ctl、定时器与关闭都由事件循环统一执行
+ */
+class CompletionQueue {
+public:
+    CompletionQueue();
+    ~CompletionQueue();
+
+    int Fd() const { return eventFd_; }
+
+    /* 任意线程调用 */
+    void Push(Completion* item);
+    /* 事件循环在eventfd可读时调用，按提交顺序处理全部完成事件，返回处理数量 */
+    size_t Drain(const std::function<void(Completion*)>& fn);
+
+    size_t Wakeups() const { return wakeups_; }
+
+private:
+    CompletionQueue(const CompletionQueue&) = delete;
+    CompletionQueue& operator=(const CompletionQueue&) = delete;
+
+    int eventFd_;
+    std::atomic<Completion*> head_;
+    std::atomic<bool> notified_;  // 已写eventfd、事件循环尚未取走
+    std::atomic<size_t> wakeups_;
+};
+
+#endif //COMPLETION_QUEUE_H
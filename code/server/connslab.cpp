@@ -0,0 +1,107 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#include "connslab.h"
+#include <sys/mman.h>
+#include <new>
+using namespace std;
+
+/* 匿名映射只占虚拟地址，页面首次写入时才分配且已清零 */
+static void* MapZeroed(size_t len) {
+    void* addr = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if(addr == MAP_FAILED) { throw bad_alloc(); }
+    return addr;
+}
+
+ConnSlab::ConnSlab(int maxFd): capacity_(maxFd) {
+    assert(maxFd > 0);
+    hot_ = static_cast<Hot*>(MapZeroed(sizeof(Hot) * capacity_));
+    for(int i = 0; i < capacity_; i++) {
+        new (&hot_[i]) Hot();
+        hot_[i].word.store(Make_(0, CONN_CLOSED), memory_order_relaxed);
+    }
+    cold_ = static_cast<Cold*>(MapZeroed(sizeof(Cold) * capacity_));
+}
+
+ConnSlab::~ConnSlab() {
+    for(int i = 0; i < capacity_; i++) {
+        if(hot_[i].constructed) { cold_[i].~Cold(); }
+        hot_[i].~Hot();
+    }
+    munmap(cold_, sizeof(Cold) * capacity_);
+    munmap(hot_, sizeof(Hot) * capacity_);
+}
+
+HttpConn* ConnSlab::Open(int fd) {
+    if(fd < 0 || fd >= capacity_) { return nullptr; }
+    Hot& hot = hot_[fd];
+    uint64_t word = hot.word.load(memory_order_acquire);
+    assert(State_(word) == CONN_CLOSED);  // 关闭与归还都在事件循环线程中完成
+    if(!hot.constructed) {
+        new (&cold_[fd]) Cold();
+        hot.constructed = true;
+    }
+    hot.word.store(Make_(Gen_(word), CONN_IDLE), memory_order_release);
+    return &cold_[fd].conn;
+}
+
+void ConnSlab::Release(int fd) {
+    if(fd < 0 || fd >= capacity_) { return; }
+    uint64_t word = hot_[fd].word.load(memory_order_acquire);
+    hot_[fd].word.store(Make_(Gen_(word) + 1, CONN_CLOSED), memory_order_release);
+}
+
+bool ConnSlab::Begin(int fd, ConnState state) {
+    assert(fd >= 0 && fd < capacity_);
+    uint64_t word = hot_[fd].word.load(memory_order_acquire);
+    do {
+        /* 已有关闭请求时不再开始新的工作 */
+        if(State_(word) != CONN_IDLE || (word & CLOSE_PENDING)) { return false; }
+    } while(!hot_[fd].word.compare_exchange_weak(word, Make_(Gen_(word), state), memory_order_acq_rel));
+    return true;
+}
+
+void ConnSlab::Switch(int fd, ConnState state) {
+    assert(fd >= 0 && fd < capacity_);
+    /* 只保留关闭请求标志，其他线程只会置该标志 */
+    uint64_t word = hot_[fd].word.load(memory_order_acquire);
+    while(!hot_[fd].word.compare_exchange_weak(word, Make_(Gen_(word), state) | (word & CLOSE_PENDING),
+                                               memory_order_acq_rel)) {}
+}
+
+Completion* ConnSlab::Post(int fd, uint32_t events) {
+    assert(fd >= 0 && fd < capacity_ && hot_[fd].constructed);
+    Completion* done = &cold_[fd].done;
+    done->fd = fd;
+    done->events = events;
+    Switch(fd, CONN_POSTED);
+    return done;
+}
+
+bool ConnSlab::Finish(int fd, uint32_t events) {
+    assert(fd >= 0 && fd < capacity_);
+    uint64_t word = hot_[fd].word.load(memory_order_acquire);
+    uint64_t next;
+    do {
+        assert(State_(word) == CONN_POSTED);
+        bool closing = events == 0 || (word & CLOSE_PENDING);
+        next = Make_(Gen_(word), closing ? CONN_CLOSING : CONN_IDLE);
+    } while(!hot_[fd].word.compare_exchange_weak(word, next, memory_order_acq_rel));
+    return State_(next) == CONN_IDLE;
+}
+
+bool ConnSlab::RequestClose(int fd, uint32_t gen) {
+    assert(fd >= 0 && fd < capacity_);
+    uint64_t word = hot_[fd].word.load(memory_order_acquire);
+    uint64_t next;
+    do {
+        ConnState cur = State_(word);
+        if(Gen_(word) != gen || cur == CONN_CLOSED || cur == CONN_CLOSING || (word & CLOSE_PENDING)) {
+            return false;
+        }
+        next = cur == CONN_IDLE ? Make_(gen, CONN_CLOSING) : word | CLOSE_PENDING;
+    } while(!hot_[fd].word.compare_exchange_weak(word, next, memory_order_acq_rel));
+    return State_(next) == CONN_CLOSING;
+}
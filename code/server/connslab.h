@@ -0,0 +1,109 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#ifndef CONN_SLAB_H
+#define CONN_SLAB_H
+
+#include <atomic>
+#include <stdint.h>
+#include <assert.h>
+#include "../http/httpconn.h"
+#include "completionqueue.h"
+
+/* 连接状态，只有持有者可以读写连接对象：READING/PROCESSING/WRITING为工作线程，其余为事件循环 */
+enum ConnState : uint32_t {
+    CONN_CLOSED = 0,   // 未使用
+    CONN_IDLE,         // 已在epoll中注册事件，等待事件
+    CONN_READING,      // 工作线程读数据
+    CONN_PROCESSING,   // 解析请求、生成响应(含等待异步认证)
+    CONN_WRITING,      // 工作线程发送响应
+    CONN_POSTED,       // 工作线程已提交完成事件，等待事件循环重新注册或关闭
+    CONN_CLOSING,      // 持有者正在关闭
+};
+
+/*
+ * 以fd为下标的连接表，替代unordered_map<int, HttpConn>
+ * 冷数据(HttpConn，含读写缓冲区、请求与响应)放在一次性mmap的大数组中，每个连接按缓存行对齐，
+ * 只预留虚拟地址，首次使用某个fd时才构造，内存按页按需分配；地址在服务器生命周期内不变
+ * 热数据单独放在紧凑数组中，每个fd一个64位原子字：高32位代数，低位状态与关闭请求标志，查找只是一次下标运算
+ * 每次关闭连接代数加一：定时器回调、线程池任务记下打开时的代数，执行前比较即可发现fd已被复用
+ *
+ * 状态转换全部是对该原子字的CAS，不加锁：
+ *   事件循环：IDLE -> READING/WRITING，取得持有权后交给工作线程
+ *   工作线程：READING -> PROCESSING -> WRITING -> POSTED，经完成队列交还事件循环
+ *   事件循环：POSTED -> IDLE(重新注册事件)或CLOSING(关闭)
+ *   超时、对端挂断要求关闭：连接空闲时立即关闭；在工作线程中时只置关闭请求标志，交还时再关闭，
+ *   关闭不会与处理中的读写并发；epoll_ctl与关闭只在事件循环线程中执行
+ */
+class ConnSlab {
+public:
+    explicit ConnSlab(int maxFd);
+    ~ConnSlab();
+
+    int Capacity() const { return capacity_; }
+
+    /* 为新连接取出fd对应的对象，状态置为IDLE；fd超出容量返回nullptr */
+    HttpConn* Open(int fd);
+    /* 持有者关闭fd之后调用，代数加一、状态置为CLOSED，之前记下的代数全部失效 */
+    void Release(int fd);
+
+    /* 事件循环收到读写事件：连接空闲时取得持有权，进入state */
+    bool Begin(int fd, ConnState state);
+    /* 持有者切换处理阶段 */
+    void Switch(int fd, ConnState state);
+    /* 工作线程交还连接：events为需要重新注册的事件，0表示关闭；返回待压入完成队列的结点 */
+    Completion* Post(int fd, uint32_t events);
+    /* 事件循环处理完成事件：回到IDLE返回true；需要关闭(主动关闭或有关闭请求)时置为CLOSING返回false */
+    bool Finish(int fd, uint32_t events);
+    /* 事件循环要求关闭：连接空闲时返回true，由调用者立即关闭；否则只留下关闭请求，返回false */
+    bool RequestClose(int fd, uint32_t gen);
+
+    /* fd上正在使用的连接，没有返回nullptr */
+    HttpConn* Get(int fd) {
+        if(fd < 0 || fd >= capacity_ || State_(Load_(fd)) == CONN_CLOSED) { return nullptr; }
+        return &cold_[fd].conn;
+    }
+    /* 代数一致时才返回连接，用于延迟执行的回调 */
+    HttpConn* Get(int fd, uint32_t gen) {
+        HttpConn* conn = Get(fd);
+        return conn && Gen(fd) == gen ? conn : nullptr;
+    }
+    uint32_t Gen(int fd) const {
+        assert(fd >= 0 && fd < capacity_);
+        return Gen_(Load_(fd));
+    }
+    ConnState State(int fd) const {
+        assert(fd >= 0 && fd < capacity_);
+        return State_(Load_(fd));
+    }
+
+private:
+    static const uint64_t STATE_MASK = 0xff;
+    static const uint64_t CLOSE_PENDING = 0x100;  // 有非持有者要求关闭
+
+    struct Hot {
+        std::atomic<uint64_t> word;  // 代数<<32 | 关闭请求 | 状态
+        bool constructed;  // 冷数据是否已构造，只由事件循环线程访问
+    };
+
+    struct alignas(64) Cold {
+        HttpConn conn;
+        Completion done;  // 完成队列结点
+    };
+
+    ConnSlab(const ConnSlab&) = delete;
+    ConnSlab& operator=(const ConnSlab&) = delete;
+
+    static uint32_t Gen_(uint64_t word) { return static_cast<uint32_t>(word >> 32); }
+    static ConnState State_(uint64_t word) { return static_cast<ConnState>(word & STATE_MASK); }
+    static uint64_t Make_(uint32_t gen, ConnState state) { return (static_cast<uint64_t>(gen) << 32) | state; }
+    uint64_t Load_(int fd) const { return hot_[fd].word.load(std::memory_order_acquire); }
+
+    int capacity_;
+    Hot* hot_;
+    Cold* cold_;
+};
+
+#endif //CONN_SLAB_H
@@ -0,0 +1,107 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#include "cpuaffinity.h"
+#include <sched.h>
+#include <stdlib.h>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+using namespace std;
+
+vector<int> CpuAffinity::Parse(const string& list) {
+    vector<int> cpus;
+    stringstream ss(list);
+    string item;
+    while(getline(ss, item, ',')) {
+        if(item.find_first_not_of(" \t\n") == string::npos) { continue; }
+        char* end = nullptr;
+        long first = strtol(item.c_str(), &end, 10);
+        long last = first;
+        if(*end == '-') { last = strtol(end + 1, &end, 10); }
+        while(*end == ' ' || *end == '\t' || *end == '\n') { end++; }
+        if(*end != '\0' || first < 0 || last < first || last >= CPU_SETSIZE) { return {}; }
+        for(long cpu = first; cpu <= last; cpu++) { cpus.push_back(static_cast<int>(cpu)); }
+    }
+    sort(cpus.begin(), cpus.end());
+    cpus.erase(unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+bool CpuAffinity::ReadLine_(const string& path, string* line) {
+    ifstream in(path);
+    return in && getline(in, *line);
+}
+
+vector<int> CpuAffinity::NodeCpus(int node) {
+    string line;
+    if(node < 0 || !ReadLine_("/sys/devices/system/node/node" + to_string(node) + "/cpulist", &line)) {
+        return {};
+    }
+    return Parse(line);
+}
+
+vector<int> CpuAffinity::NicIrqCpus(const string& nic) {
+    vector<int> cpus;
+    if(nic.empty()) { return cpus; }
+    ifstream in("/proc/interrupts");
+    string line;
+    while(getline(in, line)) {
+        /* 形如" 45:  123  0  IR-PCI-MSI 524289-edge  eth0-TxRx-0"，取行首的中断号 */
+        if(!IsNicIrq(line, nic)) { continue; }
+        int irq = atoi(line.c_str());
+        string list;
+        if(irq > 0 && ReadLine_("/proc/irq/" + to_string(irq) + "/smp_affinity_list", &list)) {
+            vector<int> irqCpus = Parse(list);
+            cpus.insert(cpus.end(), irqCpus.begin(), irqCpus.end());
+        }
+    }
+    sort(cpus.begin(), cpus.end());
+    cpus.erase(unique(cpus.begin(), cpus.end()), cpus.end());
+    return cpus;
+}
+
+bool CpuAffinity::IsNicIrq(const string& line, const string& nic) {
+    if(nic.empty()) { return false; }
+    stringstream ss(line);
+    string token;
+    while(ss >> token) {
+        if(token.compare(0, nic.size(), nic) != 0) { continue; }
+        if(token.size() == nic.size() || token[nic.size()] == '-' || token[nic.size()] == ':') { return true; }
+    }
+    return false;
+}
+
+int CpuAffinity::NodeOf(int cpu) {
+    for(int node = 0; ; node++) {
+        string line;
+        if(!ReadLine_("/sys/devices/system/node/node" + to_string(node) + "/cpulist", &line)) {
+            return -1;
+        }
+        vector<int> cpus = Parse(line);
+        if(binary_search(cpus.begin(), cpus.end(), cpu)) { return node; }
+    }
+}
+
+bool CpuAffinity::Pin(pthread_t thread, const vector<int>& cpus) {
+    if(cpus.empty()) { return false; }
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu: cpus) { CPU_SET(cpu, &set); }
+    return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+}
+
+string CpuAffinity::ToString(const vector<int>& cpus) {
+    string str;
+    for(size_t i = 0; i < cpus.size(); i++) {
+        size_t j = i;
+        while(j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1) { j++; }
+        if(!str.empty()) { str += ","; }
+        str += to_string(cpus[i]);
+        if(j > i) { str += "-" + to_string(cpus[j]); }
+        i = j;
+    }
+    return str.empty() ? "none" : str;
+}
@@ -0,0 +1,41 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#ifndef CPU_AFFINITY_H
+#define CPU_AFFINITY_H
+
+#include <vector>
+#include <string>
+#include <pthread.h>
+
+/*
+ * 线程绑核与NUMA就近放置，只读取/sys与/proc，不依赖libnuma
+ * 内核默认的内存策略是首次访问的线程所在节点分配：连接表的冷数据页在事件循环线程中首次构造，
+ * 读写缓冲区的扩容在工作线程中进行，事件循环与工作线程绑定在同一节点的核上，连接对象与缓冲区就落在本地内存
+ */
+class CpuAffinity {
+public:
+    /* 解析"0-3,8,10-11"形式的列表，空串或解析失败返回空 */
+    static std::vector<int> Parse(const std::string& list);
+    /* NUMA节点上的CPU，节点不存在返回空 */
+    static std::vector<int> NodeCpus(int node);
+    /* 网卡各队列中断(/proc/interrupts中属于nic的行)当前绑定的CPU */
+    static std::vector<int> NicIrqCpus(const std::string& nic);
+    /* /proc/interrupts的一行是否属于网卡nic：中断名为nic或以"nic-"、"nic:"开头，eth1不匹配eth10 */
+    static bool IsNicIrq(const std::string& line, const std::string& nic);
+    /* CPU所在的NUMA节点，未知返回-1 */
+    static int NodeOf(int cpu);
+
+    /* 把线程绑定到cpus中的全部CPU */
+    static bool Pin(pthread_t thread, const std::vector<int>& cpus);
+    static bool PinSelf(const std::vector<int>& cpus) { return Pin(pthread_self(), cpus); }
+
+    static std::string ToString(const std::vector<int>& cpus);
+
+private:
+    static bool ReadLine_(const std::string& path, std::string* line);
+};
+
+#endif //CPU_AFFINITY_H
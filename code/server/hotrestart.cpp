@@ -0,0 +1,200 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#include "hotrestart.h"
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "../log/log.h"
+using namespace std;
+
+const uint32_t HotRestart::MAGIC;
+const uint32_t HotRestart::MAX_SNAPSHOT;
+const int HotRestart::IO_TIMEOUT_MS;
+
+HotRestart::HotRestart(const string& path): path_(path), fd_(-1), peer_(-1) {}
+
+HotRestart::~HotRestart() {
+    ClosePeer_();
+    if(fd_ >= 0) {
+        close(fd_);
+        unlink(path_.c_str());
+    }
+}
+
+void HotRestart::SetTimeout_(int fd) {
+    struct timeval tv = { IO_TIMEOUT_MS / 1000, (IO_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+}
+
+/* 只与同一用户的进程交接 */
+bool HotRestart::CheckPeer_(int fd) {
+    struct ucred cred = { 0 };
+    socklen_t len = sizeof(cred);
+    if(getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) < 0 || cred.uid != geteuid()) {
+        LOG_WARN("HotRestart reject peer pid %d uid %d", static_cast<int>(cred.pid), static_cast<int>(cred.uid));
+        return false;
+    }
+    return true;
+}
+
+void HotRestart::ClosePeer_() {
+    if(peer_ >= 0) {
+        close(peer_);
+        peer_ = -1;
+    }
+}
+
+int HotRestart::Inherit(vector<string>* snapshot) {
+    struct sockaddr_un addr = { 0 };
+    addr.sun_family = AF_UNIX;
+    if(path_.empty() || path_.size() >= sizeof(addr.sun_path)) { return -1; }
+    strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(fd < 0) { return -1; }
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);  // 没有旧进程，或者是旧进程异常退出留下的路径
+        return -1;
+    }
+    if(!CheckPeer_(fd)) {
+        close(fd);
+        return -1;
+    }
+    SetTimeout_(fd);
+
+    Header header;
+    struct iovec iov = { &header, sizeof(header) };
+    char control[CMSG_SPACE(sizeof(int))];
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    int listenFd = -1;
+    if(recvmsg(fd, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) == sizeof(header)) {
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        if(cmsg && cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+            memcpy(&listenFd, CMSG_DATA(cmsg), sizeof(int));
+        }
+    }
+    if(listenFd < 0 || header.magic != MAGIC || header.bytes > MAX_SNAPSHOT) {
+        if(listenFd >= 0) { close(listenFd); }
+        close(fd);
+        return -1;
+    }
+
+    string body(header.bytes, '\0');
+    size_t got = 0;
+    while(got < body.size()) {
+        ssize_t n = recv(fd, &body[got], body.size() - got, 0);
+        if(n <= 0) { break; }
+        got += n;
+    }
+    if(got < body.size()) {
+        /* 旧进程中途失败：不确认、不使用监听套接字，旧进程读到连接关闭后继续服务 */
+        LOG_WARN("HotRestart snapshot incomplete: %zu/%u bytes", got, header.bytes);
+        close(listenFd);
+        close(fd);
+        return -1;
+    }
+    size_t start = 0;
+    while(start < body.size()) {
+        size_t end = body.find('\n', start);
+        if(end == string::npos) { break; }
+        if(end > start) { snapshot->emplace_back(body, start, end - start); }
+        start = end + 1;
+    }
+    peer_ = fd;  // 就绪后再确认
+    return listenFd;
+}
+
+void HotRestart::Ready() {
+    if(peer_ < 0) { return; }
+    char ack = 'R';
+    if(send(peer_, &ack, 1, MSG_NOSIGNAL) != 1) {
+        LOG_WARN("HotRestart ack error: %s", strerror(errno));
+    }
+    ClosePeer_();
+}
+
+bool HotRestart::Listen() {
+    struct sockaddr_un addr = { 0 };
+    addr.sun_family = AF_UNIX;
+    if(path_.empty() || path_.size() >= sizeof(addr.sun_path)) {
+        LOG_ERROR("HotRestart path %s error!", path_.c_str());
+        return false;
+    }
+    strncpy(addr.sun_path, path_.c_str(), sizeof(addr.sun_path) - 1);
+    fd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(fd_ < 0) { return false; }
+    unlink(path_.c_str());  // 旧进程已删除，这里清理的是异常退出留下的路径
+    if(bind(fd_, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(fd_, 1) < 0) {
+        LOG_ERROR("HotRestart listen %s error: %s", path_.c_str(), strerror(errno));
+        close(fd_);
+        fd_ = -1;
+        return false;
+    }
+    return true;
+}
+
+bool HotRestart::Handoff(int listenFd, const vector<string>& snapshot) {
+    int peer = accept4(fd_, nullptr, nullptr, SOCK_CLOEXEC);
+    if(peer < 0) { return false; }
+    if(!CheckPeer_(peer)) {
+        close(peer);
+        return false;
+    }
+    close(fd_);
+    fd_ = -1;
+    unlink(path_.c_str());
+    SetTimeout_(peer);
+    peer_ = peer;
+
+    string body;
+    for(const string& path: snapshot) {
+        if(body.size() + path.size() + 1 > MAX_SNAPSHOT) { break; }
+        body += path;
+        body += '\n';
+    }
+    Header header = { MAGIC, static_cast<uint32_t>(body.size()) };
+    struct iovec iov = { &header, sizeof(header) };
+    char control[CMSG_SPACE(sizeof(int))] = { 0 };
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &listenFd, sizeof(int));
+    bool ok = sendmsg(peer, &msg, MSG_NOSIGNAL) == sizeof(header);
+    for(size_t sent = 0; ok && sent < body.size(); ) {
+        ssize_t n = send(peer, body.data() + sent, body.size() - sent, MSG_NOSIGNAL);
+        if(n <= 0) { ok = false; }
+        else { sent += n; }
+    }
+    if(!ok) {
+        LOG_WARN("HotRestart handoff error: %s", strerror(errno));
+        ClosePeer_();
+        Listen();
+    }
+    return ok;
+}
+
+int HotRestart::OnPeer() {
+    char ack = 0;
+    ssize_t n = recv(peer_, &ack, 1, MSG_DONTWAIT);
+    if(n < 0 && (errno == EAGAIN || errno == EINTR)) { return 0; }
+    ClosePeer_();
+    if(n == 1 && ack == 'R') { return 1; }
+    LOG_WARN("HotRestart new process failed, keep serving");
+    Listen();
+    return -1;
+}
@@ -0,0 +1,60 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#ifndef HOT_RESTART_H
+#define HOT_RESTART_H
+
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+/*
+ * 热重启：新旧进程通过Unix套接字交接监听套接字，升级期间端口一直有进程在accept
+ *   旧进程在控制路径上监听；新进程启动时连接它，收到监听fd(SCM_RIGHTS)与静态文件缓存的路径索引
+ *   新进程开始接受连接后发送就绪确认，旧进程停止accept，处理完已有请求后退出
+ *   新进程随后在同一路径上监听，等待下一次升级
+ * 旧进程先关闭并删除控制路径再发送，新进程收到全部数据后才重新绑定，两者不会删除对方的路径
+ * 双方都只与同一用户的进程交接(SO_PEERCRED)，其他用户不能冒充旧进程塞给新进程监听套接字
+ */
+class HotRestart {
+public:
+    explicit HotRestart(const std::string& path);
+    ~HotRestart();
+
+    /* 新进程：从旧进程取得监听套接字与缓存索引，没有旧进程或失败(含索引不完整)返回-1 */
+    int Inherit(std::vector<std::string>* snapshot);
+    /* 新进程：已开始接受连接，通知旧进程 */
+    void Ready();
+
+    /* 在控制路径上监听，等待下一次升级 */
+    bool Listen();
+    /* 旧进程：控制套接字可读时调用，把监听套接字与缓存索引发给新进程 */
+    bool Handoff(int listenFd, const std::vector<std::string>& snapshot);
+    /* 旧进程：新进程连接可读时调用；返回1为新进程就绪，-1为新进程失败(已重新监听)，0为未完成 */
+    int OnPeer();
+
+    int Fd() const { return fd_; }  // 控制套接字，未监听为-1
+    int PeerFd() const { return peer_; }  // 交接中的另一方，没有为-1
+
+private:
+    struct Header {
+        uint32_t magic;
+        uint32_t bytes;  // 之后的缓存索引长度，路径以'\n'分隔
+    };
+
+    static const uint32_t MAGIC = 0x48525354;
+    static const uint32_t MAX_SNAPSHOT = 16 * 1024 * 1024;
+    static const int IO_TIMEOUT_MS = 2000;  // 交接期间阻塞读写的上限，避免卡住事件循环
+
+    static void SetTimeout_(int fd);
+    static bool CheckPeer_(int fd);
+    void ClosePeer_();
+
+    std::string path_;
+    int fd_;
+    int peer_;
+};
+
+#endif //HOT_RESTART_H
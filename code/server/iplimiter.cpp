@@ -0,0 +1,141 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#include "iplimiter.h"
+#include <chrono>
+#include <algorithm>
+#include <new>
+#include <sys/mman.h>
+#include <assert.h>
+using namespace std;
+
+static int64_t SteadyMs() {
+    return chrono::duration_cast<chrono::milliseconds>(
+                chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+IpLimiter::IpLimiter(size_t slots, int maxConns, int ratePerSec, int burst):
+        maxConns_(maxConns > 0 ? maxConns : 0), rate_(ratePerSec > 0 ? ratePerSec : 0),
+        burstMilli_(static_cast<uint64_t>(max(burst, ratePerSec > 0 ? 1 : 0)) * 1000), startMs_(SteadyMs()),
+        rejectedConns_(0), limitedRequests_(0), untracked_(0) {
+    size_t groups = 1;
+    while(groups * WAYS < slots) { groups <<= 1; }
+    mask_ = groups - 1;
+    /* C++14的new不保证超过16字节的对齐，与连接表一样用匿名映射(页对齐、已清零) */
+    void* addr = mmap(nullptr, sizeof(Group) * groups, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(addr == MAP_FAILED) { throw bad_alloc(); }
+    groups_ = static_cast<Group*>(addr);
+    for(size_t i = 0; i < groups; i++) {
+        new (&groups_[i]) Group();
+        for(Slot& slot: groups_[i].slots) {
+            slot.owner.store(0, memory_order_relaxed);
+            slot.bucket.store(burstMilli_, memory_order_relaxed);  // 空槽的令牌桶是满的
+        }
+    }
+}
+
+IpLimiter::~IpLimiter() {
+    for(size_t i = 0; i <= mask_; i++) { groups_[i].~Group(); }
+    munmap(groups_, sizeof(Group) * (mask_ + 1));
+}
+
+uint32_t IpLimiter::NowMs_() const {
+    return static_cast<uint32_t>(SteadyMs() - startMs_);  // 约49天回绕一次，只用差值
+}
+
+IpLimiter::Slot* IpLimiter::Find_(uint32_t ip, bool create) {
+    Group& group = groups_[(ip * 0x9E3779B1u) >> 7 & mask_];
+    for(Slot& slot: group.slots) {
+        if((slot.owner.load(memory_order_acquire) >> 32) == ip) { return &slot; }
+    }
+    if(!create) { return nullptr; }
+    for(Slot& slot: group.slots) {
+        uint64_t owner = 0;
+        if(slot.owner.load(memory_order_relaxed) == 0) {
+            /* 占用成功后才重置令牌桶，不会改写其他线程刚占用的槽；
+               重置之前其他线程看到的是回收时已补满的旧值，效果相同，重置只在旧值未被取用时生效 */
+            uint64_t bucket = slot.bucket.load(memory_order_relaxed);
+            if(slot.owner.compare_exchange_strong(owner, static_cast<uint64_t>(ip) << 32, memory_order_acq_rel)) {
+                slot.bucket.compare_exchange_strong(bucket, static_cast<uint64_t>(NowMs_()) << 32 | burstMilli_,
+                                                    memory_order_relaxed);
+                return &slot;
+            }
+            if((owner >> 32) == ip) { return &slot; }  // 同时被同一IP占用
+        }
+    }
+    untracked_++;
+    return nullptr;
+}
+
+bool IpLimiter::AcquireConn(const sockaddr_in& addr, bool* counted) {
+    uint32_t ip = addr.sin_addr.s_addr;
+    if(counted) { *counted = false; }
+    if(maxConns_ == 0 || ip == 0) { return true; }
+    Slot* slot = Find_(ip, true);
+    if(!slot) { return true; }
+    uint64_t owner = slot->owner.load(memory_order_acquire);
+    do {
+        if((owner >> 32) != ip) { return true; }  // 刚被回收，放行
+        if(static_cast<uint32_t>(owner) >= maxConns_) {
+            rejectedConns_++;
+            return false;
+        }
+    } while(!slot->owner.compare_exchange_weak(owner, owner + 1, memory_order_acq_rel));
+    if(counted) { *counted = true; }
+    return true;
+}
+
+void IpLimiter::ReleaseConn(const sockaddr_in& addr) {
+    uint32_t ip = addr.sin_addr.s_addr;
+    if(maxConns_ == 0 || ip == 0) { return; }
+    Slot* slot = Find_(ip, false);
+    if(!slot) { return; }
+    uint64_t owner = slot->owner.load(memory_order_acquire);
+    do {
+        if((owner >> 32) != ip || static_cast<uint32_t>(owner) == 0) { return; }
+    } while(!slot->owner.compare_exchange_weak(owner, owner - 1, memory_order_acq_rel));
+}
+
+uint64_t IpLimiter::Refill_(uint64_t bucket, uint32_t now) const {
+    uint32_t elapsed = now - static_cast<uint32_t>(bucket >> 32);
+    return min<uint64_t>((bucket & 0xFFFFFFFFu) + elapsed * rate_, burstMilli_);
+}
+
+bool IpLimiter::AllowRequest(const sockaddr_in& addr) {
+    uint32_t ip = addr.sin_addr.s_addr;
+    if(rate_ == 0 || ip == 0) { return true; }
+    Slot* slot = Find_(ip, true);
+    if(!slot) { return true; }
+    uint32_t now = NowMs_();
+    uint64_t bucket = slot->bucket.load(memory_order_relaxed);
+    uint64_t tokens;
+    do {
+        tokens = Refill_(bucket, now);
+        if(tokens < 1000) {
+            limitedRequests_++;
+            return false;
+        }
+    } while(!slot->bucket.compare_exchange_weak(bucket, static_cast<uint64_t>(now) << 32 | (tokens - 1000),
+                                                memory_order_relaxed));
+    return true;
+}
+
+size_t IpLimiter::Sweep() {
+    uint32_t now = NowMs_();
+    size_t used = 0;
+    for(size_t i = 0; i <= mask_; i++) {
+        for(Slot& slot: groups_[i].slots) {
+            uint64_t owner = slot.owner.load(memory_order_acquire);
+            if(owner == 0) { continue; }
+            /* 没有连接并且令牌已补满：回收后重新占用时状态与现在相同 */
+            bool idle = static_cast<uint32_t>(owner) == 0
+                        && (rate_ == 0 || Refill_(slot.bucket.load(memory_order_relaxed), now) >= burstMilli_);
+            if(!idle || !slot.owner.compare_exchange_strong(owner, 0, memory_order_acq_rel)) {
+                used++;
+            }
+        }
+    }
+    return used;
+}
@@ -0,0 +1,73 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#ifndef IP_LIMITER_H
+#define IP_LIMITER_H
+
+#include <atomic>
+#include <stdint.h>
+#include <stddef.h>
+#include <netinet/in.h>
+
+/*
+ * 按客户端IP限制并发连接数与请求速率(令牌桶)
+ * 固定大小的组相联哈希表：IP哈希到一组(4个槽，恰好一个缓存行)，组内找不到也没有空槽时该IP不受限(fail open)，
+ * 不同组之间没有探测链，回收槽不需要墓碑
+ * 每个槽两个64位原子字，全部操作是CAS，不加锁：
+ *   owner  高32位IP，低32位当前连接数；IP为0表示空槽
+ *   bucket 高32位上次取令牌的时间(毫秒)，低32位剩余令牌(千分之一个)；令牌在取用时按经过的时间补充
+ * 定时器周期调用Sweep，回收没有连接、令牌已补满的槽；空槽的令牌桶总是满的，新占用者不必先初始化再发布
+ */
+class IpLimiter {
+public:
+    /* slots为总槽数(向上取2的幂)；maxConns、ratePerSec为0表示对应项不限制 */
+    IpLimiter(size_t slots, int maxConns, int ratePerSec, int burst);
+    ~IpLimiter();
+
+    /* 新连接：未超过并发上限返回true；counted返回是否计了数(组已满、不限制时放行但不计数)
+       计了数的连接关闭时必须ReleaseConn，没计数的不能调用，否则会减掉同一IP其他连接的计数 */
+    bool AcquireConn(const sockaddr_in& addr, bool* counted = nullptr);
+    void ReleaseConn(const sockaddr_in& addr);
+    /* 请求到达：取一个令牌，取不到返回false */
+    bool AllowRequest(const sockaddr_in& addr);
+
+    /* 回收空闲槽，返回仍在使用的槽数 */
+    size_t Sweep();
+
+    size_t RejectedConns() const { return rejectedConns_; }
+    size_t LimitedRequests() const { return limitedRequests_; }
+    size_t Untracked() const { return untracked_; }
+
+private:
+    static const int WAYS = 4;
+
+    struct Slot {
+        std::atomic<uint64_t> owner;
+        std::atomic<uint64_t> bucket;
+    };
+    struct alignas(64) Group {
+        Slot slots[WAYS];
+    };
+
+    IpLimiter(const IpLimiter&) = delete;
+    IpLimiter& operator=(const IpLimiter&) = delete;
+
+    Slot* Find_(uint32_t ip, bool create);
+    uint32_t NowMs_() const;
+    uint64_t Refill_(uint64_t bucket, uint32_t now) const;  // 补充后的令牌数(千分之一个)
+
+    Group* groups_;
+    size_t mask_;
+    const uint32_t maxConns_;
+    const uint64_t rate_;       // 每秒令牌数，等于每毫秒补充的千分之一令牌数
+    const uint64_t burstMilli_;
+    const int64_t startMs_;
+
+    std::atomic<size_t> rejectedConns_;
+    std::atomic<size_t> limitedRequests_;
+    std::atomic<size_t> untracked_;  // 组内槽已满、未受限的次数
+};
+
+#endif //IP_LIMITER_H
@@ -0,0 +1,125 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#include "prefork.h"
+#include <chrono>
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/prctl.h>
+using namespace std;
+
+const int64_t Prefork::STABLE_MS;
+const int Prefork::MAX_BACKOFF_SHIFT;
+
+Prefork::Prefork(int workerNum, int restartDelayMs):
+        restartDelayMs_(max(restartDelayMs, 0)), workers_(max(workerNum, 1)), masterPid_(getpid()), restarts_(0) {
+    sigemptyset(&oldMask_);
+}
+
+int64_t Prefork::NowMs_() {
+    return chrono::duration_cast<chrono::milliseconds>(
+                chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Prefork::Spawn_(int index, const function<int(int)>& work) {
+    pid_t pid = fork();
+    if(pid < 0) {
+        fprintf(stderr, "Prefork: fork worker %d error: %s\n", index, strerror(errno));
+        workers_[index].restartAtMs = NowMs_() + max(restartDelayMs_, 1);
+        return;
+    }
+    if(pid == 0) {
+        sigprocmask(SIG_SETMASK, &oldMask_, nullptr);  // 恢复信号的默认处理
+        prctl(PR_SET_PDEATHSIG, SIGTERM);  // 主进程被强杀时工作进程随之退出
+        if(getppid() != masterPid_) { _exit(0); }  // 设置之前主进程已经退出
+        exit(work(index));  // exit而非_exit：运行静态对象的析构，日志刷盘
+    }
+    workers_[index].pid = pid;
+    workers_[index].startMs = NowMs_();
+}
+
+/* 回收退出的工作进程，非停止阶段安排重启 */
+void Prefork::Reap_(bool stopping) {
+    int status = 0;
+    pid_t pid;
+    while((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        for(size_t i = 0; i < workers_.size(); i++) {
+            Worker& worker = workers_[i];
+            if(worker.pid != pid) { continue; }
+            worker.pid = -1;
+            if(stopping) { break; }
+            if(WIFSIGNALED(status)) {
+                fprintf(stderr, "Prefork: worker %zu[%d] killed by signal %d\n", i, pid, WTERMSIG(status));
+            } else {
+                fprintf(stderr, "Prefork: worker %zu[%d] exited with %d\n", i, pid, WEXITSTATUS(status));
+            }
+            int64_t now = NowMs_();
+            if(now - worker.startMs >= STABLE_MS) {
+                worker.quickExits = 0;
+                worker.restartAtMs = now;
+            } else {
+                int shift = min(worker.quickExits, MAX_BACKOFF_SHIFT);
+                worker.quickExits++;
+                worker.restartAtMs = now + (static_cast<int64_t>(restartDelayMs_) << shift);
+            }
+            break;
+        }
+    }
+}
+
+int Prefork::Run(const function<int(int)>& work) {
+    sigset_t set;
+    sigemptyset(&set);
+    sigaddset(&set, SIGCHLD);
+    sigaddset(&set, SIGTERM);
+    sigaddset(&set, SIGINT);
+    sigprocmask(SIG_BLOCK, &set, &oldMask_);  // 先屏蔽，fork前后到达的信号留给sigtimedwait
+    for(size_t i = 0; i < workers_.size(); i++) {
+        Spawn_(static_cast<int>(i), work);
+    }
+    bool stopping = false;
+    while(true) {
+        Reap_(stopping);
+        int64_t now = NowMs_();
+        int64_t next = -1;
+        size_t alive = 0;
+        for(size_t i = 0; i < workers_.size(); i++) {
+            Worker& worker = workers_[i];
+            if(worker.pid < 0 && !stopping) {
+                if(worker.restartAtMs <= now) {
+                    Spawn_(static_cast<int>(i), work);
+                    restarts_++;
+                }
+                if(worker.pid < 0 && (next < 0 || worker.restartAtMs < next)) { next = worker.restartAtMs; }
+            }
+            if(worker.pid > 0) { alive++; }
+        }
+        if(stopping && alive == 0) { break; }
+
+        siginfo_t info;
+        int sig;
+        if(next < 0) {
+            sig = sigwaitinfo(&set, &info);
+        } else {
+            int64_t waitMs = max<int64_t>(next - NowMs_(), 0);
+            struct timespec ts = { static_cast<time_t>(waitMs / 1000), static_cast<long>(waitMs % 1000) * 1000000 };
+            sig = sigtimedwait(&set, &info, &ts);
+        }
+        if(sig == SIGTERM || sig == SIGINT) {
+            /* 第一次通知工作进程退出，再次收到则强杀 */
+            for(Worker& worker: workers_) {
+                if(worker.pid > 0) { kill(worker.pid, stopping ? SIGKILL : SIGTERM); }
+            }
+            stopping = true;
+        }
+    }
+    sigprocmask(SIG_SETMASK, &oldMask_, nullptr);
+    return 0;
+}
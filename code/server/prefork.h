@@ -0,0 +1,53 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-17
+ * @copyleft Apache 2.0
+ */
+#ifndef PREFORK_H
+#define PREFORK_H
+
+#include <vector>
+#include <functional>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+/*
+ * 多进程模型的主进程：fork出workerNum个工作进程，每个进程运行自己的WebServer(线程池、连接池、日志各自独立)
+ * 工作进程崩溃只断开它自己的连接，主进程重新拉起；启动后很快又退出的连续按指数退避延迟重启，避免反复fork
+ * 主进程不创建线程，用sigtimedwait同步等待SIGCHLD、SIGTERM、SIGINT，不使用信号处理函数
+ * 收到SIGTERM或SIGINT后转发SIGTERM给所有工作进程，全部退出后Run返回
+ */
+class Prefork {
+public:
+    Prefork(int workerNum, int restartDelayMs);
+
+    /* 主进程中返回；工作进程中执行work(序号)后以其返回值退出，不会返回 */
+    int Run(const std::function<int(int)>& work);
+
+    size_t Restarts() const { return restarts_; }
+
+private:
+    struct Worker {
+        pid_t pid = -1;
+        int64_t startMs = 0;
+        int64_t restartAtMs = 0;  // pid为-1时，到这个时间重新拉起
+        int quickExits = 0;  // 连续的启动后很快退出次数
+    };
+
+    void Spawn_(int index, const std::function<int(int)>& work);
+    void Reap_(bool stopping);
+
+    static int64_t NowMs_();
+
+    static const int64_t STABLE_MS = 1000;  // 运行超过这么久才退出视为偶发，立即重启
+    static const int MAX_BACKOFF_SHIFT = 5;
+
+    const int restartDelayMs_;
+    std::vector<Worker> workers_;
+    pid_t masterPid_;
+    sigset_t oldMask_;
+    size_t restarts_;
+};
+
+#endif //PREFORK_H
@@ -8,46 +8,284 @@
 
 using namespace std;
 
+const int WebServer::ACCEPT_RETRY_MS;
+
 WebServer::WebServer(
             int port, int trigMode, int timeoutMS, bool OptLinger,
             int sqlPort, const char* sqlUser, const  char* sqlPwd,
             const char* dbName, int connPoolNum, int threadNum,
-            bool openLog, int logLevel, int logQueSize):
-            port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS), isClose_(false),
-            timer_(make_unique<HeapTimer>()), threadpool_(make_unique<ThreadPool>(threadNum)), epoller_(make_unique<Epoller>())
+            bool openLog, int logLevel, int logQueSize,
+            const Config& config):
+            port_(port), openLinger_(OptLinger), timeoutMS_(timeoutMS),
+            keepAliveIdleMs_(config.keepAliveTimeoutMs > 0 ? config.keepAliveTimeoutMs : timeoutMS), sessionSweepMs_(0), ipSweepMs_(0),
+            fastPath_(false), fastPathMaxBytes_(0), isClose_(false),
+            acceptBatch_(config.acceptBatch > 0 ? config.acceptBatch : 1), acceptPending_(false), reserveFd_(-1),
+            draining_(false), idleClosed_(false), drainTimeoutMs_(config.drainTimeoutMs > 0 ? config.drainTimeoutMs : 0),
+            signalFd_(-1), drainSignal_(0),
+            timer_(make_unique<HeapTimer>()), epoller_(make_unique<Epoller>()),
+            users_(MAX_FD + RESERVED_FD)
             // timer_(new HeapTimer()), threadpool_(new ThreadPool(threadNum)), epoller_(new Epoller())
     {
+    /* SIGTERM、SIGINT交给事件循环经signalfd处理；在创建任何线程之前屏蔽，之后创建的线程都继承，信号不会被其他线程以默认方式处理 */
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGINT);
+    pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+    signalFd_ = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    reserveFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    vector<int> workerCpus;
+    ResolveCpus_(config, &reactorCpus_, &workerCpus);
+    threadpool_ = make_unique<ThreadPool>(threadNum, workerCpus);
     srcDir_ = getcwd(nullptr, 256);  // 获取当前工作目录路径
     assert(srcDir_);
     strncat(srcDir_, "/resources/", 16);  // 字符串拼接，得到资源文件的路径
     HttpConn::userCount = 0;
+    HttpConn::isDraining = false;
     HttpConn::srcDir = srcDir_;
-    SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum);
+    HttpConn::keepAliveMax = config.keepAliveMaxRequests;
+    /* 只有开启超时才有空闲超时，告知客户端的值向下取整，客户端先于服务器放弃连接 */
+    HttpConn::keepAliveTimeoutSec = timeoutMS_ > 0 ? max(keepAliveIdleMs_ / 1000, 1) : 0;
+    /* 多进程时各工作进程看不到彼此的注册：嵌入式存储不能共享，布隆过滤器与负缓存会给出过期的"不存在" */
+    bool multiProcess = config.workerProcesses > 0;
+    if(config.openEmbeddedStore && multiProcess) {
+        isClose_ = true;
+    } else if(config.openEmbeddedStore) {
+        userStore_ = make_unique<MmapUserStore>();
+        if(userStore_->Open(config.embeddedStorePath, config.embeddedStoreCapacity, config.embeddedStoreSync)) {
+            HttpRequest::userStore = userStore_.get();
+        } else {
+            userStore_.reset();
+            isClose_ = true;
+        }
+    } else {
+        SqlConnPool::Instance()->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, connPoolNum,
+                                      config.sqlPoolMin, config.sqlAcquireTimeoutMs, config.sqlIdleCheckMs);
+        SqlConnPool::Instance()->SetLocalStash(config.sqlLocalStash, threadNum);
+    }
+    if(config.openUserBloom && !multiProcess) {
+        UserBloom::Instance()->Init(config.userBloomExpected, config.userBloomFpRate);
+    }
+    if(config.openSqlBatch && !userStore_) {
+        SqlBatchWriter::Instance()->Init(SqlConnPool::Instance(), config.sqlBatchMax, config.sqlBatchWindowMs);
+    }
+    if(config.openCredCache) {
+        CredCache::Instance()->Init(config.credCacheShards, config.credCacheCapacity,
+                                    config.credCacheTtlMs, multiProcess ? 0 : config.credCacheNegativeTtlMs);
+    }
+    if(config.openAsyncSql && !userStore_) {  // 异步认证直接访问MySQL
+        sqlAsync_ = make_unique<SqlAsyncPool>(epoller_.get());
+        if(sqlAsync_->Init("localhost", sqlPort, sqlUser, sqlPwd, dbName, config.asyncSqlConnNum,
+                           config.asyncSqlMaxWait, config.asyncSqlTimeoutMs)) {
+            HttpRequest::isAsyncVerify = true;
+        } else {
+            sqlAsync_.reset();
+        }
+    }
+    if(config.openAsyncRedis) {
+        redisAsync_ = make_unique<RedisAsync>(epoller_.get());
+        redisAsync_->Init(config.redisHost, config.redisPort, config.redisConnNum);
+    }
+    if(config.openSession) {
+        SessionStore::Instance()->Init(config.sessionShards, config.sessionTtlMs,
+                                       config.sessionRedis ? redisAsync_.get() : nullptr);
+        sessionSweepMs_ = config.sessionSweepMs > 0 ? config.sessionSweepMs : 1000;
+        SweepSession_();
+    }
+    if(config.openAdmission) {
+        admission_ = make_unique<AdmissionControl>(config.admissionTargetMs, config.admissionIntervalMs);
+    }
+    if(config.openIpLimit) {
+        ipLimiter_ = make_unique<IpLimiter>(config.ipTableSlots, config.ipMaxConns, config.ipRatePerSec,
+                                            config.ipRateBurst);
+        limitResponse_ = "HTTP/1.1 429 Too Many Requests\r\nRetry-After: " + to_string(config.retryAfterSec)
+                    + "\r\nContent-type: text/plain\r\nContent-length: 18\r\nConnection: close\r\n\r\nToo many requests!";
+        ipSweepMs_ = config.ipSweepMs > 0 ? config.ipSweepMs : 10000;
+        SweepIpLimit_();
+    }
+    if(config.openBusyPoll && config.busyPollMaxUs > 0) {
+        busyPoll_ = make_unique<BusyPoll>(config.busyPollMaxUs);
+    }
+    busyResponse_ = "HTTP/1.1 503 Service Unavailable\r\nRetry-After: " + to_string(config.retryAfterSec)
+                    + "\r\nContent-type: text/plain\r\nContent-length: 12\r\nConnection: close\r\n\r\nServer busy!";
+    if(config.openFileCache) {
+        FileCache::Instance()->Init(static_cast<size_t>(config.fileCacheMaxFileKB) * 1024,
+                                    static_cast<size_t>(config.fileCacheCapacityMB) * 1024 * 1024);
+        fastPath_ = config.openFastPath;
+        fastPathMaxBytes_ = config.fastPathMaxBytes;
+    }
+
+    /* 热重启：有旧进程时接管它的监听套接字，并按它的缓存索引预热静态文件 */
+    int inheritedFd = config.listenFd;
+    size_t warmed = 0;
+    if(config.hotRestartPath[0] && config.workerProcesses <= 0 && inheritedFd < 0) {
+        hotRestart_ = make_unique<HotRestart>(config.hotRestartPath);
+        vector<string> snapshot;
+        inheritedFd = hotRestart_->Inherit(&snapshot);
+        if(inheritedFd >= 0) { warmed = FileCache::Instance()->Warm(snapshot, srcDir_); }
+    }
 
     InitEventMode_(trigMode);  // 初始化事件触发模式
-    if(!InitSocket_()) { isClose_ = true;}  // 初始化socket套接字
+    if(!InitSocket_(config, inheritedFd)) { isClose_ = true;}  // 初始化socket套接字
+    epoller_->AddFd(completions_.Fd(), EPOLLIN);  // 水平触发，Drain中读eventfd清零
+    if(signalFd_ >= 0) { epoller_->AddFd(signalFd_, EPOLLIN); }
 
     if(openLog) {
-        Log::Instance()->init(logLevel, "./log", ".log", logQueSize);
+        Log::Instance()->init(logLevel, "./log", config.logSuffix, logQueSize);
+        if(config.openEmbeddedStore && multiProcess) {
+            LOG_ERROR("Embedded store can not be shared by worker processes, use MySQL!");
+        }
         if(isClose_) { LOG_ERROR("========== Server init error!=========="); }
         else {
             LOG_INFO("========== Server init ==========");
             LOG_INFO("Port:%d, OpenLinger: %s", port_, OptLinger? "true":"false");
+            LOG_INFO("KeepAlive max requests: %d, idle timeout: %dms", config.keepAliveMaxRequests,
+                            timeoutMS_ > 0 ? keepAliveIdleMs_ : 0);
+            LOG_INFO("Listen backlog: %d, accept batch: %d, defer accept: %ds, fast open: %d, exclusive: %s",
+                            config.listenBacklog, acceptBatch_, config.deferAcceptSec, config.fastOpenQueue,
+                            config.listenExclusive ? "true" : "false");
             LOG_INFO("Listen Mode: %s, OpenConn Mode: %s",
                             (listenEvent_ & EPOLLET ? "ET": "LT"),
                             (connEvent_ & EPOLLET ? "ET": "LT"));
             LOG_INFO("LogSys level: %d", logLevel);
             LOG_INFO("srcDir: %s", HttpConn::srcDir);
+            if(userStore_) {
+                LOG_INFO("UserStore: embedded %s, users: %zu", config.embeddedStorePath, userStore_->Count());
+            }
             LOG_INFO("SqlConnPool num: %d, ThreadPool num: %d", connPoolNum, threadNum);
+            /* 配置写错时Parse返回空，不绑定也不会报错，这里提示 */
+            if(config.reactorCpus && *config.reactorCpus && CpuAffinity::Parse(config.reactorCpus).empty()) {
+                LOG_WARN("Invalid reactorCpus \"%s\", ignored", config.reactorCpus);
+            }
+            if(config.workerCpus && *config.workerCpus && CpuAffinity::Parse(config.workerCpus).empty()) {
+                LOG_WARN("Invalid workerCpus \"%s\", ignored", config.workerCpus);
+            }
+            if(!reactorCpus_.empty() || !workerCpus.empty()) {
+                LOG_INFO("CPU affinity reactor: %s (node %d), workers: %s",
+                            CpuAffinity::ToString(reactorCpus_).c_str(),
+                            reactorCpus_.empty() ? -1 : CpuAffinity::NodeOf(reactorCpus_[0]),
+                            CpuAffinity::ToString(workerCpus).c_str());
+            }
+            if(threadpool_->PinFailures() > 0) {
+                LOG_WARN("Pin %zu of %d workers to CPU %s error!", threadpool_->PinFailures(), threadNum,
+                            CpuAffinity::ToString(workerCpus).c_str());
+            }
+            if(hotRestart_) {
+                LOG_INFO("HotRestart path: %s, inherited listen fd: %s, warmed files: %zu",
+                            config.hotRestartPath, inheritedFd >= 0 ? "true" : "false", warmed);
+            }
+            if(busyPoll_ || config.busyPollSocketUs > 0) {
+                LOG_INFO("BusyPoll max spin: %dus, socket busy poll: %dus",
+                            busyPoll_ ? config.busyPollMaxUs : 0, config.busyPollSocketUs);
+            }
+            if(!userStore_) {
+                LOG_INFO("SqlConnPool ready: %d, acquire timeout: %dms, idle check: %dms",
+                            SqlConnPool::Instance()->GetStats().total, config.sqlAcquireTimeoutMs,
+                            config.sqlIdleCheckMs);
+            }
+            if(config.openUserBloom && multiProcess) {
+                LOG_WARN("UserBloom disabled with worker processes");
+            } else if(config.openUserBloom) {
+                LOG_INFO("UserBloom expected: %d, fp rate: %.4f", config.userBloomExpected,
+                            config.userBloomFpRate);
+            }
+            if(config.openSqlBatch) {
+                LOG_INFO("SqlBatchWriter max batch: %d, window: %dms", config.sqlBatchMax,
+                            config.sqlBatchWindowMs);
+            }
+            if(config.sqlLocalStash > 0) {
+                LOG_INFO("SqlConnPool thread local stash: %d", config.sqlLocalStash);
+            }
+            if(config.openCredCache) {
+                LOG_INFO("CredCache shards: %d, capacity: %d, ttl: %dms, negative ttl: %dms", config.credCacheShards,
+                            config.credCacheCapacity, config.credCacheTtlMs,
+                            multiProcess ? 0 : config.credCacheNegativeTtlMs);
+            }
+            if(sqlAsync_) {
+                LOG_INFO("SqlAsyncPool num: %d, max wait: %d, timeout: %dms", config.asyncSqlConnNum,
+                            config.asyncSqlMaxWait, config.asyncSqlTimeoutMs);
+            }
+            if(redisAsync_) {
+                LOG_INFO("RedisAsync %s:%d, conn num: %d", config.redisHost, config.redisPort,
+                            config.redisConnNum);
+            }
+            if(config.openSession) {
+                LOG_INFO("Session shards: %d, ttl: %dms, redis: %s", config.sessionShards,
+                            config.sessionTtlMs, (config.sessionRedis && redisAsync_) ? "true" : "false");
+            }
+            if(admission_) {
+                LOG_INFO("Admission target: %dms, interval: %dms, retry after: %ds", config.admissionTargetMs,
+                            config.admissionIntervalMs, config.retryAfterSec);
+            }
+            if(ipLimiter_) {
+                LOG_INFO("IpLimit conns: %d, rate: %d/s, burst: %d, slots: %d", config.ipMaxConns,
+                            config.ipRatePerSec, config.ipRateBurst, config.ipTableSlots);
+            }
+            if(config.openFileCache) {
+                LOG_INFO("FileCache max file: %dKB, capacity: %dMB, fast path: %s(<=%d bytes)",
+                            config.fileCacheMaxFileKB, config.fileCacheCapacityMB,
+                            fastPath_ ? "true" : "false", config.fastPathMaxBytes);
+            }
+        }
+        if(config.openAccessLog) {
+            AccessLog::Instance()->Init(config.accessSampleRate, config.accessSlowMs);
+            LOG_INFO("AccessLog sample: 1/%d, slow: %dms", config.accessSampleRate, config.accessSlowMs);
         }
     }
+    if(config.openUserBloom && !multiProcess) {
+        /* 日志系统初始化之后再开始加载，以便记录加载耗时与误判率 */
+        UserBloom::Instance()->LoadAsync(HttpRequest::userStore);
+    }
 }
 
 WebServer::~WebServer() {
-    close(listenFd_);
+    /* 先关闭会回调的组件：未完成的异步认证、注册得到失败结果，回调向仍在运行的线程池提交任务 */
+    SqlBatchWriter::Instance()->Close();  // 写完已排队的注册再关闭连接池
+    if(sqlAsync_) { sqlAsync_->Close(); }
+    if(redisAsync_) { redisAsync_->Close(); }
+    /* 等工作线程做完手上的请求，之后才能释放连接表与完成队列；指针保持有效，迟到的回调提交任务不会访问空指针 */
+    threadpool_->Shutdown();
+    if(fastPath_) {
+        for(auto& route: routes_) {
+            LOG_INFO("Route %s reactor: %zu, pool: %zu", route.first.c_str(), route.second.reactor,
+                        route.second.pool);
+        }
+        LOG_INFO("FileCache hits: %zu, misses: %zu, bytes: %zu", FileCache::Instance()->Hits(),
+                    FileCache::Instance()->Misses(), FileCache::Instance()->Bytes());
+    }
+    LogReuse_();
+    if(busyPoll_) {
+        size_t polls = busyPoll_->Hits() + busyPoll_->Blocks();
+        LOG_INFO("BusyPoll spin: %lldms, hits: %zu, blocks: %zu, hit rate: %.2f, budget: %lldus",
+                    (long long)busyPoll_->SpinUs() / 1000, busyPoll_->Hits(), busyPoll_->Blocks(),
+                    polls ? (double)busyPoll_->Hits() / polls : 0.0, (long long)busyPoll_->Budget());
+    }
+    if(admission_) {
+        LOG_INFO("Admission overloads: %zu, shed connections: %zu, new: %zu, keep-alive: %zu",
+                    admission_->Overloads(), admission_->ShedConnections(), admission_->ShedNew(),
+                    admission_->ShedKeepAlive());
+    }
+    if(ipLimiter_) {
+        LOG_INFO("IpLimit rejected connections: %zu, limited requests: %zu, untracked: %zu",
+                    ipLimiter_->RejectedConns(), ipLimiter_->LimitedRequests(), ipLimiter_->Untracked());
+    }
+    if(listenFd_ >= 0) { close(listenFd_); }
+    if(signalFd_ >= 0) { close(signalFd_); }
+    if(reserveFd_ >= 0) { close(reserveFd_); }
     isClose_ = true;
     free(srcDir_);
+    UserBloom::Instance()->Close();
+    SessionStore::Instance()->Close();
+    if(!userStore_) {
+        SqlPoolStats sqlStats = SqlConnPool::Instance()->GetStats();
+        LOG_INFO("SqlConnPool acquires: %zu, timeouts: %zu, connect fails: %zu, broken: %zu, "
+                    "wait avg: %lluus, max: %lluus, total: %d, in use: %d",
+                    sqlStats.acquires, sqlStats.timeouts, sqlStats.connectFails, sqlStats.broken,
+                    (unsigned long long)(sqlStats.acquires ? sqlStats.waitUsTotal / sqlStats.acquires : 0),
+                    (unsigned long long)sqlStats.waitUsMax, sqlStats.total, sqlStats.inUse);
+    }
     SqlConnPool::Instance()->ClosePool();
+    Log::Instance()->flush();
 }
 
 /*
@@ -81,93 +319,438 @@ void WebServer::InitEventMode_(int trigMode) {
     HttpConn::isET = (connEvent_ & EPOLLET);  // 通过按位与获取连接模式中关于ET模式的设置
 }
 
+/*
+ * 确定事件循环与工作线程绑定的CPU：显式列表优先；指定网卡时事件循环与其接收中断同核，
+ * 收到的数据仍在该核缓存中；指定(或由网卡推出)NUMA节点时未指定的列表取该节点的CPU
+ */
+void WebServer::ResolveCpus_(const Config& config, vector<int>* reactor, vector<int>* workers) {
+    *reactor = CpuAffinity::Parse(config.reactorCpus ? config.reactorCpus : "");
+    *workers = CpuAffinity::Parse(config.workerCpus ? config.workerCpus : "");
+    string nic = config.irqAffinityNic ? config.irqAffinityNic : "";
+    int node = config.numaNode;
+    if(!nic.empty()) {
+        vector<int> irqCpus = CpuAffinity::NicIrqCpus(nic);
+        if(reactor->empty() && !irqCpus.empty()) { *reactor = { irqCpus[0] }; }
+        if(node < 0 && !reactor->empty()) { node = CpuAffinity::NodeOf((*reactor)[0]); }
+    }
+    if(node >= 0) {
+        vector<int> nodeCpus = CpuAffinity::NodeCpus(node);
+        if(reactor->empty() && !nodeCpus.empty()) { *reactor = { nodeCpus[0] }; }
+        if(workers->empty()) {
+            for(int cpu: nodeCpus) {
+                if(find(reactor->begin(), reactor->end(), cpu) == reactor->end()) { workers->push_back(cpu); }
+            }
+            if(workers->empty()) { *workers = nodeCpus; }  // 节点只有一个核
+        }
+    }
+}
+
 void WebServer::Start() {
     int timeMS = -1;  /* epoll wait timeout == -1 无事件将阻塞 */
+    /* 在事件循环线程中绑定：之后首次构造的连接对象按首次访问分配在本节点；
+       放在构造之后，构造中创建的日志、连接池等线程不会继承这个绑定 */
+    if(!reactorCpus_.empty() && !CpuAffinity::PinSelf(reactorCpus_)) {
+        LOG_WARN("Pin reactor to CPU %s error!", CpuAffinity::ToString(reactorCpus_).c_str());
+    }
     if(!isClose_) { LOG_INFO("========== Server start =========="); }
+    if(hotRestart_) {
+        hotRestart_->Ready();  // 接管的监听套接字已注册，旧进程可以停止accept
+        if(hotRestart_->Listen()) { epoller_->AddFd(hotRestart_->Fd(), EPOLLIN); }
+    }
     while(!isClose_) {  // 死循环，不断调用epoll_wait
-        if(timeoutMS_ > 0) {
+        timeMS = -1;
+        if(timeoutMS_ > 0 || sessionSweepMs_ > 0 || ipSweepMs_ > 0) {  // 连接超时与周期清理共用定时器
             timeMS = timer_->GetNextTick();
         }
-        int eventCnt = epoller_->Wait(timeMS);
+        if(sqlAsync_) {  // 异步查询超时与断线重连
+            int sqlMS = sqlAsync_->GetNextTick();
+            if(sqlMS >= 0 && (timeMS < 0 || sqlMS < timeMS)) { timeMS = sqlMS; }
+        }
+        if(redisAsync_) {  // Redis断线重连
+            int redisMS = redisAsync_->GetNextTick();
+            if(redisMS >= 0 && (timeMS < 0 || redisMS < timeMS)) { timeMS = redisMS; }
+        }
+        if(acceptPending_) {  // 还有未接受的连接，只收集就绪事件不阻塞；fd耗尽时最多等到重试时间
+            auto retryMs = chrono::duration_cast<chrono::milliseconds>(
+                                acceptRetryAt_ - chrono::steady_clock::now()).count();
+            int acceptMS = retryMs > 0 ? static_cast<int>(retryMs) : 0;
+            if(timeMS < 0 || acceptMS < timeMS) { timeMS = acceptMS; }
+        }
+        if(draining_ && CheckDrain_(&timeMS)) { break; }
+        int eventCnt = Wait_(timeMS);
         // 循环遍历事件
         for(int i = 0; i < eventCnt; i++) {
             /* 处理事件 */
             int fd = epoller_->GetEventFd(i);
             uint32_t events = epoller_->GetEvents(i);
+            HttpConn* client = nullptr;
             if(fd == listenFd_) {  // 监听到的发生事件的fd与listenfd一致，表示有客户端连接进来
-                DealListen_();  // 接收客户端连接
+                acceptPending_ = true;  // 先处理已有连接的事件，最后再接受新连接
+            }
+            else if(fd == signalFd_) {
+                DealSignal_();
+            }
+            else if(hotRestart_ && (fd == hotRestart_->Fd() || fd == hotRestart_->PeerFd())) {
+                DealHotRestart_(fd);  // 新进程前来接管
+            }
+            else if(fd == completions_.Fd()) {  // 工作线程交还的连接
+                completions_.Drain(std::bind(&WebServer::OnCompletion_, this, std::placeholders::_1));
+            }
+            else if(sqlAsync_ && sqlAsync_->HandleEvent(fd, events)) {
+                continue;  // 异步数据库连接上的事件，已由连接池处理
+            }
+            else if(redisAsync_ && redisAsync_->HandleEvent(fd, events)) {
+                continue;  // Redis连接上的事件
+            }
+            else if((client = users_.Get(fd)) == nullptr) {
+                continue;  // 本轮事件返回后连接已被工作线程关闭
             }
             else if(events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {  // 连接错误
-                assert(users_.count(fd) > 0);
-                CloseConn_(&users_[fd]);  // 关闭连接
+                RequestClose_(fd, users_.Gen(fd));  // 关闭连接，正在处理时延后到处理完成
             }
             else if(events & EPOLLIN) {    
-                assert(users_.count(fd) > 0);
-                DealRead_(&users_[fd]);  // 处理读事件
+                DealRead_(client);  // 处理读事件
             }
             else if(events & EPOLLOUT) {
-                assert(users_.count(fd) > 0);
-                DealWrite_(&users_[fd]);  // 处理写事件
+                DealWrite_(client);  // 处理写事件
             } else {
                 LOG_ERROR("Unexpected event");
             }
         }
+        if(acceptPending_ && !draining_ && chrono::steady_clock::now() >= acceptRetryAt_) {
+            DealListen_();  // 接收客户端连接
+        }
+    }
+}
+
+/* 控制套接字上有新进程连接：交出监听套接字；新进程就绪后开始退出 */
+void WebServer::DealHotRestart_(int fd) {
+    if(fd == hotRestart_->Fd()) {
+        if(hotRestart_->Handoff(listenFd_, FileCache::Instance()->Paths())) {
+            epoller_->AddFd(hotRestart_->PeerFd(), EPOLLIN);
+            LOG_INFO("HotRestart listen fd handed off, waiting for new process");
+        } else if(hotRestart_->Fd() >= 0) {
+            epoller_->AddFd(hotRestart_->Fd(), EPOLLIN);  // 发送失败时已重新监听；仍是原fd时注册返回EEXIST，无影响
+        }
+        return;
+    }
+    int ret = hotRestart_->OnPeer();
+    if(ret > 0) {
+        LOG_INFO("HotRestart new process ready, draining");
+        BeginDrain_(false);  // 监听套接字由新进程继续accept
+    } else if(ret < 0 && hotRestart_->Fd() >= 0) {
+        epoller_->AddFd(hotRestart_->Fd(), EPOLLIN);
+    }
+}
+
+/*
+ * 第一次收到信号开始排空，再次收到同一信号立即退出
+ * 多进程时终端的Ctrl-C同时发给主进程与工作进程，主进程又转发SIGTERM，不同的信号不算再次
+ */
+void WebServer::DealSignal_() {
+    struct signalfd_siginfo info;
+    while(read(signalFd_, &info, sizeof(info)) == sizeof(info)) {
+        if(drainSignal_ == info.ssi_signo) {
+            LOG_WARN("Signal %u again, stop without waiting for %d connections", info.ssi_signo,
+                        (int)HttpConn::userCount);
+            isClose_ = true;
+            return;
+        }
+        if(drainSignal_ != 0) { continue; }
+        drainSignal_ = info.ssi_signo;
+        LOG_INFO("Signal %u received, draining, deadline: %dms", info.ssi_signo, drainTimeoutMs_);
+        BeginDrain_(true);  // 热重启交接后已在排空时只是记下信号
+    }
+}
+
+/*
+ * 开始排空：停止接受新连接，之后生成的响应都带Connection: close，发完即关闭
+ * 空闲的长连接在宽限期后关闭；全部连接关闭或到达期限后Start返回
+ * acceptBacklog为true时先接受完监听队列中已完成握手的连接，关闭监听套接字时它们不会被重置
+ */
+void WebServer::BeginDrain_(bool acceptBacklog) {
+    if(draining_) { return; }
+    if(acceptBacklog && listenFd_ >= 0) {
+        for(int i = 0; i < MAX_FD / acceptBatch_ + 1; i++) {
+            DealListen_();
+            if(!acceptPending_) { break; }  // 队列已空
+        }
+    }
+    draining_ = true;
+    HttpConn::isDraining = true;
+    auto now = chrono::steady_clock::now();
+    drainDeadline_ = now + chrono::milliseconds(drainTimeoutMs_);
+    int graceMs = drainTimeoutMs_ / 2 < DRAIN_GRACE_MS ? drainTimeoutMs_ / 2 : DRAIN_GRACE_MS;
+    drainIdleAt_ = now + chrono::milliseconds(graceMs);
+    if(listenFd_ >= 0) {
+        epoller_->DelFd(listenFd_);
+        close(listenFd_);
+        listenFd_ = -1;
+    }
+    acceptPending_ = false;
+}
+
+bool WebServer::CheckDrain_(int* timeMS) {
+    auto now = chrono::steady_clock::now();
+    if(!idleClosed_ && now >= drainIdleAt_) { CloseIdle_(); }
+    if(HttpConn::userCount == 0 || now >= drainDeadline_) {
+        LOG_INFO("Drain finished, %d connections left", (int)HttpConn::userCount);
+        return true;
+    }
+    auto wake = idleClosed_ ? drainDeadline_ : drainIdleAt_;
+    int drainMS = static_cast<int>(chrono::duration_cast<chrono::milliseconds>(wake - now).count()) + 1;
+    if(*timeMS < 0 || drainMS < *timeMS) { *timeMS = drainMS; }
+    return false;
+}
+
+/* 响应已发完、没有未处理数据的连接；刚建立、请求只收到一部分的连接继续处理 */
+void WebServer::CloseIdle_() {
+    idleClosed_ = true;
+    for(int fd = 0; fd < users_.Capacity(); fd++) {
+        HttpConn* client = users_.Get(fd);
+        if(client && users_.State(fd) == CONN_IDLE && client->RequestCount() > 0 && !client->HasPendingRequest()
+           && users_.Begin(fd, CONN_CLOSING)) {
+            CloseConn_(client);
+        }
     }
 }
 
+/* 清理过期会话，并以同一id重新挂上定时器 */
+void WebServer::SweepSession_() {
+    SessionStore::Instance()->Expire();
+    timer_->add(SESSION_TIMER_ID, sessionSweepMs_, std::bind(&WebServer::SweepSession_, this));
+}
+
+/* 回收限流表中没有连接、令牌已补满的槽 */
+void WebServer::SweepIpLimit_() {
+    size_t used = ipLimiter_->Sweep();
+    LOG_DEBUG("IpLimit slots in use: %zu", used);
+    timer_->add(IP_LIMIT_TIMER_ID, ipSweepMs_, std::bind(&WebServer::SweepIpLimit_, this));
+}
+
 void WebServer::SendError_(int fd, const char*info) {
     assert(fd > 0);
-    int ret = send(fd, info, strlen(info), 0);  // 直接发送字符串信息？不应该是一个http响应吗
+    int ret = send(fd, info, strlen(info), 0);  // info为完整的HTTP响应(503、429)，发完即关闭
     if(ret < 0) {
         LOG_WARN("send error to client[%d] error!", fd);
     }
     close(fd);  // 关闭该连接
 }
 
+/* 调用者必须持有连接(状态为CLOSING) */
 void WebServer::CloseConn_(HttpConn* client) {
-    assert(client);
+    assert(client && users_.State(client->GetFd()) == CONN_CLOSING);
     LOG_INFO("Client[%d] quit!", client->GetFd());
-    epoller_->DelFd(client->GetFd());  // 从epoll中移除
+    int fd = client->GetFd();
+    if(ipLimiter_ && client->IsIpCounted()) { ipLimiter_->ReleaseConn(client->GetAddr()); }
+    CountReuse_(client);
+    epoller_->DelFd(fd);  // 从epoll中移除
     client->Close();
+    users_.Release(fd);  // 归还之后才能被复用同一fd的新连接使用
 }
 
-void WebServer::AddClient_(int fd, sockaddr_in addr) {
+void WebServer::CountReuse_(HttpConn* client) {
+    int n = client->RequestCount();
+    int bucket = n;
+    if(n > 2) {
+        for(bucket = 3; bucket < REUSE_BUCKETS - 1 && n > (2 << (bucket - 2)); bucket++) {}
+    }
+    reuseHist_[bucket]++;
+    closedConns_++;
+    servedRequests_ += n;
+    if(HttpConn::keepAliveMax > 0 && n >= HttpConn::keepAliveMax) { maxRequestCloses_++; }
+}
+
+/* 预算内反复epoll_wait(0)，期间有事件就省掉一次睡眠与唤醒；自旋的时间从阻塞超时中扣除，不推迟定时器 */
+int WebServer::Wait_(int timeMS) {
+    if(!busyPoll_ || timeMS == 0) { return epoller_->Wait(timeMS); }
+    int64_t budget = busyPoll_->Budget();
+    if(timeMS > 0) { budget = min<int64_t>(budget, static_cast<int64_t>(timeMS) * 1000); }
+    int64_t start = BusyPoll::NowUs();
+    int64_t now = start;
+    int eventCnt = 0;
+    while(now - start < budget) {
+        eventCnt = epoller_->Wait(0);
+        now = BusyPoll::NowUs();
+        if(eventCnt != 0) {
+            busyPoll_->OnHit(now - start);
+            return eventCnt;
+        }
+    }
+    int remain = timeMS < 0 ? -1 : max(timeMS - static_cast<int>((now - start) / 1000), 0);
+    eventCnt = epoller_->Wait(remain);
+    busyPoll_->OnBlock(now - start, BusyPoll::NowUs() - now, eventCnt > 0);  // 预算为0时同样据此恢复
+    return eventCnt;
+}
+
+void WebServer::LogReuse_() {
+    if(closedConns_ == 0) { return; }
+    string hist;
+    for(int i = 0; i < REUSE_BUCKETS; i++) {
+        /* 桶i(i>=3)的范围是 (2^(i-2), 2^(i-1)]，最后一个桶没有上限 */
+        string label = to_string(i);
+        if(i > 2) {
+            label = to_string((1 << (i - 2)) + 1) + (i == REUSE_BUCKETS - 1 ? "+" : "-" + to_string(1 << (i - 1)));
+        }
+        hist += " " + label + ":" + to_string(reuseHist_[i]);
+    }
+    LOG_INFO("KeepAlive conns: %zu, requests: %zu, per conn: %.2f, max request closes: %zu",
+                closedConns_, servedRequests_, (double)servedRequests_ / closedConns_, maxRequestCloses_);
+    LOG_INFO("KeepAlive requests per conn:%s", hist.c_str());
+}
+
+void WebServer::AddClient_(int fd, sockaddr_in addr, bool ipCounted) {
     assert(fd > 0);
-    users_[fd].init(fd, addr);  // 客户端连接初始化
+    HttpConn* client = users_.Open(fd);
+    if(!client) {
+        if(ipCounted) { ipLimiter_->ReleaseConn(addr); }
+        SendError_(fd, busyResponse_.c_str());
+        LOG_WARN("Client fd[%d] exceeds connection table!", fd);
+        return;
+    }
+    client->init(fd, addr);  // 客户端连接初始化
+    client->SetIpCounted(ipCounted);
     if(timeoutMS_ > 0) {
-        timer_->add(fd, timeoutMS_, std::bind(&WebServer::CloseConn_, this, &users_[fd]));
+        /* 连接可能先因其他原因关闭、fd被复用，用代数识别过期的定时器 */
+        uint32_t gen = users_.Gen(fd);
+        timer_->add(fd, timeoutMS_, [this, fd, gen] { RequestClose_(fd, gen); });
     }
-    epoller_->AddFd(fd, EPOLLIN | connEvent_);  // 添加到epoll中，监听读事件
-    SetFdNonblock(fd);
-    LOG_INFO("Client[%d] in!", users_[fd].GetFd());
+    epoller_->AddFd(fd, EPOLLIN | connEvent_);  // fd在accept4时已设为非阻塞，注册后即可被工作线程读写
+    LOG_INFO("Client[%d] in!", client->GetFd());
 }
 
 // 处理客户端连接事件
+/* 每轮最多接受acceptBatch_个连接；没接受完(ET模式下不会再通知)时置acceptPending_，下一轮继续 */
 void WebServer::DealListen_() {
     struct sockaddr_in addr;  // 保存连接的客户端的信息 
-    socklen_t len = sizeof(addr);
-    do {
-        int fd = accept(listenFd_, (struct sockaddr *)&addr, &len);
-        if(fd <= 0) { return;}  // 非阻塞模式下，accept没有可接受连接时不会阻塞而是立马返回，在此处判断后跳出循环
-        else if(HttpConn::userCount >= MAX_FD) {  // 最大连接数满了
-            SendError_(fd, "Server busy!");  // 向客户端写一个服务器忙的信息
+    acceptPending_ = false;
+    for(int i = 0; i < acceptBatch_; i++) {
+        socklen_t len = sizeof(addr);
+        /* 一次系统调用完成accept与设置非阻塞、close-on-exec */
+        int fd = accept4(listenFd_, (struct sockaddr *)&addr, &len, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0) {
+            if(errno == EINTR || errno == ECONNABORTED) { continue; }
+            if(errno == EMFILE || errno == ENFILE) {
+                /* fd耗尽：监听队列里的连接在ET模式下不会再通知，释放预留fd接受一个并回503，其余下一次继续 */
+                if(reserveFd_ >= 0) {
+                    close(reserveFd_);
+                    fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+                    if(fd >= 0) { SendError_(fd, busyResponse_.c_str()); }
+                    reserveFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                }
+                LOG_WARN("Accept error: fd exhausted!");
+                if(fd >= 0) { continue; }
+                acceptPending_ = true;  // 预留fd也不可用，稍后重试
+                acceptRetryAt_ = chrono::steady_clock::now() + chrono::milliseconds(ACCEPT_RETRY_MS);
+            }
+            return;  // EAGAIN：队列已空
+        }
+        if(HttpConn::userCount >= MAX_FD) {  // 最大连接数满了
+            SendError_(fd, busyResponse_.c_str());  // 回503
             LOG_WARN("Clients is full!");  // 记录日志
-            return;
+            continue;
+        }
+        if(admission_ && !admission_->AdmitConnection()) {  // 过载时新连接最先被拒绝
+            SendError_(fd, busyResponse_.c_str());
+            continue;
+        }
+        bool ipCounted = false;
+        if(ipLimiter_ && !ipLimiter_->AcquireConn(addr, &ipCounted)) {  // 该IP的连接数已满
+            SendError_(fd, limitResponse_.c_str());
+            continue;
         }
-        AddClient_(fd, addr);  // 添加客户端fd到httpconn的users、epoll监听的数据结构中
-    } while(listenEvent_ & EPOLLET);  // ET模式，需要保证一次处理完，所以采用while循环不断调用accept接受listenFd上的连接，直到都接受完毕accept返回<=0后才return;
+        AddClient_(fd, addr, ipCounted);  // 添加客户端fd到连接表、epoll监听的数据结构中
+    }
+    acceptPending_ = true;
+}
+
+/* 事件循环与定时器要求关闭：连接空闲时立即关闭，正在处理时由持有者处理完后关闭 */
+void WebServer::RequestClose_(int fd, uint32_t gen) {
+    if(users_.RequestClose(fd, gen)) {
+        CloseConn_(users_.Get(fd));
+    }
+}
+
+/* 工作线程处理完毕，把连接交还事件循环，之后不能再访问连接对象；events为0表示关闭 */
+void WebServer::Post_(HttpConn* client, uint32_t events) {
+    completions_.Push(users_.Post(client->GetFd(), events));
+}
+
+/* 事件循环中执行：重新注册事件或关闭，处理期间收到的关闭请求在这里生效 */
+void WebServer::OnCompletion_(Completion* done) {
+    HttpConn* client = users_.Get(done->fd);
+    assert(client);
+    if(!users_.Finish(done->fd, done->events)) {
+        CloseConn_(client);
+        return;
+    }
+    if(idleClosed_ && done->events == EPOLLIN && client->RequestCount() > 0 && !client->HasPendingRequest()) {
+        users_.Switch(done->fd, CONN_CLOSING);  // 排空宽限期已过，响应发完不再等待下一个请求
+        CloseConn_(client);
+        return;
+    }
+    if(done->events == EPOLLIN && timeoutMS_ > 0 && client->RequestCount() > 0 && !client->HasPendingRequest()) {
+        timer_->adjust(done->fd, keepAliveIdleMs_);  // 响应已发完，等待下一个请求
+    } else {
+        ExtentTime_(client);
+    }
+    epoller_->ModFd(done->fd, connEvent_ | done->events);
 }
 
 void WebServer::DealRead_(HttpConn* client) {
     assert(client);
+    if(!users_.Begin(client->GetFd(), CONN_READING)) { return; }  // 正在关闭
+    if(ipLimiter_ && !ipLimiter_->AllowRequest(client->GetAddr())) {
+        RejectRequest_(client);
+        return;
+    }
     ExtentTime_(client);  // 延长关闭连接的时间
-    threadpool_->AddTask(std::bind(&WebServer::OnRead_, this, client));  // 任务队列添加读任务
+    if(fastPath_) {
+        ReadInline_(client);
+        return;
+    }
+    Dispatch_(client, &WebServer::OnRead_, true);  // 任务队列添加读任务
 }
 
 void WebServer::DealWrite_(HttpConn* client) {
     assert(client);
+    if(!users_.Begin(client->GetFd(), CONN_WRITING)) { return; }
     ExtentTime_(client);  // 延长关闭连接的时间
-    threadpool_->AddTask(std::bind(&WebServer::OnWrite_, this, client));  // 任务队列添加写任务
+    Dispatch_(client, &WebServer::OnWrite_, false);  // 任务队列添加写任务，发送中的响应不丢弃
+}
+
+/* 开启准入控制时记录入队时间，工作线程取出时据排队时间决定是否丢弃 */
+void WebServer::Dispatch_(HttpConn* client, void (WebServer::*handler)(HttpConn*), bool sheddable) {
+    if(!admission_) {
+        threadpool_->AddTask(std::bind(handler, this, client));
+        return;
+    }
+    admission_->OnEnqueue();
+    threadpool_->AddTask([this, client, handler, sheddable, enqueued = AdmissionControl::NowUs()] {
+        if(admission_->OnDequeue(enqueued, client->RequestCount() == 0, sheddable)) {
+            Shed_(client);
+            return;
+        }
+        (this->*handler)(client);
+    });
+}
+
+void WebServer::Shed_(HttpConn* client) {
+    int readErrno = 0;
+    client->read(&readErrno);  // 先读走请求，接收缓冲区有未读数据时close会发RST，客户端可能收不到503
+    ssize_t ret = send(client->GetFd(), busyResponse_.data(), busyResponse_.size(), MSG_NOSIGNAL);
+    (void)ret;
+    Post_(client, 0);
+}
+
+void WebServer::RejectRequest_(HttpConn* client) {
+    int fd = client->GetFd();
+    int readErrno = 0;
+    client->read(&readErrno);  // 与Shed_相同，先读走请求
+    ssize_t ret = send(fd, limitResponse_.data(), limitResponse_.size(), MSG_NOSIGNAL);
+    (void)ret;
+    users_.Switch(fd, CONN_CLOSING);
+    CloseConn_(client);
 }
 
 void WebServer::ExtentTime_(HttpConn* client) {  // 调用定时器调整关闭操作的到期时间
@@ -175,116 +758,231 @@ void WebServer::ExtentTime_(HttpConn* client) {  // 调用定时器调整关闭
     if(timeoutMS_ > 0) { timer_->adjust(client->GetFd(), timeoutMS_); }
 }
 
+/*
+ * 事件循环中读取并判断请求开销：缓存命中的小文件GET直接解析、生成响应并尝试写出，
+ * 省去两次线程切换与完成队列；未命中、POST、请求不完整等交给线程池处理
+ */
+void WebServer::ReadInline_(HttpConn* client) {
+    int fd = client->GetFd();
+    int readErrno = 0;
+    ssize_t ret = client->read(&readErrno);
+    if(ret <= 0 && readErrno != EAGAIN) {
+        users_.Switch(fd, CONN_CLOSING);
+        CloseConn_(client);
+        return;
+    }
+    string path;
+    bool cheap = client->IsCheapRequest(fastPathMaxBytes_, &path);
+    CountRoute_(path, cheap);
+    if(!cheap) {
+        Dispatch_(client, &WebServer::OnProcess, true);
+        return;
+    }
+    users_.Switch(fd, CONN_PROCESSING);
+    if(!client->process()) {
+        OnCompletion_(users_.Post(fd, EPOLLIN));
+        return;
+    }
+    users_.Switch(fd, CONN_WRITING);
+    int writeErrno = 0;
+    ret = client->write(&writeErrno);
+    uint32_t events = 0;
+    if(client->ToWriteBytes() == 0) {
+        if(client->IsKeepAlive()) {
+            if(client->HasPendingRequest()) {  // 流水线上的后续请求交给线程池
+                Dispatch_(client, &WebServer::OnProcess, true);
+                return;
+            }
+            events = EPOLLIN;
+        }
+    } else if(ret < 0 && writeErrno == EAGAIN) {
+        events = EPOLLOUT;  // 发送缓冲区满，剩余部分由线程池写
+    }
+    OnCompletion_(users_.Post(fd, events));
+}
+
+void WebServer::CountRoute_(const string& path, bool isInline) {
+    static const string OTHER = "other";
+    bool known = !path.empty() && (routes_.size() < ROUTE_MAX || routes_.count(path));
+    RouteStat& stat = routes_[known ? path : OTHER];
+    if(isInline) { stat.reactor++; }
+    else { stat.pool++; }
+    LOG_DEBUG("Route %s: %s", (known ? path : OTHER).c_str(), isInline ? "reactor" : "pool");
+}
+
 void WebServer::OnRead_(HttpConn* client) {
     assert(client);
     int ret = -1;
     int readErrno = 0;
     ret = client->read(&readErrno);  // 读取客户端数据
     if(ret <= 0 && readErrno != EAGAIN) {
-        CloseConn_(client);
+        Post_(client, 0);
         return;
     }
     OnProcess(client);  // 业务逻辑的处理
 }
 
 void WebServer::OnProcess(HttpConn* client) {
-    if(client->process()) {
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);  // connEvent_存放的是事件的触发方式（ET OR LT），使用|运算符在设置事件的同时快速设置事件的触发方式
-    } else {
-        epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLIN);
+    /* 生成响应后立即尝试写出，多数响应一次写完，不必先注册EPOLLOUT再等一轮事件循环与一次任务分发 */
+    for(;;) {
+        users_.Switch(client->GetFd(), CONN_PROCESSING);
+        if(client->process()) {
+            if(!Write_(client)) { return; }
+            continue;  // 保持连接，继续处理读缓冲区中的后续请求
+        }
+        if(client->IsVerifyPending()) {
+            VerifyAsync_(client);  // 等待期间仍持有连接，关闭请求延后到认证完成
+        } else {
+            Post_(client, EPOLLIN);
+        }
+        return;
     }
 }
 
+void WebServer::VerifyAsync_(HttpConn* client) {
+    assert(sqlAsync_);
+    int fd = client->GetFd();
+    const HttpRequest& request = client->GetRequest();
+    HttpRequest::UserVerifyAsync(sqlAsync_.get(), request.GetPost("username"), request.GetPost("password"),
+        request.IsLoginVerify(), [this, client, fd, gen = users_.Gen(fd)](bool success) {
+            /* 回调在事件循环线程中执行，生成响应要读文件，交回线程池 */
+            threadpool_->AddTask([this, client, fd, gen, success] {
+                if(users_.Get(fd, gen) != client || !client->IsVerifyPending()) {
+                    return;  // 等待期间连接已关闭
+                }
+                client->ResumeVerify(success);
+                if(Write_(client)) { OnProcess(client); }
+            });
+        });
+}
+
 void WebServer::OnWrite_(HttpConn* client) {
     assert(client);
-    int ret = -1;
+    if(Write_(client)) {
+        OnProcess(client);
+    }
+}
+
+/* 写出响应：写完且保持连接时返回true，由调用者继续处理；否则连接已交还事件循环(继续写或关闭) */
+bool WebServer::Write_(HttpConn* client) {
+    users_.Switch(client->GetFd(), CONN_WRITING);
     int writeErrno = 0;
-    ret = client->write(&writeErrno);
+    ssize_t ret = client->write(&writeErrno);
     if(client->ToWriteBytes() == 0) {
         /* 传输完成 */
-        if(client->IsKeepAlive()) {
-            OnProcess(client);
-            return;
-        }
+        if(client->IsKeepAlive()) { return true; }
     }
-    else if(ret < 0) {
-        if(writeErrno == EAGAIN) {
-            /* 继续传输 */
-            epoller_->ModFd(client->GetFd(), connEvent_ | EPOLLOUT);
-            return;
-        }
+    else if(ret < 0 && writeErrno == EAGAIN) {
+        /* 发送缓冲区满，等待可写后继续传输 */
+        Post_(client, EPOLLOUT);
+        return false;
     }
-    CloseConn_(client);
+    Post_(client, 0);
+    return false;
 }
 
 /* Create listenFd */
-bool WebServer::InitSocket_() {
+/* 创建监听套接字，失败返回-1；多进程模式下主进程也用它创建供工作进程继承的套接字 */
+int WebServer::Listen(int port, bool optLinger, const Config& config) {
     int ret;
     struct sockaddr_in addr;
-    if(port_ > 65535 || port_ < 1024) {
-        LOG_ERROR("Port:%d error!",  port_);
-        return false;
+    if(port > 65535 || port < 1024) {
+        LOG_ERROR("Port:%d error!",  port);
+        return -1;
     }
     addr.sin_family = AF_INET;
     addr.sin_addr.s_addr = htonl(INADDR_ANY);
-    addr.sin_port = htons(port_);
-    struct linger optLinger = { 0 };
-    if(openLinger_) {
+    addr.sin_port = htons(port);
+    struct linger lingerOpt = { 0 };
+    if(optLinger) {
         /* 优雅关闭: 直到所剩数据发送完毕或超时 */
-        optLinger.l_onoff = 1;
-        optLinger.l_linger = 1;
+        lingerOpt.l_onoff = 1;
+        lingerOpt.l_linger = 1;
     }
 
-    listenFd_ = socket(AF_INET, SOCK_STREAM, 0);
-    if(listenFd_ < 0) {
-        LOG_ERROR("Create socket error!", port_);
-        return false;
+    int listenFd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(listenFd < 0) {
+        LOG_ERROR("Create socket error!", port);
+        return -1;
     }
 
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_LINGER, &optLinger, sizeof(optLinger));
+    ret = setsockopt(listenFd, SOL_SOCKET, SO_LINGER, &lingerOpt, sizeof(lingerOpt));
     if(ret < 0) {
-        close(listenFd_);
-        LOG_ERROR("Init linger error!", port_);
-        return false;
+        close(listenFd);
+        LOG_ERROR("Init linger error!", port);
+        return -1;
     }
 
     int optval = 1;
     /* 端口复用 */
     /* 只有最后一个套接字会正常接收数据。 */
-    ret = setsockopt(listenFd_, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
+    ret = setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, (const void*)&optval, sizeof(int));
     if(ret == -1) {
         LOG_ERROR("set socket setsockopt error !");
-        close(listenFd_);
-        return false;
+        close(listenFd);
+        return -1;
+    }
+    /* 多个进程各自绑定同一端口，内核按连接的四元组哈希分给其中一个 */
+    if(config.listenReusePort && setsockopt(listenFd, SOL_SOCKET, SO_REUSEPORT, &optval, sizeof(int)) < 0) {
+        LOG_ERROR("set SO_REUSEPORT error!");
+        close(listenFd);
+        return -1;
     }
 
-    ret = bind(listenFd_, (struct sockaddr *)&addr, sizeof(addr));
+    ret = bind(listenFd, (struct sockaddr *)&addr, sizeof(addr));
     if(ret < 0) {
-        LOG_ERROR("Bind Port:%d error!", port_);
-        close(listenFd_);
-        return false;
+        LOG_ERROR("Bind Port:%d error!", port);
+        close(listenFd);
+        return -1;
     }
 
-    ret = listen(listenFd_, 6);
+    /* 可选优化，内核不支持时只记录警告 */
+    if(config.deferAcceptSec > 0 && setsockopt(listenFd, IPPROTO_TCP, TCP_DEFER_ACCEPT,
+                                               &config.deferAcceptSec, sizeof(int)) < 0) {
+        LOG_WARN("set TCP_DEFER_ACCEPT error!");
+    }
+    if(config.fastOpenQueue > 0 && setsockopt(listenFd, IPPROTO_TCP, TCP_FASTOPEN,
+                                              &config.fastOpenQueue, sizeof(int)) < 0) {
+        LOG_WARN("set TCP_FASTOPEN error!");
+    }
+
+    /* 已连接的套接字从监听套接字复制，同样带上该选项 */
+    if(config.busyPollSocketUs > 0 && setsockopt(listenFd, SOL_SOCKET, SO_BUSY_POLL,
+                                                 &config.busyPollSocketUs, sizeof(int)) < 0) {
+        LOG_WARN("set SO_BUSY_POLL error!");
+    }
+
+    ret = listen(listenFd, config.listenBacklog > 0 ? config.listenBacklog : SOMAXCONN);
     if(ret < 0) {
-        LOG_ERROR("Listen port:%d error!", port_);
-        close(listenFd_);
-        return false;
+        LOG_ERROR("Listen port:%d error!", port);
+        close(listenFd);
+        return -1;
+    }
+    SetFdNonblock(listenFd);  // 先设为非阻塞再注册，注册后随时可能被通知
+    return listenFd;
+}
+
+bool WebServer::InitSocket_(const Config& config, int inheritedFd) {
+    /* 从主进程或旧进程继承的套接字已在监听，选项由创建者设置 */
+    listenFd_ = inheritedFd >= 0 ? inheritedFd : Listen(port_, openLinger_, config);
+    if(listenFd_ < 0) { return false; }
+    uint32_t event = listenEvent_ | EPOLLIN;
+    if(config.listenExclusive) {
+        event = (event & (EPOLLIN | EPOLLET)) | EPOLLEXCLUSIVE;  // 不能与EPOLLONESHOT、EPOLLRDHUP同时使用
     }
-    ret = epoller_->AddFd(listenFd_,  listenEvent_ | EPOLLIN);
+    int ret = epoller_->AddFd(listenFd_, event);
     if(ret == 0) {
         LOG_ERROR("Add listen error!");
         close(listenFd_);
         return false;
     }
-    SetFdNonblock(listenFd_);
     LOG_INFO("Server port:%d", port_);
     return true;
 }
 
 int WebServer::SetFdNonblock(int fd) {
     assert(fd > 0);
-    return fcntl(fd, F_SETFL, fcntl(fd, F_GETFD, 0) | O_NONBLOCK);
+    return fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
 }
 
 
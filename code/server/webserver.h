@@ -7,20 +7,38 @@
 #define WEBSERVER_H
 
 #include <unordered_map>
+#include <chrono>
 #include <fcntl.h>       // fcntl()
 #include <unistd.h>      // close()
 #include <assert.h>
 #include <errno.h>
+#include <limits.h>      // INT_MAX
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <netinet/tcp.h>    // TCP_DEFER_ACCEPT, TCP_FASTOPEN
 #include <arpa/inet.h>
+#include <signal.h>
+#include <sys/signalfd.h>  // signalfd()
 
 #include "epoller.h"
+#include "connslab.h"
+#include "admission.h"
+#include "iplimiter.h"
+#include "cpuaffinity.h"
+#include "busypoll.h"
+#include "prefork.h"
+#include "hotrestart.h"
+#include "../config/config.h"
 #include "../log/log.h"
+#include "../log/accesslog.h"
 #include "../timer/heaptimer.h"
 #include "../pool/sqlconnpool.h"
 #include "../pool/threadpool.h"
 #include "../pool/sqlconnRAII.h"
+#include "../pool/sqlasyncpool.h"
+#include "../pool/sqlbatchwriter.h"
+#include "../pool/redisasync.h"
+#include "../store/mmapuserstore.h"
 #include "../http/httpconn.h"
 
 class WebServer {
@@ -29,15 +47,19 @@ public:
         int port, int trigMode, int timeoutMS, bool OptLinger, 
         int sqlPort, const char* sqlUser, const  char* sqlPwd, 
         const char* dbName, int connPoolNum, int threadNum,
-        bool openLog, int logLevel, int logQueSize);
+        bool openLog, int logLevel, int logQueSize,
+        const Config& config = Config());
 
     ~WebServer();
     void Start();
 
+    /* 创建监听套接字(非阻塞)，失败返回-1 */
+    static int Listen(int port, bool optLinger, const Config& config);
+
 private:
-    bool InitSocket_();  // socket初始化
+    bool InitSocket_(const Config& config, int inheritedFd);  // socket初始化，inheritedFd为已在监听的套接字
     void InitEventMode_(int trigMode);  // 事件触发模式设置
-    void AddClient_(int fd, sockaddr_in addr);  // 添加客户端连接
+    void AddClient_(int fd, sockaddr_in addr, bool ipCounted);  // 添加客户端连接，ipCounted为是否计入了按IP的连接数
   
     void DealListen_();  // 处理新连接
     void DealWrite_(HttpConn* client);  // 处理客户端写事件, 是将写事件的处理函数OnWrite和参数添加到任务队列
@@ -45,21 +67,66 @@ private:
 
     void SendError_(int fd, const char*info);  
     void ExtentTime_(HttpConn* client);
+    void Dispatch_(HttpConn* client, void (WebServer::*handler)(HttpConn*), bool sheddable);  // 提交到线程池
+    void Shed_(HttpConn* client);  // 过载时丢弃排队过久的请求
+    void RejectRequest_(HttpConn* client);  // 事件循环中回429并关闭
     void CloseConn_(HttpConn* client);
+    void CountReuse_(HttpConn* client);  // 记录连接上处理过的请求数
+    void LogReuse_();
+    void RequestClose_(int fd, uint32_t gen);  // 非持有者要求关闭连接
+    void Post_(HttpConn* client, uint32_t events);  // 工作线程交还连接
+    void OnCompletion_(Completion* done);  // 事件循环处理交还的连接
 
     void OnRead_(HttpConn* client);  // 具体的读事件处理函数：调用client对象的read函数，将内核读缓冲区数据读到readbuffer中
     void OnWrite_(HttpConn* client);  // 具体的写事件处理函数：调用client对象的write函数（个人理解 待定）
-    void OnProcess(HttpConn* client);  // 调用client对象的process事件进行处理, 并改变文件描述符监听事件
+    void OnProcess(HttpConn* client);  // 调用client对象的process事件进行处理, 并立即尝试写出响应
+    bool Write_(HttpConn* client);  // 写出响应，只有发送缓冲区满时才注册EPOLLOUT
+    void VerifyAsync_(HttpConn* client);  // 提交异步认证，完成后再生成响应
+    void ReadInline_(HttpConn* client);  // 事件循环中读取，廉价请求直接应答，其余交给线程池
+    void CountRoute_(const std::string& path, bool isInline);  // 记录请求走了哪条路径
+    void SweepSession_();  // 定时清理过期会话
+    void SweepIpLimit_();  // 定时回收限流表中的空闲槽
+    int Wait_(int timeMS);  // 开启忙轮询时先自旋再阻塞
+    void DealHotRestart_(int fd);  // 控制套接字事件
+    void BeginDrain_(bool acceptBacklog);  // 停止接受连接，处理完已有请求后退出事件循环
+    bool CheckDrain_(int* timeMS);  // 排空期间每轮检查，返回true时退出事件循环
+    void CloseIdle_();  // 关闭空闲的长连接
+    void DealSignal_();  // SIGTERM、SIGINT
 
     static const int MAX_FD = 65536;
+    static const int RESERVED_FD = 1024;  // 监听、日志、数据库等非客户端fd占用的编号余量
+    static const int SESSION_TIMER_ID = INT_MAX;  // 会话清理定时器的id，不会与连接fd冲突
+    static const int IP_LIMIT_TIMER_ID = INT_MAX - 1;
+    static const int REUSE_BUCKETS = 10;  // 每连接请求数分布：0,1,2,3-4,5-8,...,129+
+    static const size_t ROUTE_MAX = 1024;  // 分路径计数的路径数上限，其余计入"other"
+    static const int DRAIN_GRACE_MS = 1000;  // 开始排空后空闲长连接再保留这么久，接住已在路上的请求
+    static const int ACCEPT_RETRY_MS = 100;  // fd耗尽且没有预留fd可用时，隔这么久再重试accept
 
     static int SetFdNonblock(int fd);
+    static void ResolveCpus_(const Config& config, std::vector<int>* reactor, std::vector<int>* workers);
 
     int port_;
     bool openLinger_;
     int timeoutMS_;  /* 毫秒MS */
+    int keepAliveIdleMs_;  // 请求之间的空闲超时
+    int sessionSweepMs_;  // 会话清理间隔，0表示未开启会话
+    int ipSweepMs_;  // 限流表回收间隔，0表示未开启限流
+    bool fastPath_;  // 廉价请求在事件循环中直接完成
+    size_t fastPathMaxBytes_;
     bool isClose_;
     int listenFd_;  // 用于监听的文件描述符
+    std::vector<int> reactorCpus_;  // Start时绑定事件循环线程，空为不绑定
+    int acceptBatch_;  // 每轮最多接受的连接数
+    bool acceptPending_;  // 上一轮未接受完，本轮不阻塞继续接受
+    std::chrono::steady_clock::time_point acceptRetryAt_;  // fd耗尽后到这个时间再继续接受
+    int reserveFd_;  // 预留的fd，fd耗尽时释放它来接受并拒绝一个连接，不让连接堆在监听队列里
+    bool draining_;  // 已停止接受连接，等待已有连接处理完
+    bool idleClosed_;  // 排空期间已关闭空闲长连接
+    int drainTimeoutMs_;
+    std::chrono::steady_clock::time_point drainIdleAt_;  // 到这个时间关闭空闲长连接
+    std::chrono::steady_clock::time_point drainDeadline_;
+    int signalFd_;  // 接收SIGTERM、SIGINT
+    uint32_t drainSignal_;  // 触发排空的信号，0为还没有收到
     char* srcDir_;
     
     uint32_t listenEvent_;
@@ -68,7 +135,30 @@ private:
     std::unique_ptr<HeapTimer> timer_;  // unique_ptr指针包装定时器
     std::unique_ptr<ThreadPool> threadpool_;  // unique_ptr指针包装线程池
     std::unique_ptr<Epoller> epoller_;  // unique_ptr指针包装Epoller
-    std::unordered_map<int, HttpConn> users_;  // 记录文件描述符fd和对应的http连接对象的哈希表
+    std::unique_ptr<SqlAsyncPool> sqlAsync_;  // 异步数据库连接池，未开启时为空
+    std::unique_ptr<RedisAsync> redisAsync_;  // 异步Redis客户端，未开启时为空
+    std::unique_ptr<MmapUserStore> userStore_;  // 嵌入式用户存储，未开启时使用MySQL
+    std::unique_ptr<AdmissionControl> admission_;  // 准入控制，未开启时为空
+    std::string busyResponse_;  // 503响应
+    std::unique_ptr<IpLimiter> ipLimiter_;  // 按IP限流，未开启时为空
+    std::string limitResponse_;  // 429响应
+    std::unique_ptr<BusyPoll> busyPoll_;  // 自适应忙轮询，未开启时为空
+    std::unique_ptr<HotRestart> hotRestart_;  // 热重启控制套接字，未开启时为空
+    CompletionQueue completions_;  // 工作线程 -> 事件循环
+    ConnSlab users_;  // 以fd为下标的连接表，对象地址固定
+
+    /* 每个路径在事件循环中直接完成与交给线程池的次数，只在事件循环线程中访问 */
+    struct RouteStat {
+        size_t reactor = 0;
+        size_t pool = 0;
+    };
+    std::unordered_map<std::string, RouteStat> routes_;
+
+    /* 长连接复用统计，只在事件循环线程中访问 */
+    size_t reuseHist_[REUSE_BUCKETS] = { 0 };  // 关闭时连接上处理过的请求数分布
+    size_t closedConns_ = 0;
+    size_t servedRequests_ = 0;
+    size_t maxRequestCloses_ = 0;  // 因达到单连接请求数上限而关闭
 };
 
 
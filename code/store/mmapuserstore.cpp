@@ -0,0 +1,291 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#include "mmapuserstore.h"
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <libgen.h>
+#include <mutex>
+#include "../log/log.h"
+using namespace std;
+
+const size_t MmapUserStore::MAX_NAME;
+const size_t MmapUserStore::MAX_PWD;
+const size_t MmapUserStore::HEADER_SIZE;
+const uint32_t MmapUserStore::VERSION;
+const char MmapUserStore::MAGIC[8] = {'W', 'S', 'U', 'S', 'E', 'R', 'S', '\0'};
+
+MmapUserStore::MmapUserStore(): lockFd_(-1), fd_(-1), base_(nullptr), capacity_(0), count_(0), sync_(false) {
+    static_assert(sizeof(Slot) == 128, "slot must be 128 bytes");  // 4KB页内整数个槽
+}
+
+MmapUserStore::~MmapUserStore() {
+    Close();
+}
+
+/* 映射(必要时新建)存储文件，新建文件的槽全部为空 */
+bool MmapUserStore::Map_(const string& path, size_t capacity, bool create, int* fd, char** base) {
+    int flags = O_RDWR | O_CLOEXEC | (create ? O_CREAT | O_TRUNC : 0);
+    *fd = open(path.c_str(), flags, 0644);
+    if(*fd < 0) {
+        LOG_ERROR("UserStore open %s error: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    size_t len = HEADER_SIZE + capacity * sizeof(Slot);
+    if(create && ftruncate(*fd, len) < 0) {
+        LOG_ERROR("UserStore truncate %s error: %s", path.c_str(), strerror(errno));
+        close(*fd);
+        return false;
+    }
+    void* addr = mmap(nullptr, len, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+    if(addr == MAP_FAILED) {
+        LOG_ERROR("UserStore mmap %s error: %s", path.c_str(), strerror(errno));
+        close(*fd);
+        return false;
+    }
+    *base = static_cast<char*>(addr);
+    if(create) {
+        Header* header = reinterpret_cast<Header*>(*base);
+        memcpy(header->magic, MAGIC, sizeof(MAGIC));
+        header->version = VERSION;
+        header->slotSize = sizeof(Slot);
+        header->capacity = capacity;
+    }
+    return true;
+}
+
+bool MmapUserStore::Open(const string& path, size_t capacity, bool sync) {
+    Close();
+    unique_lock<shared_timed_mutex> locker(mtx_);
+    path_ = path;
+    sync_ = sync;
+    /* 进程内只有读写锁，多个进程同时写同一文件会互相覆盖，扩容改名后其他进程还在旧映射上写；
+       锁放在单独的文件上，扩容替换数据文件不影响锁 */
+    lockFd_ = open((path_ + ".lock").c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if(lockFd_ < 0 || flock(lockFd_, LOCK_EX | LOCK_NB) < 0) {
+        LOG_ERROR("UserStore %s is used by another process!", path_.c_str());
+        if(lockFd_ >= 0) { close(lockFd_); }
+        lockFd_ = -1;
+        return false;
+    }
+    unlink((path_ + ".tmp").c_str());  // 上次扩容中途崩溃留下的临时文件
+
+    struct stat st;
+    bool create = stat(path_.c_str(), &st) < 0 || st.st_size == 0;
+    if(create) {
+        size_t cap = 16;
+        while(cap < capacity) { cap <<= 1; }  // 槽数取2的幂，下标用位与
+        capacity_ = cap;
+    } else {
+        Header header;
+        int fd = open(path_.c_str(), O_RDONLY | O_CLOEXEC);
+        bool ok = fd >= 0 && pread(fd, &header, sizeof(header), 0) == sizeof(header);
+        if(fd >= 0) { close(fd); }
+        if(!ok || memcmp(header.magic, MAGIC, sizeof(MAGIC)) || header.version != VERSION
+           || header.slotSize != sizeof(Slot) || (header.capacity & (header.capacity - 1))
+           || static_cast<size_t>(st.st_size) != HEADER_SIZE + header.capacity * sizeof(Slot)) {
+            LOG_ERROR("UserStore %s is not a valid store file!", path_.c_str());
+            return false;
+        }
+        capacity_ = header.capacity;
+    }
+    if(!Map_(path_, capacity_, create, &fd_, &base_)) {
+        base_ = nullptr;
+        return false;
+    }
+
+    /* 校验所有槽，统计用户数 */
+    count_ = 0;
+    size_t broken = 0;
+    for(size_t i = 0; i < capacity_; i++) {
+        Slot* slot = SlotAt_(i);
+        if(slot->state == 0) { continue; }
+        if(slot->state == 1 && slot->nameLen <= MAX_NAME && slot->pwdLen <= MAX_PWD
+           && slot->check == Check_(*slot)) {
+            count_++;
+        } else {
+            broken++;
+        }
+    }
+    if(broken > 0) {
+        /* 直接清空坏槽会截断探测链，把有效数据重建到新文件 */
+        LOG_WARN("UserStore %s found %zu broken slots, rebuilding", path_.c_str(), broken);
+        if(!Rebuild_(capacity_)) { return false; }
+    }
+    LOG_INFO("UserStore %s opened, users: %zu, capacity: %zu", path_.c_str(), count_, capacity_);
+    return true;
+}
+
+void MmapUserStore::Unmap_() {
+    if(base_) {
+        munmap(base_, HEADER_SIZE + capacity_ * sizeof(Slot));
+        base_ = nullptr;
+    }
+    if(fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+void MmapUserStore::Close() {
+    unique_lock<shared_timed_mutex> locker(mtx_);
+    if(base_) {
+        msync(base_, HEADER_SIZE + capacity_ * sizeof(Slot), MS_SYNC);
+    }
+    Unmap_();
+    if(lockFd_ >= 0) {
+        close(lockFd_);  // 关闭即释放flock
+        lockFd_ = -1;
+    }
+}
+
+/* FNV-1a */
+uint32_t MmapUserStore::Hash_(const char* str, size_t len) {
+    uint32_t h = 2166136261u;
+    for(size_t i = 0; i < len; i++) {
+        h ^= static_cast<unsigned char>(str[i]);
+        h *= 16777619u;
+    }
+    return h;
+}
+
+uint32_t MmapUserStore::Check_(const Slot& slot) {
+    uint32_t h = Hash_(reinterpret_cast<const char*>(&slot.nameLen), 2);
+    h ^= Hash_(slot.name, slot.nameLen < MAX_NAME ? slot.nameLen : MAX_NAME);
+    h = h * 31 + Hash_(slot.pwd, slot.pwdLen < MAX_PWD ? slot.pwdLen : MAX_PWD);
+    return h;
+}
+
+/* 线性探测：找到同名槽时found为true，否则返回第一个空槽 */
+MmapUserStore::Slot* MmapUserStore::Find_(char* base, size_t capacity, const char* name,
+                                          size_t len, bool* found) {
+    Slot* slots = reinterpret_cast<Slot*>(base + HEADER_SIZE);
+    size_t mask = capacity - 1;
+    for(size_t i = Hash_(name, len) & mask; ; i = (i + 1) & mask) {
+        Slot* slot = slots + i;
+        if(__atomic_load_n(&slot->state, __ATOMIC_ACQUIRE) == 0) {
+            *found = false;
+            return slot;
+        }
+        if(slot->nameLen == len && memcmp(slot->name, name, len) == 0) {
+            *found = true;
+            return slot;
+        }
+    }
+}
+
+/* 把有效数据重建到capacity个槽的新文件，写完同步后rename替换原文件 */
+bool MmapUserStore::Rebuild_(size_t capacity) {
+    string tmp = path_ + ".tmp";
+    int fd;
+    char* base;
+    if(!Map_(tmp, capacity, true, &fd, &base)) {
+        return false;
+    }
+    size_t count = 0;
+    for(size_t i = 0; i < capacity_; i++) {
+        Slot* slot = SlotAt_(i);
+        if(slot->state != 1 || slot->nameLen > MAX_NAME || slot->pwdLen > MAX_PWD
+           || slot->check != Check_(*slot)) {
+            continue;
+        }
+        bool found;
+        Slot* dst = Find_(base, capacity, slot->name, slot->nameLen, &found);
+        if(found) { continue; }
+        *dst = *slot;
+        count++;
+    }
+    size_t len = HEADER_SIZE + capacity * sizeof(Slot);
+    if(msync(base, len, MS_SYNC) < 0 || fsync(fd) < 0 || rename(tmp.c_str(), path_.c_str()) < 0) {
+        LOG_ERROR("UserStore rebuild %s error: %s", path_.c_str(), strerror(errno));
+        munmap(base, len);
+        close(fd);
+        unlink(tmp.c_str());
+        return false;
+    }
+    /* rename本身也要落盘 */
+    string dir = path_;
+    int dirFd = open(dirname(&dir[0]), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if(dirFd >= 0) {
+        fsync(dirFd);
+        close(dirFd);
+    }
+    Unmap_();
+    fd_ = fd;
+    base_ = base;
+    capacity_ = capacity;
+    count_ = count;
+    return true;
+}
+
+bool MmapUserStore::Query(const string& name, Credential* cred) {
+    assert(cred);
+    shared_lock<shared_timed_mutex> locker(mtx_);
+    if(!base_) { return false; }
+    cred->exist = false;
+    cred->password.clear();
+    if(name.size() > MAX_NAME) { return true; }
+    bool found;
+    Slot* slot = Find_(base_, capacity_, name.data(), name.size(), &found);
+    if(found) {
+        cred->exist = true;
+        cred->password.assign(slot->pwd, slot->pwdLen);
+    }
+    return true;
+}
+
+bool MmapUserStore::Insert(const string& name, const string& pwd) {
+    if(name.empty() || name.size() > MAX_NAME || pwd.size() > MAX_PWD) { return false; }
+    unique_lock<shared_timed_mutex> locker(mtx_);
+    if(!base_) { return false; }
+    /* 装载因子超过0.7时容量翻倍 */
+    if((count_ + 1) * 10 > capacity_ * 7 && !Rebuild_(capacity_ * 2)) {
+        return false;
+    }
+    bool found;
+    Slot* slot = Find_(base_, capacity_, name.data(), name.size(), &found);
+    if(found) { return false; }
+    slot->nameLen = name.size();
+    slot->pwdLen = pwd.size();
+    memcpy(slot->name, name.data(), name.size());
+    memcpy(slot->pwd, pwd.data(), pwd.size());
+    slot->check = Check_(*slot);
+    __atomic_store_n(&slot->state, 1, __ATOMIC_RELEASE);
+    count_++;
+    if(sync_) {
+        size_t page = sysconf(_SC_PAGESIZE);
+        size_t offset = (reinterpret_cast<char*>(slot) - base_) & ~(page - 1);
+        msync(base_ + offset, page, MS_SYNC);
+    }
+    return true;
+}
+
+long MmapUserStore::ScanNames(const function<void(const string&)>& fn) {
+    shared_lock<shared_timed_mutex> locker(mtx_);
+    if(!base_) { return -1; }
+    long n = 0;
+    for(size_t i = 0; i < capacity_; i++) {
+        Slot* slot = SlotAt_(i);
+        if(slot->state == 1) {
+            fn(string(slot->name, slot->nameLen));
+            n++;
+        }
+    }
+    return n;
+}
+
+size_t MmapUserStore::Count() {
+    shared_lock<shared_timed_mutex> locker(mtx_);
+    return count_;
+}
+
+size_t MmapUserStore::Capacity() {
+    shared_lock<shared_timed_mutex> locker(mtx_);
+    return capacity_;
+}
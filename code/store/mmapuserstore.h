@@ -0,0 +1,83 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#ifndef MMAP_USER_STORE_H
+#define MMAP_USER_STORE_H
+
+#include <string>
+#include <shared_mutex>
+#include <stdint.h>
+#include "userstore.h"
+
+/*
+ * 嵌入式用户存储：单个文件mmap到内存，开放寻址(线性探测)哈希表，不依赖外部服务
+ * 文件布局：4KB文件头 + capacity个128字节的定长槽，槽不会跨页
+ * 写入顺序：先写用户名、密码、校验和，最后单字节写入槽状态，进程崩溃时槽要么完整要么为空；
+ * 打开时校验每个槽，发现写了一半的槽(掉电等)则把有效数据重建到新文件；
+ * 扩容与重建都先写临时文件再rename原子替换，中途崩溃不影响原文件
+ * 读共享锁，写独占锁
+ */
+class MmapUserStore : public UserStore {
+public:
+    static const size_t MAX_NAME = 60;
+    static const size_t MAX_PWD = 60;
+
+    MmapUserStore();
+    ~MmapUserStore();
+
+    /* 打开或创建存储文件；capacity为新建时的槽数；sync为true时每次插入后同步所在页到磁盘
+       同一时间只能被一个进程打开，已被其他进程打开时返回false */
+    bool Open(const std::string& path, size_t capacity = 65536, bool sync = false);
+    void Close();
+
+    bool Query(const std::string& name, Credential* cred) override;
+    bool Insert(const std::string& name, const std::string& pwd) override;
+    long ScanNames(const std::function<void(const std::string&)>& fn) override;
+
+    size_t Count();
+    size_t Capacity();
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t slotSize;
+        uint64_t capacity;
+    };
+
+    struct Slot {
+        uint8_t state;    // 0空 1已写入，最后写
+        uint8_t nameLen;
+        uint8_t pwdLen;
+        uint8_t pad;
+        uint32_t check;   // 长度与内容的校验和
+        char name[MAX_NAME];
+        char pwd[MAX_PWD];
+    };
+
+    static const size_t HEADER_SIZE = 4096;
+    static const uint32_t VERSION = 1;
+    static const char MAGIC[8];
+
+    static bool Map_(const std::string& path, size_t capacity, bool create, int* fd, char** base);
+    static uint32_t Hash_(const char* str, size_t len);
+    static uint32_t Check_(const Slot& slot);
+    static Slot* Find_(char* base, size_t capacity, const char* name, size_t len, bool* found);
+
+    Slot* SlotAt_(size_t i) { return reinterpret_cast<Slot*>(base_ + HEADER_SIZE) + i; }
+    bool Rebuild_(size_t capacity);
+    void Unmap_();
+
+    std::string path_;
+    int lockFd_;  // 持有期间独占存储文件，防止多个进程同时打开
+    int fd_;
+    char* base_;
+    size_t capacity_;
+    size_t count_;
+    bool sync_;
+    std::shared_timed_mutex mtx_;
+};
+
+#endif //MMAP_USER_STORE_H
@@ -0,0 +1,106 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#include "mysqluserstore.h"
+using namespace std;
+
+/* 查询用户凭据，查询失败返回false，用户不存在时cred->exist为false */
+bool MysqlUserStore::Query(const string& name, Credential* cred) {
+    MYSQL* sql;
+    SqlConnRAII sqlRAII(&sql, pool_);
+    if(!sql) { return false; }
+    SqlStmtCache* stmts = pool_->GetStmtCache(sql);
+    if(!stmts) { return false; }
+
+    /* 参数以二进制协议绑定，不再拼接SQL字符串 */
+    unsigned long nameLen = name.size();
+    MYSQL_BIND param;
+    memset(&param, 0, sizeof(param));
+    param.buffer_type = MYSQL_TYPE_STRING;
+    param.buffer = const_cast<char*>(name.data());
+    param.buffer_length = nameLen;
+    param.length = &nameLen;
+
+    char password[64] = { 0 };
+    unsigned long passwordLen = 0;
+    MYSQL_BIND result;
+    memset(&result, 0, sizeof(result));
+    result.buffer_type = MYSQL_TYPE_STRING;
+    result.buffer = password;
+    result.buffer_length = sizeof(password);
+    result.length = &passwordLen;
+
+    MYSQL_STMT* stmt = stmts->Execute(STMT_QUERY_USER, &param);
+    if(!stmt) { return false; }
+    if(mysql_stmt_bind_result(stmt, &result) || mysql_stmt_store_result(stmt)) {
+        LOG_WARN("MySql fetch error: %s", mysql_stmt_error(stmt));
+        mysql_stmt_free_result(stmt);
+        return false;
+    }
+    int ret = mysql_stmt_fetch(stmt);
+    mysql_stmt_free_result(stmt);
+    if(ret != 0 && ret != MYSQL_DATA_TRUNCATED && ret != MYSQL_NO_DATA) {
+        return false;
+    }
+    cred->exist = (ret != MYSQL_NO_DATA);
+    cred->password.assign(password, passwordLen < sizeof(password) ? passwordLen : sizeof(password));
+    return true;
+}
+
+bool MysqlUserStore::Insert(const string& name, const string& pwd) {
+    SqlBatchWriter* writer = SqlBatchWriter::Instance();
+    if(writer->IsOpen()) {
+        return writer->AddUser(name, pwd);  // 与同一窗口内的其他注册合并写入
+    }
+    MYSQL* sql;
+    SqlConnRAII sqlRAII(&sql, pool_);
+    if(!sql) { return false; }
+    SqlStmtCache* stmts = pool_->GetStmtCache(sql);
+    if(!stmts) { return false; }
+
+    unsigned long nameLen = name.size(), pwdLen = pwd.size();
+    MYSQL_BIND params[2];
+    memset(params, 0, sizeof(params));
+    params[0].buffer_type = MYSQL_TYPE_STRING;
+    params[0].buffer = const_cast<char*>(name.data());
+    params[0].buffer_length = nameLen;
+    params[0].length = &nameLen;
+    params[1].buffer_type = MYSQL_TYPE_STRING;
+    params[1].buffer = const_cast<char*>(pwd.data());
+    params[1].buffer_length = pwdLen;
+    params[1].length = &pwdLen;
+    return stmts->Execute(STMT_INSERT_USER, params) != nullptr;
+}
+
+long MysqlUserStore::ScanNames(const function<void(const string&)>& fn) {
+    MYSQL* sql;
+    SqlConnRAII sqlRAII(&sql, pool_);
+    if(!sql) { return -1; }
+    /* mysql_use_result逐行从服务端读取，不把整张表缓存在客户端 */
+    if(mysql_query(sql, "SELECT username FROM user")) {
+        LOG_ERROR("MySql scan error: %s", mysql_error(sql));
+        return -1;
+    }
+    MYSQL_RES* res = mysql_use_result(sql);
+    if(!res) {
+        LOG_ERROR("MySql scan error: %s", mysql_error(sql));
+        return -1;
+    }
+    long rows = 0;
+    while(MYSQL_ROW row = mysql_fetch_row(res)) {
+        unsigned long* lens = mysql_fetch_lengths(res);
+        if(row[0]) {
+            fn(string(row[0], lens[0]));
+            rows++;
+        }
+    }
+    bool ok = mysql_errno(sql) == 0;
+    mysql_free_result(res);
+    if(!ok) {
+        LOG_ERROR("MySql scan error: %s", mysql_error(sql));
+        return -1;
+    }
+    return rows;
+}
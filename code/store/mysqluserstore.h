@@ -0,0 +1,30 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#ifndef MYSQL_USER_STORE_H
+#define MYSQL_USER_STORE_H
+
+#include <mysql/mysql.h>
+#include <string.h>
+#include "userstore.h"
+#include "../log/log.h"
+#include "../pool/sqlconnpool.h"
+#include "../pool/sqlconnRAII.h"
+#include "../pool/sqlbatchwriter.h"
+
+/* 基于MySQL user表的存储，查询与插入使用连接上缓存的预处理语句，开启批量写入时插入经由SqlBatchWriter */
+class MysqlUserStore : public UserStore {
+public:
+    explicit MysqlUserStore(SqlConnPool* pool): pool_(pool) {}
+
+    bool Query(const std::string& name, Credential* cred) override;
+    bool Insert(const std::string& name, const std::string& pwd) override;
+    long ScanNames(const std::function<void(const std::string&)>& fn) override;
+
+private:
+    SqlConnPool* pool_;
+};
+
+#endif //MYSQL_USER_STORE_H
@@ -0,0 +1,32 @@
+/*
+ * @Author       : mark
+ * @Date         : 2020-06-16
+ * @copyleft Apache 2.0
+ */
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <string>
+#include <functional>
+#include "../cache/credcache.h"  // Credential
+
+/*
+ * 用户数据的存储后端
+ * 认证逻辑只依赖这个接口，可以换成MySQL或嵌入式的本地文件存储
+ * 所有接口须线程安全
+ */
+class UserStore {
+public:
+    virtual ~UserStore() = default;
+
+    /* 查询用户，后端出错返回false；用户不存在时返回true且cred->exist为false */
+    virtual bool Query(const std::string& name, Credential* cred) = 0;
+
+    /* 新增用户，用户名已存在或后端出错返回false */
+    virtual bool Insert(const std::string& name, const std::string& pwd) = 0;
+
+    /* 逐个遍历所有用户名(如建立布隆过滤器)，返回遍历的个数，出错返回-1 */
+    virtual long ScanNames(const std::function<void(const std::string&)>& fn) = 0;
+};
+
+#endif //USER_STORE_H
@@ -7,12 +7,11 @@
 
 void HeapTimer::siftup_(size_t i) {
     assert(i >= 0 && i < heap_.size());
-    size_t j = (i - 1) / 2;
-    while(j >= 0) {
+    while(i > 0) {  // size_t下标，根结点的(i - 1) / 2会回绕
+        size_t j = (i - 1) / 2;
         if(heap_[j] < heap_[i]) { break; }
         SwapNode_(i, j);
         i = j;
-        j = (i - 1) / 2;
     }
 }
 
@@ -106,8 +105,9 @@ void HeapTimer::tick() {
         if(std::chrono::duration_cast<MS>(node.expires - Clock::now()).count() > 0) { 
             break; 
         }
-        node.cb();
+        /* 先出堆再回调，回调中可以用同一id重新添加定时器 */
         pop();
+        node.cb();
     }
 }
 
@@ -0,0 +1,77 @@
+#include <benchmark/benchmark.h>
+#include <thread>
+#include "../code/server/webserver.h"
+
+/*
+ * 连接建立速率(短连接)：每次迭代 新建连接 -> GET -> 读完响应 -> 服务器关闭，1~64个客户端线程
+ * 对比原来的 listen(6)+每次通知只accept一个(LT) 与 大backlog+accept4批量接受
+ * 使用嵌入式用户存储，不需要MySQL；需要在仓库根目录运行(读取resources)
+ * g++ -std=c++14 -O2 accept_test.cpp ../code/*\/*.cpp -lbenchmark -lmysqlclient -lhiredis -pthread
+ */
+
+static const int OLD_PORT = 1417;
+static const int NEW_PORT = 1418;
+
+static void StartServer(int port, int backlog, int batch, const char* store) {
+    std::thread([=] {
+        Config config;
+        config.openEmbeddedStore = true;
+        config.embeddedStorePath = store;
+        config.listenBacklog = backlog;
+        config.acceptBatch = batch;
+        WebServer server(port, 0, 60000, false, 3306, "root", "root", "webserver",
+                         1, 8, false, 1, 1024, config);
+        server.Start();
+    }).detach();
+}
+
+static void InitServers() {
+    static bool inited = false;
+    if(!inited) {
+        StartServer(OLD_PORT, 6, 1, "/tmp/accept_test_old.db");
+        StartServer(NEW_PORT, 4096, 64, "/tmp/accept_test_new.db");
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        inited = true;
+    }
+}
+
+static bool Request(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return false;
+    }
+    const char req[] = "GET /index.html HTTP/1.1\r\nConnection: close\r\n\r\n";
+    bool ok = send(fd, req, sizeof(req) - 1, 0) == sizeof(req) - 1;
+    char buf[4096];
+    ssize_t n, total = 0;
+    while((n = recv(fd, buf, sizeof(buf), 0)) > 0) { total += n; }
+    close(fd);
+    return ok && total > 0;
+}
+
+static void Churn(benchmark::State& state, int port) {
+    if(state.thread_index() == 0) { InitServers(); }
+    int64_t failed = 0;
+    for (auto _ : state) {
+        if(!Request(port)) { failed++; }
+    }
+    state.SetItemsProcessed(state.iterations());  // items_per_second 即每秒新建连接数
+    state.counters["failed"] = failed;
+}
+
+static void BM_AcceptOld(benchmark::State& state) {
+    Churn(state, OLD_PORT);
+}
+BENCHMARK(BM_AcceptOld)->ThreadRange(1, 64)->UseRealTime();
+
+static void BM_AcceptBatch(benchmark::State& state) {
+    Churn(state, NEW_PORT);
+}
+BENCHMARK(BM_AcceptBatch)->ThreadRange(1, 64)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,113 @@
+#include <benchmark/benchmark.h>
+#include <thread>
+#include <algorithm>
+#include "../code/server/webserver.h"
+
+/*
+ * 绑核对请求延迟的影响：每个客户端线程一个长连接，逐个发送GET并等待完整响应，统计p50/p99
+ * 绑核：事件循环绑定CPU 0，工作线程逐个绑定其余CPU(只有一个CPU时同样绑定CPU 0)；不绑核：由调度器决定
+ * 客户端线程与服务器在同一台机器上，客户端不绑核
+ * 使用嵌入式用户存储，不需要MySQL；需要在仓库根目录运行(读取resources)
+ * g++ -std=c++14 -O2 affinity_test.cpp ../code/*\/*.cpp -lbenchmark -lmysqlclient -lhiredis -pthread
+ */
+
+static const int FLOAT_PORT = 1419;
+static const int PINNED_PORT = 1420;
+
+static void StartServer(int port, bool pinned, const char* store) {
+    static std::string workers;
+    int ncpu = static_cast<int>(std::thread::hardware_concurrency());
+    workers = ncpu > 1 ? "1-" + std::to_string(ncpu - 1) : "0";
+    std::thread([=] {
+        Config config;
+        config.openEmbeddedStore = true;
+        config.embeddedStorePath = store;
+        if(pinned) {
+            config.reactorCpus = "0";
+            config.workerCpus = workers.c_str();
+        }
+        WebServer server(port, 3, 60000, false, 3306, "root", "root", "webserver",
+                         1, 4, false, 1, 1024, config);
+        server.Start();
+    }).detach();
+}
+
+static void InitServers() {
+    static bool inited = false;
+    if(!inited) {
+        StartServer(FLOAT_PORT, false, "/tmp/affinity_test_float.db");
+        StartServer(PINNED_PORT, true, "/tmp/affinity_test_pinned.db");
+        std::this_thread::sleep_for(std::chrono::milliseconds(200));
+        inited = true;
+    }
+}
+
+static int Connect(int port) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if(connect(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/* 读完一个响应：先读到响应头得到Content-length，再读完响应体 */
+static bool ReadResponse(int fd) {
+    std::string data;
+    char buf[8192];
+    size_t need = std::string::npos;
+    while(need == std::string::npos || data.size() < need) {
+        ssize_t n = recv(fd, buf, sizeof(buf), 0);
+        if(n <= 0) { return false; }
+        data.append(buf, n);
+        size_t head = data.find("\r\n\r\n");
+        size_t len = data.find("Content-length: ");
+        if(need == std::string::npos && head != std::string::npos && len != std::string::npos) {
+            need = head + 4 + atoi(data.c_str() + len + 16);
+        }
+    }
+    return true;
+}
+
+static void Latency(benchmark::State& state, int port) {
+    if(state.thread_index() == 0) { InitServers(); }
+    const char req[] = "GET /index.html HTTP/1.1\r\nHost: bench\r\n\r\n";
+    std::vector<double> latencies;
+    int fd = -1;
+    for (auto _ : state) {
+        if(fd < 0) { fd = Connect(port); }
+        auto start = std::chrono::steady_clock::now();
+        if(send(fd, req, sizeof(req) - 1, 0) != sizeof(req) - 1 || !ReadResponse(fd)) {
+            close(fd);
+            fd = -1;  // 到达单连接请求数上限或出错，重新连接
+            continue;
+        }
+        latencies.push_back(std::chrono::duration<double, std::micro>(
+                                std::chrono::steady_clock::now() - start).count());
+    }
+    if(fd >= 0) { close(fd); }
+    std::sort(latencies.begin(), latencies.end());
+    if(!latencies.empty()) {
+        state.counters["p50_us"] = benchmark::Counter(latencies[latencies.size() / 2],
+                                                      benchmark::Counter::kAvgThreads);
+        state.counters["p99_us"] = benchmark::Counter(latencies[latencies.size() * 99 / 100],
+                                                      benchmark::Counter::kAvgThreads);
+    }
+    state.SetItemsProcessed(latencies.size());
+}
+
+static void BM_Float(benchmark::State& state) {
+    Latency(state, FLOAT_PORT);
+}
+BENCHMARK(BM_Float)->ThreadRange(1, 16)->UseRealTime();
+
+static void BM_Pinned(benchmark::State& state) {
+    Latency(state, PINNED_PORT);
+}
+BENCHMARK(BM_Pinned)->ThreadRange(1, 16)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,35 @@
+#include <benchmark/benchmark.h>
+#include "../code/server/iplimiter.h"
+
+/*
+ * 限流检查的开销：每次请求一次AllowRequest，连接建立/关闭一次AcquireConn + ReleaseConn
+ * 客户端IP从4096个中轮换，1~8线程共享同一张表
+ * g++ -std=c++14 -O2 iplimiter_test.cpp ../code/server/iplimiter.cpp -lbenchmark -pthread
+ */
+
+static IpLimiter limiter(65536, 1 << 20, 1 << 20, 1 << 20);  // 上限足够大，只测查表与CAS
+
+static void BM_AllowRequest(benchmark::State& state) {
+    sockaddr_in addr = { 0 };
+    uint32_t i = state.thread_index() * 1024;
+    for (auto _ : state) {
+        addr.sin_addr.s_addr = htonl(0x0A000000 | (i++ & 4095));
+        benchmark::DoNotOptimize(limiter.AllowRequest(addr));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AllowRequest)->ThreadRange(1, 8)->UseRealTime();
+
+static void BM_AcquireRelease(benchmark::State& state) {
+    sockaddr_in addr = { 0 };
+    uint32_t i = state.thread_index() * 1024;
+    for (auto _ : state) {
+        addr.sin_addr.s_addr = htonl(0x0A000000 | (i++ & 4095));
+        benchmark::DoNotOptimize(limiter.AcquireConn(addr));
+        limiter.ReleaseConn(addr);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_AcquireRelease)->ThreadRange(1, 8)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,55 @@
+#include <benchmark/benchmark.h>
+#include <atomic>
+#include <string>
+#include <unistd.h>
+#include "../code/pool/sqlconnpool.h"
+#include "../code/pool/sqlconnRAII.h"
+#include "../code/pool/sqlbatchwriter.h"
+
+/*
+ * 注册写入吞吐：逐条自动提交INSERT 与 延迟合并批量写入 对比
+ * 需要本机MySQL/MariaDB(与main.cpp相同的账号和库)，会向user表写入大量bench_开头的用户
+ * g++ -std=c++14 -O2 sqlbatchwriter_test.cpp ../code/pool/sqlconnpool.cpp ../code/pool/sqlstmtcache.cpp
+ *     ../code/pool/sqlbatchwriter.cpp ../code/log/log.cpp ../code/buffer/buffer.cpp
+ *     -lbenchmark -lmysqlclient -pthread
+ */
+
+static std::atomic<long> userId(0);
+
+static std::string NextName() {
+    return "bench_" + std::to_string(getpid()) + "_" + std::to_string(userId++);
+}
+
+static void InitPool() {
+    static bool inited = false;
+    if(!inited) {
+        SqlConnPool::Instance()->Init("localhost", 3306, "root", "root", "webserver", 64);
+        SqlBatchWriter::Instance()->Init(SqlConnPool::Instance(), 64, 5);
+        inited = true;
+    }
+}
+
+// 每个注册一次往返、一个事务
+static void BM_SingleInsert(benchmark::State& state) {
+    if(state.thread_index() == 0) { InitPool(); }
+    for (auto _ : state) {
+        MYSQL* sql;
+        SqlConnRAII sqlRAII(&sql, SqlConnPool::Instance());
+        std::string query = "INSERT INTO user(username, password) VALUES('" + NextName() + "', 'pwd')";
+        benchmark::DoNotOptimize(mysql_query(sql, query.c_str()));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_SingleInsert)->ThreadRange(1, 64)->UseRealTime();
+
+// 窗口内的注册合并为一个事务
+static void BM_BatchInsert(benchmark::State& state) {
+    if(state.thread_index() == 0) { InitPool(); }
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(SqlBatchWriter::Instance()->AddUser(NextName(), "pwd"));
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_BatchInsert)->ThreadRange(1, 64)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -0,0 +1,47 @@
+#include <benchmark/benchmark.h>
+#include "../code/pool/sqlconnpool.h"
+#include "../code/pool/sqlconnRAII.h"
+
+/*
+ * 连接池借还开销：共享队列(锁+条件变量) 与 线程本地缓存 对比，1~64线程
+ * 需要本机MySQL(与main.cpp相同的账号和库)，连接数不少于最大线程数
+ * 只有建立连接时访问MySQL；未开启空闲检查，计时的借还循环不调用客户端库，只测连接池本身
+ * g++ -std=c++14 -O2 sqlconnpool_test.cpp ../code/pool/sqlconnpool.cpp ../code/pool/sqlstmtcache.cpp
+ *     ../code/log/log.cpp ../code/buffer/buffer.cpp -lbenchmark -lmysqlclient -pthread
+ */
+
+static const int CONN_NUM = 64;
+
+static void InitPool() {
+    static bool inited = false;
+    if(!inited) {
+        SqlConnPool::Instance()->Init("localhost", 3306, "root", "root", "webserver", CONN_NUM);
+        inited = true;
+    }
+}
+
+// 借出后立即归还，测量一次借还的开销
+static void AcquireRelease(benchmark::State& state, int stash) {
+    if(state.thread_index() == 0) {
+        InitPool();
+        SqlConnPool::Instance()->SetLocalStash(stash, state.threads());
+    }
+    for (auto _ : state) {
+        MYSQL* sql;
+        SqlConnRAII sqlRAII(&sql, SqlConnPool::Instance());
+        benchmark::DoNotOptimize(sql);
+    }
+    state.SetItemsProcessed(state.iterations());
+}
+
+static void BM_SharedQueue(benchmark::State& state) {
+    AcquireRelease(state, 0);
+}
+BENCHMARK(BM_SharedQueue)->ThreadRange(1, 64)->UseRealTime();
+
+static void BM_LocalStash(benchmark::State& state) {
+    AcquireRelease(state, 1);
+}
+BENCHMARK(BM_LocalStash)->ThreadRange(1, 64)->UseRealTime();
+
+BENCHMARK_MAIN();
@@ -5,7 +5,29 @@
  */ 
 #include "../code/log/log.h"
 #include "../code/pool/threadpool.h"
+#include "../code/cache/credcache.h"
+#include "../code/cache/userbloom.h"
+#include "../code/cache/sessionstore.h"
+#include "../code/cache/filecache.h"
+#include "../code/timer/heaptimer.h"
+#include "../code/store/mmapuserstore.h"
+#include "../code/server/connslab.h"
+#include "../code/server/admission.h"
+#include "../code/server/iplimiter.h"
+#include "../code/server/cpuaffinity.h"
+#include "../code/server/busypoll.h"
+#include "../code/server/prefork.h"
+#include "../code/server/hotrestart.h"
+#include "../code/pool/redisasync.h"
+#include "../code/server/webserver.h"
+#include <sys/epoll.h>
 #include <features.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/wait.h>
+#include <poll.h>
+#include <netinet/in.h>
 
 #if __GLIBC__ == 2 && __GLIBC_MINOR__ < 30
 #include <sys/syscall.h>
@@ -50,7 +72,691 @@ void TestThreadPool() {
     getchar();
 }
 
+/* 析构时执行完已排队的任务并等待线程退出 */
+void TestThreadPoolJoin() {
+    std::atomic<int> done(0);
+    {
+        ThreadPool threadpool(2);
+        for(int i = 0; i < 20; i++) {
+            threadpool.AddTask([&done] {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                done++;
+            });
+        }
+    }
+    assert(done == 20);
+}
+
+void TestCredCache() {
+    CredCache* cache = CredCache::Instance();
+    cache->Init(4, 8, 1000, 1000);
+    Credential cred;
+    assert(!cache->Get("mark", &cred));
+    cache->Put("mark", {true, "123"});
+    assert(cache->Get("mark", &cred) && cred.exist && cred.password == "123");
+    cache->Invalidate("mark");
+    assert(!cache->Get("mark", &cred));
+
+    /* 容量有限，旧数据被淘汰 */
+    for(int i = 0; i < 100; i++) {
+        cache->Put("user" + std::to_string(i), {true, "pwd"});
+    }
+    assert(!cache->Get("user0", &cred));
+
+    /* 并发未命中同一个用户名只查询一次后端 */
+    std::atomic<int> loads(0);
+    std::vector<std::thread> threads;
+    for(int i = 0; i < 8; i++) {
+        threads.emplace_back([&] {
+            Credential c;
+            bool ok = cache->GetOrLoad("hot", &c, [&](Credential* out) {
+                loads++;
+                std::this_thread::sleep_for(std::chrono::milliseconds(50));
+                out->exist = false;
+                return true;
+            });
+            assert(ok && !c.exist);
+        });
+    }
+    for(auto& t: threads) { t.join(); }
+    assert(loads == 1);
+}
+
+void TestUserBloom() {
+    UserBloom* bloom = UserBloom::Instance();
+    bloom->Init(10000, 0.01);
+    for(int i = 0; i < 10000; i++) {
+        bloom->Add("user" + std::to_string(i));
+    }
+    /* 已加入的一定判定为可能存在 */
+    for(int i = 0; i < 10000; i++) {
+        assert(bloom->MayContain("user" + std::to_string(i)));
+    }
+    /* 误判率接近目标值 */
+    int falsePositive = 0;
+    for(int i = 0; i < 10000; i++) {
+        if(bloom->MayContain("other" + std::to_string(i))) { falsePositive++; }
+    }
+    assert(falsePositive < 300);
+    assert(bloom->EstimatedFpRate() < 0.02);
+}
+
+void TestMmapUserStore() {
+    const char* path = "./testusers.db";
+    unlink(path);
+    Credential cred;
+    {
+        MmapUserStore store;
+        assert(store.Open(path, 16));
+        assert(store.Insert("mark", "123"));
+        assert(!store.Insert("mark", "456"));  // 用户名唯一
+        assert(store.Query("mark", &cred) && cred.exist && cred.password == "123");
+        assert(store.Query("nobody", &cred) && !cred.exist);
+        /* 超过装载因子自动扩容 */
+        for(int i = 0; i < 1000; i++) {
+            assert(store.Insert("user" + std::to_string(i), "pwd"));
+        }
+        assert(store.Count() == 1001 && store.Capacity() >= 2048);
+    }
+    {
+        /* 重新打开后数据仍在 */
+        MmapUserStore store;
+        assert(store.Open(path));
+        assert(store.Count() == 1001);
+        assert(store.Query("user999", &cred) && cred.exist && cred.password == "pwd");
+        /* 已被打开时其他打开者(其他进程)失败 */
+        MmapUserStore other;
+        assert(!other.Open(path));
+    }
+    {
+        /* 模拟写了一半的槽：改坏一个槽的内容，打开时丢弃该槽并重建，其余数据不受影响 */
+        int fd = open(path, O_RDWR);
+        char buf[128];
+        for(off_t off = 4096; pread(fd, buf, sizeof(buf), off) == sizeof(buf); off += sizeof(buf)) {
+            if(buf[0] == 1) {
+                buf[8] ^= 0x55;
+                assert(pwrite(fd, buf, sizeof(buf), off) == sizeof(buf));
+                break;
+            }
+        }
+        close(fd);
+        MmapUserStore store;
+        assert(store.Open(path));
+        assert(store.Count() == 1000);
+        long n = store.ScanNames([](const std::string&) {});
+        assert(n == 1000);
+    }
+    unlink(path);
+    unlink((std::string(path) + ".lock").c_str());
+}
+
+void TestSession() {
+    SessionStore* sessions = SessionStore::Instance();
+    sessions->Init(4, 100);
+    std::string a = sessions->Create("mark"), b = sessions->Create("mark");
+    assert(a.size() == SessionStore::ID_LEN && a != b);
+    std::string user;
+    assert(sessions->Validate(a, &user) && user == "mark");
+    assert(!sessions->Validate("0123456789abcdef0123456789abcdef", &user));
+    assert(!sessions->Validate("bad", &user));
+    sessions->Remove(b);
+    assert(!sessions->Validate(b, &user));
+
+    /* 定时器驱动清理：回调中以同一id重新添加定时器 */
+    HeapTimer timer;
+    std::function<void()> sweep = [&] {
+        sessions->Expire();
+        timer.add(1, 20, sweep);
+    };
+    timer.add(1, 20, sweep);
+    for(int i = 0; i < 10; i++) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        timer.tick();
+    }
+    assert(!sessions->Validate(a, &user));
+    assert(sessions->Count() == 0 && sessions->Expired() == 1);
+    assert(timer.GetNextTick() >= 0);  // 清理定时器仍在
+    sessions->Close();
+}
+
+void TestConnSlab() {
+    ConnSlab slab(1024);
+    assert(!slab.Open(1024) && !slab.Get(5));
+    HttpConn* conn = slab.Open(5);
+    assert(conn && slab.Get(5) == conn);
+    uint32_t gen = slab.Gen(5);
+    assert(slab.Get(5, gen) == conn);
+    /* 关闭后旧代数失效，fd复用时对象地址不变 */
+    slab.Release(5);
+    assert(!slab.Get(5) && !slab.Get(5, gen));
+    assert(slab.Open(5) == conn && !slab.Get(5, gen) && slab.Get(5, slab.Gen(5)) == conn);
+    assert(reinterpret_cast<uintptr_t>(conn) % 64 == 0);
+
+    /* 空闲时要求关闭立即生效 */
+    assert(slab.RequestClose(5, slab.Gen(5)) && slab.State(5) == CONN_CLOSING);
+    assert(!slab.Begin(5, CONN_READING));
+    slab.Release(5);
+
+    /* 处理中要求关闭：延后到工作线程交还连接时 */
+    slab.Open(5);
+    gen = slab.Gen(5);
+    assert(slab.Begin(5, CONN_READING));
+    assert(!slab.Begin(5, CONN_READING));  // 同一时刻只有一个持有者
+    slab.Switch(5, CONN_PROCESSING);
+    assert(!slab.RequestClose(5, gen) && !slab.RequestClose(5, gen + 1));
+    Completion* done = slab.Post(5, EPOLLIN);
+    assert(done->fd == 5 && slab.State(5) == CONN_POSTED);
+    assert(!slab.Finish(5, done->events) && slab.State(5) == CONN_CLOSING);
+    slab.Release(5);
+
+    /* 交还后回到空闲 */
+    slab.Open(5);
+    assert(slab.Begin(5, CONN_WRITING));
+    assert(slab.Finish(5, slab.Post(5, EPOLLOUT)->events) && slab.State(5) == CONN_IDLE);
+}
+
+void TestCompletionQueue() {
+    CompletionQueue queue;
+    std::vector<Completion> items(4000);
+    std::vector<std::thread> threads;
+    for(int t = 0; t < 4; t++) {
+        threads.emplace_back([&, t] {
+            for(int i = 0; i < 1000; i++) {
+                items[t * 1000 + i].fd = t * 1000 + i;
+                queue.Push(&items[t * 1000 + i]);
+            }
+        });
+    }
+    for(auto& t: threads) { t.join(); }
+    /* 同一线程的提交保持顺序，取走之前只唤醒一次 */
+    std::vector<int> last(4, -1);
+    size_t n = queue.Drain([&](Completion* c) {
+        int t = c->fd / 1000;
+        assert(c->fd > last[t]);
+        last[t] = c->fd;
+    });
+    assert(n == 4000 && queue.Wakeups() == 1);
+    assert(queue.Drain([](Completion*) {}) == 0);
+}
+
+void TestFileCache() {
+    const char* path = "/tmp/filecache_test.html";
+    FILE* fp = fopen(path, "w");
+    fputs("<html>v1</html>", fp);
+    fclose(fp);
+    chmod(path, 0644);
+    FileCache* cache = FileCache::Instance();
+    cache->Init(64, 1024);
+    assert(!cache->Contains(path, 64));  // 只查询不加载
+    auto file = cache->Get(path);
+    assert(file && file->data == "<html>v1</html>" && file->st.st_size == 15);
+    assert(cache->Contains(path, 64) && !cache->Contains(path, 8));
+    assert(cache->Get(path) == file && cache->Hits() == 1 && cache->Bytes() == 15);
+    /* 未命中时带回stat结果，调用者不必再stat */
+    struct stat st;
+    int ret = 0;
+    assert(!cache->Get("/tmp/filecache_test_missing.html", &st, &ret) && ret == -1);
+    assert(!cache->Get("/tmp", &st, &ret) && ret == 0 && S_ISDIR(st.st_mode));
+
+    /* 修改后在检查间隔到期时重新加载，旧内容仍被持有者引用 */
+    fp = fopen(path, "w");
+    fputs("<html>version2</html>", fp);
+    fclose(fp);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    auto file2 = cache->Get(path);
+    assert(file2 && file2->data == "<html>version2</html>" && file->data == "<html>v1</html>");
+    assert(cache->Bytes() == file2->data.size());
+    /* 热重启交给新进程的索引，只预热前缀匹配的路径 */
+    assert((cache->Paths() == std::vector<std::string>{ path }));
+    assert(cache->Warm({ path, "/srv/www/index.html" }, "/tmp/") == 1 && cache->Warm({ path }, "/srv/") == 0);
+
+    /* 超过单文件上限不缓存 */
+    fp = fopen(path, "w");
+    for(int i = 0; i < 10; i++) { fputs("0123456789", fp); }
+    fclose(fp);
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    assert(!cache->Get(path, &st, &ret) && ret == 0 && st.st_size == 100);
+    assert(!cache->Contains(path, 1024) && cache->Bytes() == 0);
+    unlink(path);
+}
+
+void TestAdmission() {
+    AdmissionControl admission(5, 20);
+    for(int i = 0; i < 100; i++) { admission.OnEnqueue(); }
+    /* 排队时间持续一个interval高于target才进入过载 */
+    int64_t start = AdmissionControl::NowUs();
+    assert(!admission.OnDequeue(AdmissionControl::NowUs() - 10000, true));
+    assert(!admission.Overloaded() && admission.AdmitConnection());
+    while(AdmissionControl::NowUs() - start < 25000) {
+        admission.OnEnqueue();
+        admission.OnDequeue(AdmissionControl::NowUs() - 10000, false);
+    }
+    assert(admission.Overloaded() && admission.Overloads() == 1);
+    assert(!admission.AdmitConnection() && admission.ShedConnections() == 1);
+    /* 新连接的请求超过target即丢弃，长连接请求超过interval才丢弃，发送中的响应不丢弃 */
+    int64_t now = AdmissionControl::NowUs();
+    assert(admission.OnDequeue(now - 10000, true));
+    assert(!admission.OnDequeue(now - 10000, false));
+    assert(admission.OnDequeue(now - 30000, false));
+    assert(!admission.OnDequeue(now - 30000, false, false));
+    assert(admission.ShedNew() == 1 && admission.ShedKeepAlive() == 1);
+    /* 排队时间回落到target以下即退出过载 */
+    assert(!admission.OnDequeue(AdmissionControl::NowUs() - 1000, true));
+    assert(!admission.Overloaded() && admission.AdmitConnection());
+}
+
+void TestIpLimiter() {
+    IpLimiter limiter(64, 2, 10, 3);
+    sockaddr_in a = { 0 }, b = { 0 };
+    a.sin_addr.s_addr = inet_addr("10.0.0.1");
+    b.sin_addr.s_addr = inet_addr("10.0.0.2");
+    /* 并发连接上限按IP独立计数 */
+    assert(limiter.AcquireConn(a) && limiter.AcquireConn(a) && !limiter.AcquireConn(a));
+    assert(limiter.AcquireConn(b) && limiter.RejectedConns() == 1);
+    limiter.ReleaseConn(a);
+    assert(limiter.AcquireConn(a));
+    /* 令牌桶：先用完突发容量，之后按速率补充(10/s即每100ms一个) */
+    assert(limiter.AllowRequest(b) && limiter.AllowRequest(b) && limiter.AllowRequest(b));
+    assert(!limiter.AllowRequest(b) && limiter.AllowRequest(a));
+    std::this_thread::sleep_for(std::chrono::milliseconds(120));
+    assert(limiter.AllowRequest(b) && !limiter.AllowRequest(b));
+    assert(limiter.LimitedRequests() == 2);
+    /* 有连接或令牌未补满的槽不回收 */
+    assert(limiter.Sweep() == 2);
+    limiter.ReleaseConn(a);
+    limiter.ReleaseConn(a);
+    limiter.ReleaseConn(b);
+    std::this_thread::sleep_for(std::chrono::milliseconds(350));
+    assert(limiter.Sweep() == 0);
+    limiter.ReleaseConn(a);  // 已回收，不会出错
+    assert(limiter.AcquireConn(a) && limiter.AllowRequest(a));
+
+    /* 只有一组4个槽：第5个IP放行但不计数，关闭时不能释放 */
+    IpLimiter small(4, 1, 0, 0);
+    sockaddr_in ips[5] = { { 0 } };
+    bool counted = false;
+    for(int i = 0; i < 5; i++) {
+        ips[i].sin_addr.s_addr = htonl(0x0A000101 + i);
+        assert(small.AcquireConn(ips[i], &counted) && counted == (i < 4));
+    }
+    assert(small.Untracked() == 1 && small.AcquireConn(ips[4], &counted) && !counted);
+    assert(!small.AcquireConn(ips[0], &counted) && !counted);
+}
+
+void TestKeepAlive() {
+    auto parse = [](const char* text) {
+        Buffer buff;
+        buff.Append(text, strlen(text));
+        HttpRequest request;
+        assert(request.parse(buff));
+        return request.IsKeepAlive();
+    };
+    /* HTTP/1.1默认长连接，HTTP/1.0需要显式要求；头名与选项不区分大小写 */
+    assert(parse("GET / HTTP/1.1\r\nHost: a\r\n\r\n"));
+    assert(!parse("GET / HTTP/1.1\r\nConnection: Close\r\n\r\n"));
+    assert(!parse("GET / HTTP/1.1\r\nconnection: Upgrade, close\r\n\r\n"));
+    assert(!parse("GET / HTTP/1.0\r\nHost: a\r\n\r\n"));
+    assert(parse("GET / HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\n"));
+    assert(!parse("GET / HTTP/1.0\r\nConnection: keep-alive-x\r\n\r\n"));
+}
+
+/* 流水线：一次读到多个请求，每次parse只消费一个，请求体按Content-Length截取 */
+void TestPipeline() {
+    const char* text = "GET /a HTTP/1.1\r\nHost: x\r\n\r\n"
+                       "POST /b HTTP/1.1\r\nContent-Type: application/x-www-form-urlencoded\r\n"
+                       "content-length: 7\r\n\r\nk=v&n=1"
+                       "GET /c HTTP/1.1\r\nHost: x\r\n\r\n";
+    Buffer buff;
+    buff.Append(text, strlen(text));
+    HttpRequest request;
+    assert(request.parse(buff) && request.path() == "/a");
+    assert(strncmp(buff.Peek(), "POST /b", 7) == 0);
+    request.Init();
+    assert(request.parse(buff) && request.path() == "/b");
+    assert(request.GetPost("k") == "v" && request.GetPost("n") == "1");
+    request.Init();
+    assert(request.parse(buff) && request.path() == "/c" && request.method() == "GET");
+    assert(buff.ReadableBytes() == 0);
+}
+
+void TestCpuAffinity() {
+    std::vector<int> cpus = CpuAffinity::Parse("8, 0-3,2 ,10-11\n");
+    assert((cpus == std::vector<int>{ 0, 1, 2, 3, 8, 10, 11 }));
+    assert(CpuAffinity::ToString(cpus) == "0-3,8,10-11");
+    assert(CpuAffinity::Parse("").empty() && CpuAffinity::Parse("3-1").empty() && CpuAffinity::Parse("a").empty());
+    /* 网卡名按整个名字匹配 */
+    const char* irq = " 45:  123  0  IR-PCI-MSI 524289-edge      eth10-TxRx-0";
+    assert(CpuAffinity::IsNicIrq(irq, "eth10") && !CpuAffinity::IsNicIrq(irq, "eth1"));
+    assert(CpuAffinity::IsNicIrq(" 30:  5  PCI-MSI 1-edge  eth1", "eth1"));
+    /* 绑定到当前可用的第一个CPU */
+    cpu_set_t set;
+    assert(sched_getaffinity(0, sizeof(set), &set) == 0);
+    int first = 0;
+    while(!CPU_ISSET(first, &set)) { first++; }
+    std::thread([first] {
+        assert(CpuAffinity::PinSelf({ first }));
+        assert(sched_getcpu() == first);
+    }).join();
+    /* 工作线程的绑定结果在构造返回时可知，不存在的CPU绑定失败 */
+    assert(ThreadPool(2, { first }).PinFailures() == 0);
+    assert(ThreadPool(2, { CPU_SETSIZE - 1 }).PinFailures() == 2);
+}
+
+void TestBusyPoll() {
+    BusyPoll poll(100);
+    assert(poll.Budget() == 10);
+    poll.OnHit(5);  // 自旋中等到，预算不变
+    assert(poll.Budget() == 10 && poll.Hits() == 1);
+    /* 阻塞后很快就有事件：加倍直到上限 */
+    poll.OnBlock(10, 20, true);
+    assert(poll.Budget() == 20);
+    poll.OnBlock(20, 30, true);
+    poll.OnBlock(40, 30, true);
+    poll.OnBlock(80, 10, true);
+    assert(poll.Budget() == 100);
+    /* 事件稀疏或超时：减半，低于起始值归零 */
+    poll.OnBlock(100, 5000, true);
+    assert(poll.Budget() == 50);
+    poll.OnBlock(50, 0, false);
+    poll.OnBlock(25, 1000, true);
+    assert(poll.Budget() == 12);
+    poll.OnBlock(12, 1000, false);
+    assert(poll.Budget() == 0);
+    /* 不自旋时，阻塞很快被唤醒则恢复自旋 */
+    poll.OnBlock(0, 1000, true);
+    assert(poll.Budget() == 0);
+    poll.OnBlock(0, 30, true);
+    assert(poll.Budget() == 10);
+    assert(poll.SpinUs() == 5 + 10 + 20 + 40 + 80 + 100 + 50 + 25 + 12 && poll.Blocks() == 10);
+}
+
+/* 主进程在子进程中运行：工作进程0第一次启动即崩溃，被重新拉起；SIGTERM后全部退出 */
+void TestPrefork() {
+    int fds[2];
+    assert(pipe(fds) == 0);
+    unlink("/tmp/test_prefork_crashed");
+    pid_t master = fork();
+    assert(master >= 0);
+    if(master == 0) {
+        close(fds[0]);
+        Prefork prefork(2, 10);
+        int ret = prefork.Run([&](int index) {
+            char msg = static_cast<char>('0' + index);
+            ssize_t n = write(fds[1], &msg, 1);
+            if(index == 0 && access("/tmp/test_prefork_crashed", F_OK) != 0) {
+                close(open("/tmp/test_prefork_crashed", O_CREAT | O_WRONLY, 0644));
+                abort();
+            }
+            pause();  // 等待主进程转发的SIGTERM
+            return n == 1 ? 0 : 1;
+        });
+        _exit(ret == 0 && prefork.Restarts() == 1 ? 0 : 1);
+    }
+    close(fds[1]);
+    int starts[2] = { 0 };
+    char msg;
+    for(int i = 0; i < 3 && read(fds[0], &msg, 1) == 1; i++) { starts[msg - '0']++; }
+    assert(starts[0] == 2 && starts[1] == 1);
+    kill(master, SIGTERM);
+    int status = 0;
+    assert(waitpid(master, &status, 0) == master);
+    assert(WIFEXITED(status) && WEXITSTATUS(status) == 0);
+    assert(read(fds[0], &msg, 1) == 0);  // 工作进程都已退出，写端全部关闭
+    close(fds[0]);
+    unlink("/tmp/test_prefork_crashed");
+}
+
+static bool WaitReadable(int fd) {
+    struct pollfd pfd = { fd, POLLIN, 0 };
+    return poll(&pfd, 1, 2000) == 1;
+}
+
+/* 旧进程把监听套接字与缓存索引交给新进程，新进程就绪后旧进程得到确认，新进程接着在同一路径上监听 */
+void TestHotRestart() {
+    const char* path = "/tmp/test_hotrestart.sock";
+    HotRestart none(path);
+    unlink(path);
+    std::vector<std::string> snapshot;
+    assert(none.Inherit(&snapshot) == -1);  // 没有旧进程
+
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    assert(bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) == 0 && listen(listenFd, 8) == 0);
+    socklen_t len = sizeof(addr);
+    getsockname(listenFd, (struct sockaddr*)&addr, &len);
+
+    HotRestart old(path);
+    assert(old.Listen());
+    HotRestart fresh(path);
+    int inherited = -1;
+    std::thread newProcess([&] { inherited = fresh.Inherit(&snapshot); });
+    assert(WaitReadable(old.Fd()));
+    assert(old.Handoff(listenFd, { "/srv/a.html", "/srv/b.css" }));
+    assert(old.Fd() == -1 && access(path, F_OK) != 0);  // 交接开始即删除控制路径
+    newProcess.join();
+    assert(inherited >= 0 && inherited != listenFd);
+    assert((snapshot == std::vector<std::string>{ "/srv/a.html", "/srv/b.css" }));
+    struct sockaddr_in got = { 0 };
+    len = sizeof(got);
+    getsockname(inherited, (struct sockaddr*)&got, &len);
+    assert(got.sin_port == addr.sin_port);
+
+    assert(old.OnPeer() == 0);  // 还没有确认
+    fresh.Ready();
+    assert(WaitReadable(old.PeerFd()) && old.OnPeer() == 1 && old.PeerFd() == -1);
+    assert(fresh.Listen() && access(path, F_OK) == 0);
+    close(inherited);
+
+    /* 旧进程发完监听套接字后没有发完索引就断开：新进程放弃接管，不确认 */
+    HotRestart broken(path);
+    std::thread brokenProcess([&] { inherited = broken.Inherit(&snapshot); });
+    assert(WaitReadable(fresh.Fd()));
+    int peer = accept(fresh.Fd(), nullptr, nullptr);
+    uint32_t header[2] = { 0x48525354, 100 };
+    struct iovec iov = { header, sizeof(header) };
+    char control[CMSG_SPACE(sizeof(int))] = { 0 };
+    struct msghdr msg = { 0 };
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cmsg), &listenFd, sizeof(int));
+    assert(sendmsg(peer, &msg, 0) == sizeof(header) && send(peer, "/srv/a", 6, 0) == 6);
+    close(peer);
+    brokenProcess.join();
+    assert(inherited == -1 && broken.PeerFd() == -1);
+    close(listenFd);
+}
+
+/* 异步认证还在等数据库时退出：待完成的认证在线程池关闭前得到失败结果并回应，不能访问已释放的线程池 */
+void TestShutdownPendingVerify() {
+    int probe = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    assert(bind(probe, (struct sockaddr*)&addr, len) == 0 && getsockname(probe, (struct sockaddr*)&addr, &len) == 0);
+    close(probe);  // 取一个空闲端口
+
+    Config config;
+    config.openAsyncSql = true;
+    config.asyncSqlConnNum = 1;
+    config.asyncSqlTimeoutMs = 60000;  // 查询一直排队，直到关闭
+    config.sqlPoolMin = 0;
+    config.drainTimeoutMs = 200;
+    int client = socket(AF_INET, SOCK_STREAM, 0);
+    {
+        WebServer server(ntohs(addr.sin_port), 3, 0, false, 1, "root", "root", "webserver", 1, 2,
+                         false, 1, 0, config);
+        std::thread loop([&server] { server.Start(); });
+        assert(connect(client, (struct sockaddr*)&addr, sizeof(addr)) == 0);
+        const char* login = "POST /login HTTP/1.1\r\nHost: x\r\n"
+                            "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: 21\r\n\r\n"
+                            "username=a&password=b";
+        assert(send(client, login, strlen(login), 0) == (ssize_t)strlen(login));
+        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        pthread_kill(loop.native_handle(), SIGTERM);  // 事件循环线程屏蔽了SIGTERM，经signalfd开始排空
+        loop.join();  // 认证未完成，到排空期限后返回
+    }
+    /* 析构时认证失败，工作线程写出响应 */
+    char buf[16] = { 0 };
+    struct timeval tv = { 2, 0 };
+    setsockopt(client, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    assert(recv(client, buf, sizeof(buf) - 1, 0) > 0 && strncmp(buf, "HTTP/1.1", 8) == 0);
+    close(client);
+    HttpRequest::isAsyncVerify = false;
+}
+
+/* 从缓冲中取出一条完整的RESP命令(批量字符串数组)，不完整时返回false */
+static bool TakeRespCommand(std::string& buf, std::vector<std::string>* argv) {
+    size_t pos = 0;
+    auto line = [&buf, &pos](long* num) {
+        size_t end = buf.find("\r\n", pos);
+        if(end == std::string::npos) { return false; }
+        *num = atol(buf.c_str() + pos + 1);
+        pos = end + 2;
+        return true;
+    };
+    long n = 0, len = 0;
+    if(!line(&n)) { return false; }
+    argv->clear();
+    for(long i = 0; i < n; i++) {
+        if(!line(&len) || buf.size() < pos + len + 2) { return false; }
+        argv->push_back(buf.substr(pos, len));
+        pos += len + 2;
+    }
+    buf.erase(0, pos);
+    return true;
+}
+
+static std::string RespBulk(const std::string& key) {
+    if(key == "missing") { return "$-1\r\n"; }
+    std::string value = "v_" + key;
+    return "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
+}
+
+/* 假Redis服务端收齐全部命令后才一次回复：客户端须在收到回复前发出所有命令(流水线)，回调/future按发送顺序得到各自的结果 */
+void TestRedisAsync() {
+    int listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = { 0 };
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    assert(bind(listenFd, (struct sockaddr*)&addr, len) == 0 && listen(listenFd, 8) == 0);
+    getsockname(listenFd, (struct sockaddr*)&addr, &len);
+
+    const size_t total = 7;
+    std::vector<std::vector<std::string>> received;
+    std::thread server([listenFd, total, &received] {
+        int fd = accept(listenFd, nullptr, nullptr);
+        std::string in, out;
+        std::vector<std::string> argv;
+        char buf[4096];
+        while(received.size() < total) {
+            ssize_t n = recv(fd, buf, sizeof(buf), 0);
+            if(n <= 0) { break; }
+            in.append(buf, n);
+            while(TakeRespCommand(in, &argv)) { received.push_back(argv); }
+        }
+        for(const auto& cmd: received) {
+            if(cmd[0] == "GET") {
+                out += RespBulk(cmd[1]);
+            } else if(cmd[0] == "MGET") {
+                out += "*" + std::to_string(cmd.size() - 1) + "\r\n";
+                for(size_t i = 1; i < cmd.size(); i++) { out += RespBulk(cmd[i]); }
+            } else if(cmd[0] == "MSET") {
+                out += "+OK\r\n";
+            } else {
+                out += ":1\r\n";
+            }
+        }
+        send(fd, out.data(), out.size(), 0);
+        while(recv(fd, buf, sizeof(buf), 0) > 0) {}  // 等客户端关闭
+        close(fd);
+    });
+
+    Epoller epoller;
+    RedisAsync redis(&epoller);
+    assert(redis.Init("127.0.0.1", ntohs(addr.sin_port), 1));
+    std::vector<int> order;
+    std::future<RedisValue> fut;
+    redis.Get("k0", [&order](const RedisValue& v) {
+        assert(v.ok && !v.nil && v.str == "v_k0");
+        order.push_back(0);
+    });
+    redis.Get("k1", [&order](const RedisValue& v) {
+        assert(v.ok && v.str == "v_k1");
+        order.push_back(1);
+    });
+    redis.MSet({ {"a", "1"}, {"b", "2"} }, [&order](const RedisValue& v) {
+        assert(v.ok && v.str == "OK");
+        order.push_back(2);
+    });
+    redis.MGet({ "a", "missing", "b" }, [&order](const RedisValue& v) {
+        assert(v.ok && v.elements.size() == 3);
+        assert(v.elements[0].str == "v_a" && v.elements[1].nil && v.elements[2].str == "v_b");
+        order.push_back(3);
+    });
+    fut = redis.Command({ "GET", "k4" });
+    redis.Del("k5", [&order, &fut](const RedisValue& v) {
+        assert(v.ok && v.integer == 1);
+        assert(fut.wait_for(std::chrono::seconds(0)) == std::future_status::ready);  // 前一条命令的future已完成
+        order.push_back(5);
+    });
+    redis.Get("missing", [&order](const RedisValue& v) {
+        assert(v.ok && v.nil);
+        order.push_back(6);
+    });
+
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(2);
+    while(order.size() < total - 1 && std::chrono::steady_clock::now() < deadline) {
+        int n = epoller.Wait(100);
+        for(int i = 0; i < n; i++) {
+            assert(redis.HandleEvent(epoller.GetEventFd(i), epoller.GetEvents(i)));
+        }
+    }
+    assert((order == std::vector<int>{ 0, 1, 2, 3, 5, 6 }));
+    RedisValue value = fut.get();
+    assert(value.ok && value.str == "v_k4");
+
+    /* 关闭后的命令立即以失败回调 */
+    redis.Close();
+    bool called = false;
+    redis.Get("k0", [&called](const RedisValue& v) {
+        assert(!v.ok);
+        called = true;
+    });
+    assert(called);
+    server.join();
+    assert(received.size() == total && received[2].size() == 5 && received[2][0] == "MSET");
+    close(listenFd);
+}
+
 int main() {
+    TestCredCache();
+    TestConnSlab();
+    TestCompletionQueue();
+    TestAdmission();
+    TestIpLimiter();
+    TestKeepAlive();
+    TestPipeline();
+    TestCpuAffinity();
+    TestBusyPoll();
+    TestPrefork();
+    TestHotRestart();
+    TestShutdownPendingVerify();
+    TestRedisAsync();
+    TestThreadPoolJoin();
+    TestSession();
+    TestFileCache();
+    TestUserBloom();
+    TestMmapUserStore();
     TestLog();
     TestThreadPool();
 }
\ No newline at end of file